@@ -0,0 +1,57 @@
+#!/bin/bash
+# A batch runner's view of the compile cache: a set of generated jobs of
+# FUNCTIONS functions each, run without the cache, once into an empty
+# cache, then RUNS more times from it. Reports the hits and misses summed
+# from --cache-stats and the mean wall time per start, for both backends.
+# The cache lives in build/bench/cache, through ALGO_CACHE_DIR.
+
+. "$(dirname "$0")/lib.sh"
+
+SCRIPTS=${SCRIPTS:-20}
+FUNCTIONS=${FUNCTIONS:-200}
+mkdir -p "$OUT/jobs"
+export ALGO_CACHE_DIR="$OUT/cache"
+
+make -s >/dev/null
+
+for ((s = 0; s < SCRIPTS; s++)); do
+    awk -v n="$FUNCTIONS" -v s="$s" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "fn step%d(a) {\n", i
+            printf "  let total = 0\n"
+            printf "  while a > 0 { total = total + a * %d  a = a - 1 }\n", s + i
+            printf "  return total + %d\n", i
+            printf "}\n"
+        }
+        printf "print step0(10)\n"
+        printf "print step%d(20)\n", n - 1
+    }' > "$OUT/jobs/job$s.algo"
+done
+
+# Runs every job `passes` times; prints hits, misses and the mean ms per start.
+run_jobs() {
+    local passes=$1
+    shift
+    local stats="$OUT/cache-stats.txt"
+    : > "$stats"
+    local start=$(date +%s%N)
+    for ((p = 0; p < passes; p++)); do
+        for f in "$OUT"/jobs/*.algo; do
+            ./algolang --cache-stats "$@" "$f" 2>>"$stats" >/dev/null
+        done
+    done
+    local end=$(date +%s%N)
+    awk -v ns=$((end - start)) -v starts=$((passes * SCRIPTS)) '
+        $1 == "hits" { hits += $2 }
+        $1 == "misses" { misses += $2 }
+        END { printf "%8d %8d %10.2f\n", hits, misses, ns / 1e6 / starts }' "$stats"
+}
+
+printf "%-10s %-12s %8s %8s %10s\n" "backend" "cache" "hits" "misses" "ms/start"
+for mode in "" --registers; do
+    backend=${mode#--}
+    rm -rf "$ALGO_CACHE_DIR"
+    printf "%-10s %-12s %s\n" "${backend:-stack}" "off" "$(run_jobs "$RUNS" --no-cache $mode)"
+    printf "%-10s %-12s %s\n" "${backend:-stack}" "cold" "$(run_jobs 1 $mode)"
+    printf "%-10s %-12s %s\n" "${backend:-stack}" "warm" "$(run_jobs "$RUNS" $mode)"
+done
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Compares switch and computed-goto dispatch on the bench workloads.
+# Reports wall time, dispatched opcode count and time per dispatch.
+
+. "$(dirname "$0")/lib.sh"
+
+build() {
+    make -s DISPATCH="$1" STATS="$2" JIT=0 BUILD_DIR="$OUT/obj-$1-$2" TARGET="$OUT/algolang-$1-$2" >/dev/null 2>&1
+}
+
+dispatches() {
+    "$1" "$2" 2>&1 >/dev/null | awk '$1 == "total" { print $2 }'
+}
+
+for mode in switch threaded; do
+    build "$mode" 0
+    build "$mode" 1
+done
+
+printf "%-22s %-9s %10s %14s %12s\n" "workload" "dispatch" "best ms" "dispatches" "ns/dispatch"
+for script in bench/fib.algo bench/primes.algo examples/fib.algo examples/primes.algo; do
+    count=$(dispatches "$OUT/algolang-switch-1" "$script")
+    for mode in switch threaded; do
+        ms=$(best_ms "$OUT/algolang-$mode-0" "$script")
+        ns=$(awk -v ms="$ms" -v n="$count" 'BEGIN { printf "%.2f", n ? ms * 1e6 / n : 0 }')
+        printf "%-22s %-9s %10s %14s %12s\n" "$script" "$mode" "$ms" "$count" "$ns"
+    done
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Feeds the REPL a generated session that keeps a large set of functions
+# alive while redefining others, so every collection has live data to mark
+# and garbage to sweep, and reports the p50/p99/max collection pause for
+# stop-the-world collection (--gc-budget 0) and a few pause budgets.
+# --eager compiles the functions as they are defined, as none is called.
+
+. "$(dirname "$0")/lib.sh"
+
+LIVE=${LIVE:-20000}
+LINES=${LINES:-20000}
+
+make -s >/dev/null
+
+awk -v live="$LIVE" -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < live; i++) printf "fn keep%d(x) { return x + %d }\n", i, i
+    for (i = 0; i < lines; i++) printf "fn churn%d(x) { return x * %d + keep%d(x) }\n", i % 50, i, i % live
+}' > "$OUT/gc-session.txt"
+
+printf "%-10s %8s %8s %10s %10s %10s\n" "budget" "cycles" "pauses" "p50 ms" "p99 ms" "max ms"
+for budget in 0 1000 200 50; do
+    ./algolang --eager --gc-stats --gc-budget "$budget" < "$OUT/gc-session.txt" 2>&1 >/dev/null |
+        awk -v b="$budget" '
+            $1 == "collections" { c = $2 }
+            $1 == "pauses" { n = $2 }
+            $1 == "p50" { p50 = $3 }
+            $1 == "p99" { p99 = $3 }
+            $1 == "max" { m = $3 }
+            END { printf "%-10s %8s %8s %10s %10s %10s\n", b "us", c, n, p50, p99, m }'
+done
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Compares the interpreter with the baseline JIT, alone and with loop
+# traces, on the fib, primes and sorting workloads. The examples/ scripts call each function only a few
+# times, so most of their work never reaches JIT_THRESHOLD; the bench/
+# versions repeat the same functions until they are hot.
+
+. "$(dirname "$0")/lib.sh"
+
+make -s >/dev/null
+
+printf "%-24s %10s %10s %10s %9s\n" "workload" "no-jit ms" "no-trace" "jit ms" "speedup"
+for name in fib primes sorting; do
+    for f in "examples/$name.algo" "bench/$name.algo"; do
+        ./algolang --no-jit "$f" > "$OUT/interpreted.out"
+        ./algolang --jit "$f" > "$OUT/jit.out"
+        cmp -s "$OUT/interpreted.out" "$OUT/jit.out" || { echo "output differs: $f"; exit 1; }
+        
+        before=$(best_ms ./algolang --no-jit "$f")
+        baseline=$(best_ms ./algolang --jit --no-trace "$f")
+        after=$(best_ms ./algolang --jit "$f")
+        speedup=$(awk -v b="$before" -v a="$after" 'BEGIN { printf "%.2fx", a ? b / a : 0 }')
+        printf "%-24s %10s %10s %10s %9s\n" "$f" "$before" "$baseline" "$after" "$speedup"
+    done
+done
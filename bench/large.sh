@@ -0,0 +1,55 @@
+#!/bin/bash
+# Generates a ~1 MB script with tens of thousands of globals and constants
+# and branch/loop bodies far larger than 64 KiB, then checks its output.
+# Exercises the _LONG constant, global and jump encodings.
+
+. "$(dirname "$0")/lib.sh"
+
+COUNT=${COUNT:-30000}
+SCRIPT="$OUT/large.algo"
+
+make -s >/dev/null
+
+awk -v n="$COUNT" 'BEGIN {
+    for (i = 0; i < n; i++) printf "let g%d = %d\n", i, i % 10
+    print "fn weigh(x) {"
+    print "  let acc = 0"
+    print "  if x > 0 {"
+    for (i = 0; i < n; i += 3) printf "    acc = acc + g%d * x\n", i
+    print "  } else {"
+    print "    acc = -1"
+    print "  }"
+    print "  return acc"
+    print "}"
+    print "let sum = 0"
+    print "let round = 0"
+    print "while round < 3 {"
+    print "  if round < 10 {"
+    for (i = 0; i < n; i++) printf "    sum = sum + g%d\n", i
+    print "  }"
+    print "  round = round + 1"
+    print "}"
+    print "print sum"
+    print "print weigh(2)"
+    print "print weigh(0)"
+}' > "$SCRIPT"
+
+# Values stay small so the totals print exactly with print's %g format.
+expected_sum=0
+for ((i = 0; i < COUNT; i++)); do expected_sum=$(( expected_sum + 3 * (i % 10) )); done
+weighed=0
+for ((i = 0; i < COUNT; i += 3)); do weighed=$(( weighed + 2 * (i % 10) )); done
+
+printf "%s: %d bytes\n" "$SCRIPT" "$(wc -c < "$SCRIPT")"
+start=$(date +%s%N)
+actual=$(./algolang "$SCRIPT")
+end=$(date +%s%N)
+expected=$(printf "%s\n%s\n%s" "$expected_sum" "$weighed" "-1")
+
+if [ "$actual" != "$expected" ]; then
+    echo "output differs"
+    echo "expected: $expected"
+    echo "actual:   $actual"
+    exit 1
+fi
+echo "ok ($(( (end - start) / 1000000 )) ms)"
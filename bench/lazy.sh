@@ -0,0 +1,47 @@
+#!/bin/bash
+# Startup time and memory with function bodies compiled on their first
+# call (the default) and all up front (--eager): a generated script that
+# defines FUNCTIONS helpers and calls two of them, and the examples. The
+# cache is off so every run compiles. Times are the best of BATCHES
+# batches of RUNS runs, per run; "code" is the bytecode held at exit.
+
+RUNS=${RUNS:-10}
+. "$(dirname "$0")/lib.sh"
+
+FUNCTIONS=${FUNCTIONS:-5000}
+
+make -s >/dev/null
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fn helper%d(a, b) {\n", i
+        printf "  let total = 0\n"
+        printf "  let i = 0\n"
+        printf "  while i < a {\n"
+        printf "    if i %% 3 == 0 { total = total + b * i } else { total = total - %d }\n", i
+        printf "    i = i + 1\n"
+        printf "  }\n"
+        printf "  return total + %d\n", i
+        printf "}\n"
+    }
+    print "print helper0(10, 2)"
+    printf "print helper%d(100, 3)\n", n - 1
+}' > "$OUT/lazy.algo"
+
+# Prints one --gc-stats field: stat <name> <args...>
+stat() {
+    local name=$1
+    shift
+    ./algolang --no-cache --gc-stats "$@" 2>&1 >/dev/null |
+        awk -v name="$name" 'index($0, name) == 1 { print $(NF - 1) }'
+}
+
+printf "%-12s %-6s %10s %14s %12s\n" "workload" "mode" "ms/start" "peak rss KiB" "code bytes"
+for f in "$OUT/lazy.algo" examples/*.algo; do
+    name=$(basename "$f" .algo)
+    for mode in "" --eager; do
+        label=${mode#--}
+        printf "%-12s %-6s %10s %14s %12s\n" "$name" "${label:-lazy}" \
+            "$(batch_ms ./algolang --no-cache $mode "$f")" "$(stat "peak rss" $mode "$f")" "$(stat "code " $mode "$f")"
+    done
+done
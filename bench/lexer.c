@@ -0,0 +1,75 @@
+/*
+ * Lexer-only throughput, built by bench/lexer.sh against
+ * src/lexer/lexer.c alone. Each file named on the command line is read
+ * into memory and tokenized RUNS times with every scan the CPU supports;
+ * the best run is reported in MB/s.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/algo_token.h"
+
+#define RUNS 30
+
+static const char* scan_names[] = {"scalar", "sse2", "avx2"};
+
+static double now_ms() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static char* read_source(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\"\n", path);
+        exit(74);
+    }
+    fseek(file, 0L, SEEK_END);
+    *size = (size_t)ftell(file);
+    rewind(file);
+    char* source = malloc(*size + 1);
+    if (source == NULL || fread(source, 1, *size, file) < *size) {
+        fprintf(stderr, "Could not read file \"%s\"\n", path);
+        exit(74);
+    }
+    source[*size] = '\0';
+    fclose(file);
+    return source;
+}
+
+/* Tokens in the source; the count keeps the loop from being optimized away. */
+static size_t lex(const char* source) {
+    Lexer lexer;
+    lexer_init(&lexer, source);
+    size_t tokens = 0;
+    while (lexer_next_token(&lexer).type != TOKEN_EOF) tokens++;
+    return tokens;
+}
+
+int main(int argc, const char* argv[]) {
+    printf("%-20s %8s %10s %8s %10s\n", "source", "MB", "tokens", "scan", "MB/s");
+    for (int i = 1; i < argc; i++) {
+        size_t size;
+        char* source = read_source(argv[i], &size);
+        for (LexerScan scan = LEXER_SCALAR; scan <= LEXER_AVX2; scan++) {
+            lexer_set_scan(scan);
+            if (lexer_get_scan() != scan) continue;
+            
+            double best = 0;
+            size_t tokens = 0;
+            for (int run = 0; run < RUNS; run++) {
+                double start = now_ms();
+                tokens = lex(source);
+                double ms = now_ms() - start;
+                if (run == 0 || ms < best) best = ms;
+            }
+            const char* name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+            printf("%-20s %8.1f %10zu %8s %10.0f\n", name, size / 1e6, tokens,
+                   scan_names[scan], size / 1e3 / best);
+        }
+        free(source);
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+# Builds bench/lexer.c against the lexer alone and reports its throughput
+# in MB/s on three generated sources of about SIZE_MB each: ordinary
+# code, heavily indented and commented code, and long identifiers and
+# numbers. Each is lexed with the scalar character tables and with every
+# vector scan the CPU supports.
+
+. "$(dirname "$0")/lib.sh"
+
+SIZE_MB=${SIZE_MB:-8}
+
+gcc -O2 -std=c11 -Iinclude bench/lexer.c src/lexer/lexer.c -o "$OUT/lexer"
+
+bytes=$((SIZE_MB * 1000000))
+
+awk -v bytes="$bytes" 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        line = sprintf("fn f%d(a, b, c) {\n", i)
+        line = line sprintf("  let x = a * 2 + b - c / 3 + %d\n", i)
+        line = line "  if x > 10 and b < 5 {\n"
+        line = line sprintf("    x = f%d(x, a + 1, b * (c - 2))\n", i)
+        line = line "  } else {\n"
+        line = line "    x = -x + 4.5 * 2\n"
+        line = line "  }\n"
+        line = line "  while x > 100 { x = x - 1 }\n"
+        line = line sprintf("  return x + f%d(a - 1, b, c)\n", i)
+        line = line "}\n"
+        printf "%s", line
+        size += length(line)
+    }
+}' > "$OUT/lex-code.algo"
+
+awk -v bytes="$bytes" 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        line = "# ------------------------------------------------------------------------\n"
+        line = line sprintf("# step%d: walks the table and folds each entry into the running total,\n", i)
+        line = line "# skipping entries that were already counted by an earlier step.\n"
+        line = line sprintf("fn step%d(table, total) {\n", i)
+        line = line "        let i = 0\n"
+        line = line "        while i < 10 {\n"
+        line = line "                # Only even entries count.\n"
+        line = line "                if i % 2 == 0 {\n"
+        line = line "                        total = total + table[i]\n"
+        line = line "                }\n"
+        line = line "                i = i + 1\n"
+        line = line "        }\n"
+        line = line "        return total\n"
+        line = line "}\n"
+        printf "%s", line
+        size += length(line)
+    }
+}' > "$OUT/lex-comments.algo"
+
+awk -v bytes="$bytes" 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        line = sprintf("let accumulated_interest_for_account_number_%d = principal_balance_before_adjustment * 1.000273972602739726 + 31415926535897932384626433 * %d\n", i, i)
+        line = line sprintf("print accumulated_interest_for_account_number_%d + monthly_service_charge_waived_for_customers\n", i)
+        printf "%s", line
+        size += length(line)
+    }
+}' > "$OUT/lex-names.algo"
+
+"$OUT/lexer" "$OUT/lex-code.algo" "$OUT/lex-comments.algo" "$OUT/lex-names.algo"
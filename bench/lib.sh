@@ -0,0 +1,40 @@
+# Sourced by the bench scripts: runs from the repository root and keeps
+# builds and generated workloads under build/bench. A script that wants
+# other defaults for RUNS or BATCHES sets them before sourcing this.
+
+set -e
+cd "$(dirname "$0")/.."
+
+RUNS=${RUNS:-5}
+BATCHES=${BATCHES:-5}
+OUT=build/bench
+mkdir -p "$OUT"
+
+# Prints the best wall time in ms of RUNS runs of a command.
+best_ms() {
+    local best=""
+    for ((r = 0; r < RUNS; r++)); do
+        local start=$(date +%s%N)
+        "$@" >/dev/null
+        local end=$(date +%s%N)
+        local ms=$(( (end - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then best=$ms; fi
+    done
+    echo "$best"
+}
+
+# For runs too short to time one by one: the best of BATCHES batches of
+# RUNS runs, in ms per run with two decimals.
+batch_ms() {
+    local best=""
+    for ((b = 0; b < BATCHES; b++)); do
+        local start=$(date +%s%N)
+        for ((r = 0; r < RUNS; r++)); do
+            "$@" >/dev/null
+        done
+        local end=$(date +%s%N)
+        local us=$(( (end - start) / 1000 / RUNS ))
+        if [ -z "$best" ] || [ "$us" -lt "$best" ]; then best=$us; fi
+    done
+    awk -v us="$best" 'BEGIN { printf "%.2f", us / 1000 }'
+}
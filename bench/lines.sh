@@ -0,0 +1,42 @@
+#!/bin/bash
+# Reports the bytecode and line table bytes of live functions at exit
+# (--gc-stats) for the stack and register backends, on a generated
+# ~100k-line script of function definitions and on the examples and
+# bench workloads. "int per unit" is what one int per code byte (stack)
+# or per instruction (registers) would take.
+
+. "$(dirname "$0")/lib.sh"
+
+FUNCTIONS=${FUNCTIONS:-10000}
+
+make -s >/dev/null
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fn f%d(a, b, c) {\n", i
+        printf "  let x = a * 2 + b - c / 3 + %d\n", i
+        printf "  if x > 10 and b < 5 {\n"
+        printf "    x = f%d(x, a + 1, b * (c - 2))\n", i
+        printf "  } else {\n"
+        printf "    x = -x + 4 * 2\n"
+        printf "  }\n"
+        printf "  while x > 100 { x = x - 1 }\n"
+        printf "  return x + f%d(a - 1, b, c)\n", i
+        printf "}\n"
+    }
+    print "print 1"
+}' > "$OUT/lines.algo"
+
+printf "%-24s %-12s %10s %12s %14s\n" "workload" "backend" "code" "line table" "int per unit"
+for f in "$OUT/lines.algo" examples/*.algo bench/*.algo; do
+    for mode in "" --registers; do
+        ./algolang --gc-stats $mode "$f" 2>&1 >/dev/null |
+            awk -v f="$(basename "$f")" -v mode="${mode:-stack}" '
+                $1 == "code" { code = $2 }
+                $1 == "line" && $2 == "tables" { lines = $3 }
+                END {
+                    unit = mode == "stack" ? 4 * code : code
+                    printf "%-24s %-12s %10d %12d %14d\n", f, mode, code, lines, unit
+                }'
+    done
+done
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Feeds the REPL a generated session in which every line redefines a few
+# functions that call helpers under fresh names, so most name strings die
+# with the function they were compiled into. Compares the nursery with
+# plain malloc (--gc-nursery 0): best wall time, minor collections and
+# their p50/p99/max pause, and the bytes promoted out of the nursery.
+# The functions are never called, so --eager compiles them as they are
+# defined.
+
+. "$(dirname "$0")/lib.sh"
+
+LINES=${LINES:-40000}
+
+make -s >/dev/null
+
+awk -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < lines; i++)
+        printf "fn g%d(x) { if x < 0 { return tmp%d(x) + aux%d(x) } return x }\n", i % 8, i, i
+    print "print g0(1)"
+}' > "$OUT/nursery-session.txt"
+
+session() {
+    ./algolang --eager "$@" < "$OUT/nursery-session.txt"
+}
+
+printf "%-10s %9s %8s %10s %10s %10s %12s\n" \
+    "nursery" "best ms" "minors" "p50 ms" "p99 ms" "max ms" "promoted"
+for kb in 0 64 256 1024; do
+    ms=$(best_ms session --gc-nursery "$kb")
+    session --gc-stats --gc-nursery "$kb" 2>&1 >/dev/null |
+        awk -v kb="$kb" -v ms="$ms" '
+            $1 == "minor" && $2 == "gcs" { n = $3 }
+            $1 == "minor" && $2 == "p50" { p50 = $3 }
+            $1 == "minor" && $2 == "p99" { p99 = $3 }
+            $1 == "minor" && $2 == "max" { m = $3 }
+            $1 == "promoted" { p = $2 }
+            END { printf "%-10s %9s %8s %10s %10s %10s %12s\n", kb "KB", ms, n + 0, p50, p99, m, p + 0 }'
+done
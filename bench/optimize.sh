@@ -0,0 +1,23 @@
+#!/bin/bash
+# Reports how many instruction dispatches each -O level saves on the
+# examples and bench workloads, and the best-of-N wall time at -O0 and
+# the default -O2 (interpreter only).
+
+. "$(dirname "$0")/lib.sh"
+
+make -s STATS=1 BUILD_DIR="$OUT/obj-stats" TARGET="$OUT/algolang-stats" >/dev/null 2>&1
+make -s >/dev/null
+
+dispatches() {
+    "$OUT/algolang-stats" "$@" 2>&1 >/dev/null | awk '$1 == "total" { print $2 }'
+}
+
+printf "%-22s %12s %12s %12s %7s %8s %8s\n" "workload" "-O0" "-O1" "-O2" "saved" "O0 ms" "O2 ms"
+for f in examples/*.algo bench/*.algo; do
+    o0=$(dispatches -O0 "$f")
+    o1=$(dispatches -O1 "$f")
+    o2=$(dispatches -O2 "$f")
+    saved=$(awk -v b="$o0" -v a="$o2" 'BEGIN { printf "%.1f%%", b ? 100 * (b - a) / b : 0 }')
+    printf "%-22s %12s %12s %12s %7s %8s %8s\n" "$f" "$o0" "$o1" "$o2" "$saved" \
+        "$(best_ms ./algolang --no-jit -O0 "$f")" "$(best_ms ./algolang --no-jit -O2 "$f")"
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Generates a ~100k-line script of function definitions that are never
+# called and reports the best time to parse it and to compile it, at -O0
+# and -O2 and for the register backend. --eager compiles the bodies, which
+# would otherwise wait for a call. A copy ending in a syntax error stops
+# after parsing, so compile time is the full run minus that.
+
+. "$(dirname "$0")/lib.sh"
+
+FUNCTIONS=${FUNCTIONS:-10000}
+
+make -s >/dev/null
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fn f%d(a, b, c) {\n", i
+        printf "  let x = a * 2 + b - c / 3 + %d\n", i
+        printf "  if x > 10 and b < 5 {\n"
+        printf "    x = f%d(x, a + 1, b * (c - 2))\n", i
+        printf "  } else {\n"
+        printf "    x = -x + 4 * 2\n"
+        printf "  }\n"
+        printf "  while x > 100 { x = x - 1 }\n"
+        printf "  return x + f%d(a - 1, b, c)\n", i
+        printf "}\n"
+    }
+    print "print 1"
+}' > "$OUT/parse.algo"
+{ cat "$OUT/parse.algo"; echo ")"; } > "$OUT/parse-error.algo"
+
+# The copy with the syntax error fails, which is expected.
+compile() {
+    ./algolang --no-cache --eager "$@" >/dev/null 2>&1 || true
+}
+
+echo "$(wc -l < "$OUT/parse.algo") lines"
+printf "%-14s %10s %10s %10s\n" "mode" "parse ms" "compile ms" "total ms"
+for mode in -O0 -O2 --registers; do
+    parse=$(best_ms compile "$mode" "$OUT/parse-error.algo")
+    total=$(best_ms compile "$mode" "$OUT/parse.algo")
+    printf "%-14s %10s %10s %10s\n" "$mode" "$parse" "$((total - parse))" "$total"
+done
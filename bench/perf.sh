@@ -0,0 +1,27 @@
+#!/bin/bash
+# Counts instructions, loads and stores of the interpreter (JIT off) on the
+# examples and bench workloads with `perf stat`, plus best wall time. Run it
+# on two checkouts to compare interpreter changes; without perf only the
+# times are reported.
+
+. "$(dirname "$0")/lib.sh"
+
+EVENTS=instructions,L1-dcache-loads,L1-dcache-stores
+
+make -s >/dev/null
+
+# Prints instructions, loads and stores, or dashes when perf is missing.
+counters() {
+    if ! command -v perf >/dev/null; then
+        echo "- - -"
+        return
+    fi
+    perf stat -x, -e "$EVENTS" ./algolang --no-jit "$1" 2>&1 >/dev/null |
+        awk -F, '{ v[NR] = $1 } END { print v[1], v[2], v[3] }'
+}
+
+printf "%-24s %14s %14s %14s %9s\n" "workload" "instructions" "loads" "stores" "best ms"
+for f in examples/*.algo bench/*.algo; do
+    read -r insns loads stores <<< "$(counters "$f")"
+    printf "%-24s %14s %14s %14s %9s\n" "$f" "$insns" "$loads" "$stores" "$(best_ms ./algolang --no-jit "$f")"
+done
@@ -0,0 +1,75 @@
+/*
+ * Allocate/free churn through pool_alloc() and through malloc, built by
+ * bench/pools.sh against src/runtime/pool.c alone. A working set of
+ * LIVE objects with the sizes of function, native and short string
+ * headers is replaced at random, touching each new object once.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/algo_memory.h"
+
+#define LIVE 100000
+#define ROUNDS 20000000
+
+static const size_t sizes[] = {144, 24, 48, 56, 64, 48, 144, 40};
+
+static void* live[LIVE];
+static size_t live_size[LIVE];
+
+static double now_ms() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t next_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double churn(bool pools) {
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < LIVE; i++) {
+        live_size[i] = sizes[i % 8];
+        live[i] = pools ? pool_alloc(live_size[i]) : malloc(live_size[i]);
+        memset(live[i], 0, live_size[i]);
+    }
+    
+    double start = now_ms();
+    for (int round = 0; round < ROUNDS; round++) {
+        uint32_t r = next_random(&state);
+        int slot = r % LIVE;
+        if (pools) {
+            pool_free(live[slot], live_size[slot]);
+        } else {
+            free(live[slot]);
+        }
+        live_size[slot] = sizes[(r >> 24) % 8];
+        live[slot] = pools ? pool_alloc(live_size[slot]) : malloc(live_size[slot]);
+        *(size_t*)live[slot] = round;
+    }
+    double elapsed = now_ms() - start;
+    
+    for (int i = 0; i < LIVE; i++) {
+        if (pools) {
+            pool_free(live[i], live_size[i]);
+        } else {
+            free(live[i]);
+        }
+    }
+    return elapsed;
+}
+
+int main() {
+    double with_malloc = churn(false);
+    double with_pools = churn(true);
+    printf("%-8s %10s %12s\n", "", "total ms", "ns/pair");
+    printf("%-8s %10.1f %12.2f\n", "malloc", with_malloc, with_malloc * 1e6 / ROUNDS);
+    printf("%-8s %10.1f %12.2f\n", "pools", with_pools, with_pools * 1e6 / ROUNDS);
+    free_pools();
+    return 0;
+}
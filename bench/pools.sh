@@ -0,0 +1,9 @@
+#!/bin/bash
+# Builds bench/pools.c against the object pools alone and compares their
+# allocate/free churn with glibc malloc. `--gc-stats` shows the pools'
+# occupancy for a real program.
+
+. "$(dirname "$0")/lib.sh"
+
+gcc -O2 -std=c11 -Iinclude bench/pools.c src/runtime/pool.c -o "$OUT/pools"
+"$OUT/pools"
@@ -0,0 +1,19 @@
+#!/bin/bash
+# Compares generic and quickened arithmetic in the interpreter. The JIT is
+# off for both runs so that every instruction goes through dispatch.
+
+. "$(dirname "$0")/lib.sh"
+
+make -s >/dev/null
+
+printf "%-24s %10s %10s %9s\n" "workload" "generic ms" "quick ms" "speedup"
+for f in bench/arithmetic.algo bench/fib.algo bench/primes.algo bench/sorting.algo; do
+    ./algolang --no-jit --no-quicken "$f" > "$OUT/generic.out"
+    ./algolang --no-jit "$f" > "$OUT/quick.out"
+    cmp -s "$OUT/generic.out" "$OUT/quick.out" || { echo "output differs: $f"; exit 1; }
+
+    before=$(best_ms ./algolang --no-jit --no-quicken "$f")
+    after=$(best_ms ./algolang --no-jit "$f")
+    speedup=$(awk -v b="$before" -v a="$after" 'BEGIN { printf "%.2fx", a ? b / a : 0 }')
+    printf "%-24s %10s %10s %9s\n" "$f" "$before" "$after" "$speedup"
+done
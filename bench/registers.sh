@@ -0,0 +1,35 @@
+#!/bin/bash
+# Compares the stack interpreter with the register VM (--registers) on the
+# examples and bench workloads: dispatched instructions from a STATS=1
+# build and best wall time from a normal one. Both are built without the
+# JIT so every instruction of either VM goes through dispatch.
+
+. "$(dirname "$0")/lib.sh"
+
+build() {
+    make -s STATS="$1" JIT=0 BUILD_DIR="$OUT/obj-registers-$1" TARGET="$OUT/algolang-registers-$1" >/dev/null 2>&1
+}
+
+dispatches() {
+    "$OUT/algolang-registers-1" "$@" 2>&1 >/dev/null | awk '$1 == "total" { print $2 }'
+}
+
+build 0
+build 1
+
+printf "%-24s %12s %12s %7s %9s %9s %8s\n" \
+    "workload" "stack ops" "reg ops" "ratio" "stack ms" "reg ms" "speedup"
+for f in examples/*.algo bench/*.algo; do
+    "$OUT/algolang-registers-0" "$f" > "$OUT/stack.out"
+    "$OUT/algolang-registers-0" --registers "$f" > "$OUT/registers.out"
+    cmp -s "$OUT/stack.out" "$OUT/registers.out" || { echo "output differs: $f"; exit 1; }
+
+    stack_ops=$(dispatches "$f")
+    reg_ops=$(dispatches --registers "$f")
+    stack_ms=$(best_ms "$OUT/algolang-registers-0" "$f")
+    reg_ms=$(best_ms "$OUT/algolang-registers-0" --registers "$f")
+    ratio=$(awk -v s="$stack_ops" -v r="$reg_ops" 'BEGIN { printf "%.2f", s ? r / s : 0 }')
+    speedup=$(awk -v s="$stack_ms" -v r="$reg_ms" 'BEGIN { printf "%.2fx", r ? s / r : 0 }')
+    printf "%-24s %12s %12s %7s %9s %9s %8s\n" \
+        "$f" "$stack_ops" "$reg_ops" "$ratio" "$stack_ms" "$reg_ms" "$speedup"
+done
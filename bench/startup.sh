@@ -0,0 +1,47 @@
+#!/bin/bash
+# Cold start of short scripts run from source, from the compile cache and
+# from a precompiled .algoc file, for both backends: a generated
+# cron-style job that defines many helper functions but calls few of them,
+# and the examples. Each time is the best of BATCHES batches of RUNS runs,
+# per run, so process start dominates small scripts.
+
+RUNS=${RUNS:-20}
+. "$(dirname "$0")/lib.sh"
+
+FUNCTIONS=${FUNCTIONS:-2000}
+CACHE="$OUT/startup-cache"
+rm -rf "$CACHE"
+
+make -s >/dev/null
+
+awk -v n="$FUNCTIONS" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fn task%d(a, b) {\n", i
+        printf "  let total = 0\n"
+        printf "  let i = 0\n"
+        printf "  while i < a {\n"
+        printf "    if i %% 3 == 0 { total = total + b * i } else { total = total - %d }\n", i
+        printf "    i = i + 1\n"
+        printf "  }\n"
+        printf "  return total + %d\n", i
+        printf "}\n"
+    }
+    print "print task0(10, 2)"
+    printf "print task%d(100, 3)\n", n - 1
+}' > "$OUT/startup.algo"
+
+printf "%-20s %-10s %8s %8s %10s %10s %10s\n" "workload" "backend" "source" "algoc" \
+    "ms .algo" "ms cached" "ms .algoc"
+for f in "$OUT/startup.algo" examples/*.algo; do
+    name=$(basename "$f" .algo)
+    for mode in "" --registers; do
+        backend=${mode#--}
+        compiled="$OUT/$name${mode:+-$backend}.algoc"
+        ./algolang $mode -o "$compiled" "$f"
+        ALGO_CACHE_DIR="$CACHE" ./algolang $mode "$f" >/dev/null
+        printf "%-20s %-10s %8d %8d %10s %10s %10s\n" "$name" "${backend:-stack}" \
+            "$(stat -c %s "$f")" "$(stat -c %s "$compiled")" \
+            "$(batch_ms ./algolang --no-cache $mode "$f")" \
+            "$(ALGO_CACHE_DIR="$CACHE" batch_ms ./algolang $mode "$f")" "$(batch_ms ./algolang "$compiled")"
+    done
+done
@@ -0,0 +1,36 @@
+#!/bin/bash
+# The strings a program makes are the names it interns while compiling, so
+# the string-heavy workload is a generated script of NAMES globals, each
+# defined by a function whose name is also new, and read back once. Reports
+# best wall time with the nursery and with plain malloc (--gc-nursery 0),
+# on the stack interpreter and on registers, plus the objects allocated,
+# minor collections and bytes allocated young and promoted. The cache is
+# off and --eager compiles every body, so each run interns every name.
+
+. "$(dirname "$0")/lib.sh"
+
+NAMES=${NAMES:-50000}
+WORKLOAD="$OUT/strings.algo"
+
+make -s >/dev/null
+
+awk -v n="$NAMES" 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "fn make_value_number_%d(seed) { return seed * 2 + 1 }\n", i
+        printf "let stored_value_number_%d = make_value_number_%d(%d)\n", i, i, i % 10
+    }
+    printf "print stored_value_number_0 + stored_value_number_%d\n", n - 1
+}' > "$WORKLOAD"
+
+printf "%-24s %9s %10s %8s %12s %10s\n" \
+    "mode" "best ms" "objects" "minors" "young" "promoted"
+for mode in "" "--gc-nursery 0" "--registers" "--registers --gc-nursery 0"; do
+    ms=$(best_ms ./algolang --no-cache --eager $mode "$WORKLOAD")
+    ./algolang --no-cache --eager --gc-stats $mode "$WORKLOAD" 2>&1 >/dev/null |
+        awk -v mode="${mode:-default}" -v ms="$ms" '
+            $1 == "objects" { o = $2 }
+            $1 == "minor" && $2 == "gcs" { n = $3 }
+            $1 == "young" && $2 == "allocated" { y = $3 }
+            $1 == "promoted" { p = $2 }
+            END { printf "%-24s %9s %10s %8s %12s %10s\n", mode, ms, o + 0, n + 0, y + 0, p + 0 }'
+done
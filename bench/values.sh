@@ -0,0 +1,25 @@
+#!/bin/bash
+# Compares the tagged-struct and NaN-boxed Value representations.
+# Reports best-of-N wall time on the bench workloads for each build.
+
+. "$(dirname "$0")/lib.sh"
+
+build() {
+    make -s VALUE="$1" JIT=0 BUILD_DIR="$OUT/obj-value-$1" TARGET="$OUT/algolang-value-$1" >/dev/null 2>&1
+}
+
+build tagged
+build nanbox
+
+for f in examples/*.algo bench/*.algo; do
+    "$OUT/algolang-value-tagged" "$f" > "$OUT/tagged.out"
+    "$OUT/algolang-value-nanbox" "$f" > "$OUT/nanbox.out"
+    cmp -s "$OUT/tagged.out" "$OUT/nanbox.out" || { echo "output differs: $f"; exit 1; }
+done
+
+printf "%-22s %10s %10s\n" "workload" "tagged ms" "nanbox ms"
+for script in bench/*.algo; do
+    printf "%-22s %10s %10s\n" "$script" \
+        "$(best_ms "$OUT/algolang-value-tagged" "$script")" \
+        "$(best_ms "$OUT/algolang-value-nanbox" "$script")"
+done
@@ -70,8 +70,11 @@ typedef struct {
     Expr* right;
 } LogicalExpr;
 
+/* Nodes keep the line and column of their token for runtime errors (see the parser). */
 struct Expr {
     ExprType type;
+    int line;
+    int column;
     union {
         LiteralExpr literal;
         UnaryExpr unary;
@@ -127,6 +130,9 @@ typedef struct {
     size_t param_count;
     Stmt** body;
     size_t body_count;
+    /* The declaration's source, from `fn` to the closing brace. */
+    const char* text;
+    size_t text_length;
 } FunctionStmt;
 
 typedef struct {
@@ -139,6 +145,8 @@ typedef struct {
 
 struct Stmt {
     StmtType type;
+    int line;
+    int column;
     union {
         ExprStmt expr_stmt;
         LetStmt let_stmt;
@@ -176,8 +184,18 @@ Stmt* new_function_stmt(Token name, Token* params, size_t param_count, Stmt** bo
 Stmt* new_return_stmt(Expr* value);
 Stmt* new_print_stmt(Expr* expression);
 
-void free_expr(Expr* expr);
-void free_stmt(Stmt* stmt);
+/*
+ * Nodes, the arrays they point to and the Program itself are carved out
+ * of one chunked arena, so a tree is never freed node by node:
+ * free_program() drops the whole arena at once, keeping its first chunk
+ * for the next program.
+ */
+void* ast_alloc(size_t size);
+/* Resizes an arena array, in place when it is the newest allocation. */
+void* ast_grow(void* array, size_t old_size, size_t new_size);
 void free_program(Program* program);
+void free_ast();
+
+void optimize_program(Program* program);
 
 #endif
@@ -30,7 +30,131 @@ typedef enum {
     OP_JUMP_IF_FALSE,
     OP_LOOP,
     OP_CALL,
-    OP_RETURN
+    OP_RETURN,
+    OP_TAIL_CALL,
+    OP_CONSTANT_LONG,
+    OP_GET_GLOBAL_LONG,
+    OP_DEFINE_GLOBAL_LONG,
+    OP_SET_GLOBAL_LONG,
+    OP_JUMP_LONG,
+    OP_JUMP_IF_FALSE_LONG,
+    OP_LOOP_LONG,
+    OP_GREATER_EQUAL,
+    OP_LESS_EQUAL,
+    OP_NOT_EQUAL,
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_EQUAL,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_ADD_LOCALS,
+    OP_LESS_LOCAL_CONSTANT,
+    
+    /*
+     * Quickened forms. The compiler never emits these: the interpreter
+     * writes them over an arithmetic or comparison instruction in
+     * ObjFunction.code once its operands were numbers, and writes the
+     * generic opcode back if a later execution sees anything else.
+     */
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_MODULO_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER,
+    OP_GREATER_EQUAL_NUMBER,
+    OP_LESS_EQUAL_NUMBER,
+    OP_JUMP_IF_LESS_NUMBER,
+    OP_JUMP_IF_NOT_LESS_NUMBER,
+    OP_JUMP_IF_GREATER_NUMBER,
+    OP_JUMP_IF_NOT_GREATER_NUMBER
 } OpCode;
 
+#define OP_COUNT (OP_JUMP_IF_NOT_GREATER_NUMBER + 1)
+
+/* Largest constant index or global slot a _LONG instruction can encode. */
+#define MAX_LONG_INDEX 0xffffff
+
+/*
+ * Static description of each opcode: its mnemonic, its encoded length in
+ * bytes (opcode plus operands), its net effect on the value stack and
+ * whether its operand is a forward (1) or backward (-1) jump offset.
+ * The effect of OP_CALL and OP_TAIL_CALL depends on their operand; see
+ * instruction_stack_effect().
+ */
+typedef struct {
+    const char* name;
+    int length;
+    int stack_effect;
+    int jump;
+} OpInfo;
+
+extern const OpInfo op_info[OP_COUNT];
+
+int instruction_stack_effect(const uint8_t* ip);
+bool instruction_jump_target(const uint8_t* ip, size_t offset, size_t* target);
+int chunk_max_stack(const Chunk* chunk, int initial_depth);
+
+/*
+ * A chunk decoded into one entry per instruction. Opcodes are stored in
+ * their short form, operands are widened to 32 bits and a jump operand
+ * holds the index of the instruction it lands on, so a pass can add or
+ * drop instructions without tracking byte offsets. encode_chunk() picks
+ * the short or _LONG encoding of every instruction when writing it back.
+ */
+typedef struct {
+    uint8_t op;
+    uint32_t operand;
+    int line;
+    int column;
+} Instruction;
+
+typedef struct {
+    Instruction* code;
+    int count;
+    int capacity;
+} InstructionList;
+
+/* A forward jump whose distance did not fit its 16-bit operand. */
+typedef struct {
+    size_t offset;
+    size_t target;
+} JumpPatch;
+
+void optimize_instructions(InstructionList* list);
+void decode_chunk(const Chunk* chunk, const JumpPatch* patches, int patch_count,
+                  InstructionList* list);
+void encode_chunk(Chunk* chunk, const InstructionList* list);
+void free_instruction_list(InstructionList* list);
+
+/*
+ * Compiled programs saved as .algoc files (serialize.c): the functions
+ * reachable from a script with their constants and line tables, and one
+ * table of the strings they name. A loaded file is mapped into memory and
+ * its code runs from there; ALGOC_VERSION changes whenever the layout does.
+ */
+#define ALGOC_MAGIC "ALGC"
+#define ALGOC_VERSION 1
+
+bool is_bytecode_file(const char* path);
+/* Replaces `path` in one step, so concurrent readers never see part of a file. */
+bool write_bytecode_file(ObjFunction* script, const char* path, bool report);
+/* The loaded script, or NULL when the file cannot be used, saying why if `report`. */
+ObjFunction* load_bytecode_file(const char* path, bool report);
+void mark_loader_roots();
+void unload_bytecode_file();
+
+/*
+ * Compiled scripts kept in a cache directory under a hash of their source
+ * and compile settings (cache.c), so a script run again unchanged is
+ * loaded from its .algoc file instead of compiled. `stats` prints hits,
+ * misses and the time each step took once the script is ready.
+ */
+void set_compile_cache(bool enabled, bool stats);
+/* The script compiled with the chosen backend; NULL after a compile error. */
+ObjFunction* compile_cached(const char* source, bool registers);
+void free_compile_cache();
+
 #endif
@@ -7,6 +7,24 @@
 
 #define ALGO_VERSION "0.2.0"
 
+#if defined(__GNUC__) && !defined(ALGO_NO_COMPUTED_GOTO)
+#define ALGO_COMPUTED_GOTO
+#endif
+
+/* The baseline JIT emits x86-64 code for the tagged-struct Value layout. */
+#if defined(__x86_64__) && defined(__linux__) && !defined(ALGO_NAN_BOXING) && !defined(ALGO_NO_JIT)
+#define ALGO_JIT
+#endif
+
+/*
+ * The lexer skips runs of characters with SSE2, and AVX2 where the CPU has
+ * it. Its vector loads may read past the end of the source within a page,
+ * which AddressSanitizer reports, so its builds scan byte by byte.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ALGO_NO_SIMD) && !defined(__SANITIZE_ADDRESS__)
+#define ALGO_SIMD_LEXER
+#endif
+
 typedef enum {
     ALGO_OK = 0,
     ALGO_ERROR_SYNTAX,
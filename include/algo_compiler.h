@@ -4,6 +4,7 @@
 #include "algo_common.h"
 #include "algo_ast.h"
 #include "algo_value.h"
+#include "algo_bytecode.h"
 
 typedef struct {
     Token name;
@@ -23,8 +24,20 @@ typedef struct Compiler {
     Local locals[256];
     int local_count;
     int scope_depth;
+    
+    JumpPatch* jump_patches;
+    int jump_patch_count;
+    int jump_patch_capacity;
 } Compiler;
 
 ObjFunction* compile(const char* source);
+ObjFunction* compile_registers(const char* source);
+void set_optimize_level(int level);
+int get_optimize_level();
+void set_lazy_functions(bool enabled);
+bool get_lazy_functions();
+/* Compiles a function that has not run yet (algo_value.h); may collect. False if it cannot. */
+bool compile_pending(ObjFunction* function);
+void mark_compiler_roots();
 
 #endif
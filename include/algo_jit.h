@@ -0,0 +1,87 @@
+#ifndef ALGO_JIT_H
+#define ALGO_JIT_H
+
+#include "algo_common.h"
+#include "algo_value.h"
+#include "algo_vm.h"
+
+/* Calls a function makes before its chunk is compiled to native code. */
+#define JIT_THRESHOLD 100
+
+/* Native frames nested on the C stack; deeper calls stay in the interpreter. */
+#define JIT_MAX_DEPTH 1024
+
+/*
+ * What native code reports when it hands control back. JIT_RETURNED
+ * means the frame finished and its result is on the stack, exactly as
+ * after OP_RETURN. JIT_BAILED means the frame is still live: its ip
+ * and the stack top are up to date and the interpreter picks it up at
+ * that instruction.
+ */
+typedef enum {
+    JIT_RETURNED,
+    JIT_BAILED,
+    JIT_ERROR
+} JitStatus;
+
+typedef JitStatus (*JitFunction)(VM* vm);
+
+/* Backedges a loop takes before one iteration of it is recorded as a trace. */
+#define TRACE_THRESHOLD 50
+
+/* Longest trace, in instructions; longer iterations abort the recording. */
+#define TRACE_MAX_LENGTH 256
+
+/* Aborted recordings after which a loop is blacklisted. */
+#define TRACE_MAX_ABORTS 3
+
+/* Entries after which a trace averaging under one iteration per entry is dropped. */
+#define TRACE_PROBATION 100
+
+/*
+ * A loop header seen at an OP_LOOP backedge, keyed by (function, header)
+ * in the trace cache. Compiled code holds pointers to these, so they
+ * are never moved, and only freed with the function that owns that code.
+ */
+typedef struct {
+    ObjFunction* function;
+    uint8_t* header;
+    
+    /* Backedges left before recording; the baseline JIT counts it down too. */
+    int countdown;
+    int aborts;
+    bool blacklisted;
+    JitFunction trace;
+    
+    /* Updated by the trace itself. */
+    uint64_t entries;
+    uint64_t iterations;
+    uint64_t guard_exits;
+    uint64_t branch_exits;
+} LoopTrace;
+
+#ifdef ALGO_JIT
+bool jit_compile(ObjFunction* function);
+void free_jit();
+
+/* Runtime entry points the generated code calls back into (vm.c). */
+int jit_call(int arg_count);
+
+/* Set while one loop iteration is being recorded (trace.c). */
+extern bool trace_recording;
+
+LoopTrace* find_loop(ObjFunction* function, uint8_t* header);
+JitFunction loop_backedge(VM* vm, CallFrame* frame);
+void record_instruction(VM* vm, CallFrame* frame);
+void abort_recording();
+void print_trace_stats();
+void free_traces();
+
+/*
+ * The cache holds functions weakly: once marking is final, loops of
+ * functions it left unmarked are freed along with their traces.
+ */
+void sweep_traces();
+#endif
+
+#endif
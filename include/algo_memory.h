@@ -0,0 +1,85 @@
+#ifndef ALGO_MEMORY_H
+#define ALGO_MEMORY_H
+
+#include "algo_common.h"
+#include "algo_value.h"
+
+/* Heap size below which no collection runs. */
+#define GC_HEAP_MIN (1024 * 1024)
+#define GC_GROWTH_DEFAULT 2.0
+/* Longest a collection step may run, in microseconds; 0 collects all at once. */
+#define GC_BUDGET_DEFAULT 500
+/* Objects marked or swept between checks of the clock. */
+#define GC_STEP_OBJECTS 32
+#define GC_NURSERY_SIZE (256 * 1024)
+/* Old objects up to this size come from per-size-class slabs (pool.c). */
+#define POOL_MAX_SIZE 256
+#define POOL_SLAB_SIZE (16 * 1024)
+
+/*
+ * Every object is linked into one list when allocated. Once the heap has
+ * grown to `growth` times its live size after the previous collection, a
+ * cycle starts: it marks from the VM stack and frames, globals, the
+ * compilers' functions in progress, the functions of a bytecode file
+ * being loaded and traced loops, then frees whatever it did not reach.
+ * The work is spread over later allocations in steps
+ * of at most `budget_us` microseconds. Strings and arrays start in a
+ * nursery of `nursery_kb` and are copied out by minor collections
+ * (memory.c).
+ */
+Obj* allocate_object(size_t size, ObjType type);
+/* Counts growth of an object's arrays toward the next collection; never collects. */
+void count_bytes(size_t bytes);
+void mark_object(Obj* object);
+void mark_value(Value value);
+void collect_garbage();
+void set_gc(double growth, long budget_us, long nursery_kb, bool stats);
+void free_objects();
+
+/*
+ * True while a cycle is marking. Storing a value into a global or an
+ * object that may already be marked must go through write_barrier(), so
+ * the collector cannot miss it.
+ */
+extern bool gc_marking;
+
+static inline void write_barrier(Value value) {
+    if (gc_marking) mark_value(value);
+}
+
+/*
+ * A store of `value` into a field of `owner`: write_barrier(), and
+ * remembers an old owner that now points at a young object so the next
+ * minor collection updates it.
+ */
+void object_barrier(Obj* owner, Value value);
+
+/*
+ * Minor collections move young objects, so roots that may hold one are
+ * updated in place through these rather than marked.
+ */
+bool is_young(Obj* object);
+void forward_object(Obj** slot);
+void forward_value(Value* slot);
+
+/*
+ * The old space's allocator. `size` must be the same when freeing as when
+ * allocating; objects larger than POOL_MAX_SIZE fall through to malloc.
+ */
+void* pool_alloc(size_t size);
+void pool_free(void* pointer, size_t size);
+void print_pool_stats();
+/* Frees every slab; all pooled objects must be dead. */
+void free_pools();
+
+/*
+ * The string intern table (value.c) holds its strings weakly: once
+ * marking is done, this drops up to `limit` entries' worth of unmarked
+ * strings and returns true when it has been through the whole table.
+ */
+bool clear_white_strings(int limit);
+/* A young string was copied to `survivor`, or died when that is NULL. */
+void intern_moved(ObjString* string, ObjString* survivor);
+void free_string_table();
+
+#endif
@@ -14,6 +14,8 @@ typedef struct {
 } Parser;
 
 void parser_init(Parser* parser, const char* source);
+/* For source that starts at `line` and `column` of a larger text. */
+void parser_init_at(Parser* parser, const char* source, int line, int column);
 Program* parse(Parser* parser);
 
 #endif
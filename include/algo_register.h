@@ -0,0 +1,86 @@
+#ifndef ALGO_REGISTER_H
+#define ALGO_REGISTER_H
+
+#include "algo_common.h"
+#include "algo_ast.h"
+#include "algo_value.h"
+#include "algo_vm.h"
+
+/*
+ * Register bytecode: an alternative to the stack bytecode in
+ * algo_bytecode.h, compiled from the same AST (src/bytecode/registers.c)
+ * and run by its own interpreter (src/vm/registers.c). Every instruction
+ * is one 32-bit word:
+ *
+ *     | B (9) | C (9) | A (8) | op (6) |     or     | Bx (18) | A (8) | op (6) |
+ *
+ * A names a register of the current frame. B and C are "RK" operands:
+ * below RK_CONSTANT they name a register, otherwise the constant
+ * RK_CONSTANT + k. Bx is an unsigned constant or global index; jumps use
+ * it as a signed offset biased by MAX_SBX, counted in words from the next
+ * instruction.
+ *
+ * A frame's registers live on the VM's value stack exactly where a stack
+ * frame's slots would: register 0 holds the callee, then the parameters,
+ * then locals in declaration order, then temporaries.
+ */
+typedef enum {
+    R_MOVE,         /* A B     R[A] = R[B] */
+    R_LOADK,        /* A Bx    R[A] = K[Bx] */
+    R_LOADNIL,      /* A       R[A] = nil */
+    R_LOADBOOL,     /* A B     R[A] = B != 0 */
+    R_GETGLOBAL,    /* A Bx    R[A] = G[Bx] */
+    R_SETGLOBAL,    /* A Bx    G[Bx] = R[A], which must be defined */
+    R_DEFGLOBAL,    /* A Bx    G[Bx] = R[A] */
+    R_ADD,          /* A B C   R[A] = RK(B) + RK(C) */
+    R_SUB,
+    R_MUL,
+    R_DIV,
+    R_MOD,
+    R_NEG,          /* A B     R[A] = -R[B] */
+    R_NOT,          /* A B     R[A] = is_falsey(R[B]) */
+    R_EQ,           /* A B C   R[A] = RK(B) == RK(C) */
+    R_NE,
+    R_LT,           /* A B C   R[A] = RK(B) < RK(C) */
+    R_GT,
+    R_GE,           /* A B C   R[A] = !(RK(B) < RK(C)) */
+    R_LE,           /* A B C   R[A] = !(RK(B) > RK(C)) */
+    R_JMP,          /* sBx     pc += sBx */
+    R_IFEQ,         /* A B C   if ((RK(B) == RK(C)) == A) take the R_JMP that follows, else skip it */
+    R_IFLT,         /* A B C   same, with RK(B) < RK(C) */
+    R_IFGT,         /* A B C   same, with RK(B) > RK(C) */
+    R_TEST,         /* A B     same, with R[B] being truthy */
+    R_CALL,         /* A B     R[A] = R[A](R[A+1], ..., R[A+B]) */
+    R_TAILCALL,     /* A B     return R[A](R[A+1], ..., R[A+B]) */
+    R_RETURN,       /* A B     return B ? R[A] : nil */
+    R_PRINT         /* A       print R[A] */
+} RegisterOpCode;
+
+#define R_OP_COUNT (R_PRINT + 1)
+
+#define RK_CONSTANT 256
+#define MAX_REGISTERS 256
+#define MAX_BX ((1 << 18) - 1)
+#define MAX_SBX (MAX_BX >> 1)
+
+#define GET_OP(i) ((i) & 0x3f)
+#define GET_A(i)  (((i) >> 6) & 0xff)
+#define GET_C(i)  (((i) >> 14) & 0x1ff)
+#define GET_B(i)  ((i) >> 23)
+#define GET_BX(i) ((i) >> 14)
+#define GET_SBX(i) ((int)GET_BX(i) - MAX_SBX)
+
+#define ENCODE_ABC(op, a, b, c) \
+    ((uint32_t)(op) | ((uint32_t)(a) << 6) | ((uint32_t)(c) << 14) | ((uint32_t)(b) << 23))
+#define ENCODE_ABX(op, a, bx) ((uint32_t)(op) | ((uint32_t)(a) << 6) | ((uint32_t)(bx) << 14))
+
+extern const char* const register_op_names[R_OP_COUNT];
+
+/* Compiles a parsed program to register bytecode; NULL after a compile error. */
+ObjFunction* compile_program_registers(Program* program);
+void mark_register_compiler_roots();
+
+InterpretResult run_registers(VM* vm, ObjFunction* script);
+void free_register_vm();
+
+#endif
@@ -76,6 +76,16 @@ typedef struct {
     int column;
 } Lexer;
 
+/* How the lexer skips runs of blanks, comment bodies, identifiers and digits. */
+typedef enum {
+    LEXER_SCALAR,
+    LEXER_SSE2,
+    LEXER_AVX2
+} LexerScan;
+
+/* Uses `scan`, or the widest narrower one the CPU supports; lexer_init() picks the widest. */
+void lexer_set_scan(LexerScan scan);
+LexerScan lexer_get_scan();
 void lexer_init(Lexer* lexer, const char* source);
 Token lexer_next_token(Lexer* lexer);
 const char* token_type_name(TokenType type);
@@ -1,20 +1,73 @@
 #ifndef ALGO_VALUE_H
 #define ALGO_VALUE_H
 
+#include <string.h>
 #include "algo_common.h"
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+typedef struct ObjFunction ObjFunction;
+typedef struct ObjNative ObjNative;
+
+#ifdef ALGO_NAN_BOXING
+
+/*
+ * A Value is a single 64-bit word. Doubles are stored as-is; every other
+ * value lives inside the payload of a quiet NaN. The extra 0x0004 bit keeps
+ * clear of the Intel "real indefinite" NaN produced by 0/0, so arithmetic
+ * can never forge a tagged value. Objects set the sign bit and keep their
+ * 48-bit pointer in the low bits; nil/false/true use small tags.
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT  ((uint64_t)0x8000000000000000)
+#define QNAN      ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1
+#define TAG_FALSE 2
+#define TAG_TRUE  3
+#define TAG_UNDEFINED 4
+
+#define NIL_VAL          ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define FALSE_VAL        ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL         ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define UNDEFINED_VAL    ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define BOOL_VAL(b)      ((b) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(num)  num_to_value(num)
+#define OBJ_VAL(obj)     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+#define IS_NIL(value)    ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_BOOL(value)   (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value)   ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+#define AS_OBJ(value)    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+static inline double value_to_num(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value num_to_value(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 typedef enum {
     VAL_NIL,
     VAL_BOOL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_UNDEFINED
 } ValueType;
 
-typedef struct Obj Obj;
-typedef struct ObjString ObjString;
-typedef struct ObjFunction ObjFunction;
-typedef struct ObjNative ObjNative;
-
 typedef struct {
     ValueType type;
     union {
@@ -28,6 +81,7 @@ typedef struct {
 #define IS_BOOL(value)   ((value).type == VAL_BOOL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)    ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_BOOL(value)   ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
@@ -37,6 +91,9 @@ typedef struct {
 #define BOOL_VAL(val)    ((Value){VAL_BOOL, {.boolean = val}})
 #define NUMBER_VAL(val)  ((Value){VAL_NUMBER, {.number = val}})
 #define OBJ_VAL(object)  ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+#define UNDEFINED_VAL    ((Value){VAL_UNDEFINED, {.number = 0}})
+
+#endif
 
 typedef enum {
     OBJ_STRING,
@@ -47,16 +104,45 @@ typedef enum {
 
 struct Obj {
     ObjType type;
+    bool marked;
+    /* In the collector's remembered set (algo_memory.h). */
+    bool remembered;
     struct Obj* next;
 };
 
+/* The characters follow the header, so a string is a single allocation. */
 struct ObjString {
     Obj obj;
     size_t length;
-    char* chars;
     uint32_t hash;
+    char chars[];
 };
 
+/*
+ * Source positions of a chunk's code, run-length encoded: a run starts
+ * wherever the line or column changes. Each is stored as varints: its
+ * distance in code units from the previous run, then either the column
+ * change on the same line or the line change and the new column, so a
+ * run on the same line usually takes two bytes. Only errors read it back.
+ */
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+    /* The last run added, which the next one is relative to. */
+    size_t offset;
+    int line;
+    int column;
+} LineTable;
+
+/* Reads a LineTable forward, for offsets that never decrease. */
+typedef struct {
+    size_t read;
+    size_t offset;
+    int line;
+    int column;
+} LineCursor;
+
 typedef struct {
     uint8_t* code;
     size_t count;
@@ -64,14 +150,55 @@ typedef struct {
     Value* constants;
     size_t constant_count;
     size_t constant_capacity;
-    int* lines;
+    LineTable lines;
 } Chunk;
 
+/*
+ * Instructions from the register backend (algo_register.h). A function
+ * compiled that way keeps its constants in chunk.constants and leaves
+ * the rest of the chunk empty.
+ */
+typedef struct {
+    uint32_t* code;
+    LineTable lines;
+    int count;
+    int capacity;
+    int frame_size;
+} RegisterCode;
+
+/*
+ * A function whose body has not been compiled yet keeps a copy of its
+ * declaration, from `fn` to the closing brace, and where that starts in
+ * the script; compile_pending() compiles it on the first call.
+ */
+typedef struct {
+    char* text;
+    size_t length;
+    int line;
+    int column;
+} PendingSource;
+
 struct ObjFunction {
     Obj obj;
     int arity;
+    int max_slots;
+    int call_count;
+    void* native;
     Chunk chunk;
+    
+    /*
+     * The instructions frames execute: a copy of chunk.code that the
+     * interpreter quickens in place, so the chunk stays as compiled.
+     */
+    uint8_t* code;
+    RegisterCode registers;
     ObjString* name;
+    
+    /* Code and line tables point into a loaded .algoc file rather than the heap. */
+    bool mapped;
+    
+    /* NULL once the function is compiled. */
+    PendingSource* pending;
 };
 
 typedef Value (*NativeFn)(int arg_count, Value* args);
@@ -106,12 +233,20 @@ static inline bool is_obj_type(Value value, ObjType type) {
 }
 
 void init_chunk(Chunk* chunk);
-void write_chunk(Chunk* chunk, uint8_t byte, int line);
-int add_constant(Chunk* chunk, Value value);
+void write_chunk(Chunk* chunk, uint8_t byte, int line, int column);
+/* Appends to `function`'s constant table, through object_barrier(). */
+int add_constant(ObjFunction* function, Value value);
 void free_chunk(Chunk* chunk);
 
+void init_line_table(LineTable* table);
+/* Records that code from `offset` on comes from `line` and `column`. */
+void add_position(LineTable* table, size_t offset, int line, int column);
+/* Moves `cursor` (zeroed to start) to the run holding `offset`; line 0 before any run. */
+void find_position(const LineTable* table, size_t offset, LineCursor* cursor);
+void free_line_table(LineTable* table);
+
 ObjString* copy_string(const char* chars, size_t length);
-ObjString* take_string(char* chars, size_t length);
+
 ObjFunction* new_function();
 ObjNative* new_native(NativeFn function);
 ObjArray* new_array();
@@ -4,8 +4,14 @@
 #include "algo_common.h"
 #include "algo_value.h"
 
-#define STACK_MAX 256
-#define FRAMES_MAX 64
+#define STACK_INITIAL 256
+#define FRAMES_INITIAL 64
+
+/* Frames shown at each end of a runtime error trace. */
+#define TRACE_EDGE 10
+
+#define STACK_MAX_DEFAULT (1 << 22)
+#define FRAMES_MAX_DEFAULT (1 << 18)
 
 typedef struct {
     ObjFunction* function;
@@ -13,16 +19,54 @@ typedef struct {
     Value* slots;
 } CallFrame;
 
+/*
+ * Both stacks start small and are reallocated on demand up to their
+ * limits. Growing the value stack moves it, so every frame's `slots`
+ * pointer is rebased when that happens.
+ */
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame* frames;
     int frame_count;
+    int frame_capacity;
+    int frame_limit;
     
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stack_top;
+    size_t stack_capacity;
+    size_t stack_limit;
+    
+    /* When false, OP_TAIL_CALL pushes a frame like OP_CALL so traces stay complete. */
+    bool tail_calls;
+    
+    /* When true, arithmetic and comparisons that only see numbers are quickened. */
+    bool quicken;
+    
+    /* When true, functions called JIT_THRESHOLD times are compiled to native code. */
+    bool jit;
+    
+    /* When true, hot loops are recorded and compiled as traces; trace_stats reports them at exit. */
+    bool traces;
+    bool trace_stats;
+    
+    /* When true, programs are compiled to register bytecode and run by run_registers(). */
+    bool registers;
     
     Obj* objects;
 } VM;
 
+/*
+ * Global variables, indexed by the slot the compiler assigns to each name.
+ * Slots that have not been defined yet hold UNDEFINED_VAL.
+ */
+typedef struct {
+    Value* values;
+    ObjString** names;
+    int count;
+    int capacity;
+} GlobalSlots;
+
+extern GlobalSlots global_slots;
+
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
@@ -31,9 +75,28 @@ typedef enum {
 
 void init_vm();
 void free_vm();
+void set_stack_limits(size_t max_values, int max_frames);
+void set_tail_calls(bool enabled);
+void set_quicken(bool enabled);
+void set_jit(bool enabled);
+void set_traces(bool enabled, bool stats);
+void set_registers(bool enabled);
 InterpretResult interpret(const char* source);
+/* Runs a compiled script with whichever VM its code was compiled for. */
+InterpretResult run_script(ObjFunction* script);
 
 void push(Value value);
 Value pop();
 
+int global_slot(ObjString* name);
+bool global_get(ObjString* key, Value* value);
+void global_set(ObjString* key, Value value);
+bool global_delete(ObjString* key);
+void free_globals();
+
+void mark_vm_roots();
+bool mark_globals(int* cursor, int limit);
+void forward_vm_roots();
+void forward_globals();
+
 #endif
@@ -0,0 +1,134 @@
+#ifndef ALGO_X64_H
+#define ALGO_X64_H
+
+#include "algo_common.h"
+#include "algo_value.h"
+#include "algo_vm.h"
+
+#ifdef ALGO_JIT
+
+/*
+ * x86-64 encoder and the value-stack templates shared by the baseline
+ * compiler (jit.c) and the trace compiler (trace.c). Generated code keeps
+ * the interpreter's state in callee-saved registers and reads and writes
+ * the value stack in memory, so it can hand a frame back at any
+ * instruction boundary.
+ */
+
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+enum { XMM0, XMM1, XMM2 };
+
+#define REG_SLOTS     RBX
+#define REG_TOP       R12
+#define REG_VM        R13
+#define REG_FRAME     R14
+#define REG_CONSTANTS R15
+
+/* Condition codes for Jcc/SETcc after ucomisd, cmp and test. */
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+#define CC_S  0x8
+#define CC_P  0xA
+
+#define VALUE_SIZE  ((int32_t)sizeof(Value))
+#define TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define AS_OFFSET   ((int32_t)offsetof(Value, as))
+
+/* Stack operand n counted from the top: 0 is the topmost value. */
+#define TOP(n) (-((n) + 1) * VALUE_SIZE)
+
+/*
+ * Where a rel32 operand points. TO_INSTRUCTION and TO_BAIL carry a
+ * bytecode offset: the native code of that instruction, or a stub that
+ * hands the frame to the interpreter there. TO_EXIT is a trace leaving
+ * its recorded path, which is counted apart from bails.
+ */
+typedef enum {
+    TO_INSTRUCTION,
+    TO_BAIL,
+    TO_EXIT,
+    TO_EPILOGUE,
+    TO_ERROR
+} FixupKind;
+
+typedef struct {
+    size_t at;
+    FixupKind kind;
+    size_t offset;
+} Fixup;
+
+typedef struct {
+    uint8_t* code;
+    size_t count;
+    size_t capacity;
+    
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+} Assembler;
+
+void init_assembler(Assembler* as);
+void free_assembler(Assembler* as);
+
+void emit8(Assembler* as, uint8_t byte);
+void emit32(Assembler* as, uint32_t value);
+void emit64(Assembler* as, uint64_t value);
+void patch32(Assembler* as, size_t at, uint32_t value);
+void add_fixup(Assembler* as, FixupKind kind, size_t offset);
+
+void emit_op_mem(Assembler* as, uint8_t prefix, bool wide, int opcode,
+                 int reg, int base, int32_t disp);
+void emit_op_reg(Assembler* as, uint8_t prefix, bool wide, int opcode, int reg, int rm);
+void emit_mov_imm64(Assembler* as, int reg, uint64_t value);
+void emit_mov_imm32(Assembler* as, int reg, uint32_t value);
+void emit_add_imm(Assembler* as, int reg, int32_t value);
+void emit_call(Assembler* as, void* function);
+void emit_jump(Assembler* as, FixupKind kind, size_t offset);
+void emit_jcc(Assembler* as, int cc, FixupKind kind, size_t offset);
+size_t emit_jcc8(Assembler* as, int cc);
+void patch_jcc8(Assembler* as, size_t at);
+
+void emit_load(Assembler* as, int reg, int base, int32_t disp);
+void emit_store(Assembler* as, int base, int32_t disp, int reg);
+void emit_store_imm32(Assembler* as, int base, int32_t disp, uint32_t value, bool wide);
+
+/* Frame entry and exit shared by every compiled function and trace. */
+void emit_prologue(Assembler* as, Value* constants);
+size_t emit_epilogue(Assembler* as);
+void emit_reload(Assembler* as);
+void emit_sync(Assembler* as, uint8_t* ip);
+
+/* Value-stack templates; `checked` adds the number checks that bail at `bail`. */
+void emit_copy_value(Assembler* as, int dst_base, int32_t dst, int src_base, int32_t src);
+void emit_push_value(Assembler* as, int base, int32_t disp);
+void emit_push_literal(Assembler* as, ValueType type, uint32_t payload);
+void emit_store_bool_from_al(Assembler* as, int base, int32_t disp);
+void emit_write_barrier(Assembler* as, int base, int32_t disp);
+void emit_bail_if_type(Assembler* as, int base, int32_t disp, int cc, ValueType type,
+                       FixupKind kind, size_t bail);
+void emit_check_numbers(Assembler* as, size_t bail);
+void emit_falsey_to_ecx(Assembler* as);
+void emit_values_equal(Assembler* as);
+void emit_arithmetic(Assembler* as, int opcode, bool checked, size_t bail);
+void emit_modulo(Assembler* as, bool checked, size_t bail);
+void emit_compare(Assembler* as, bool swap, int cc, bool checked, size_t bail);
+void emit_compare_pop(Assembler* as, bool swap, bool checked, size_t bail);
+
+uint32_t read_operand(const uint8_t* ip);
+
+/* Copies the assembled code into executable memory owned until free_code(). */
+void* install_code(Assembler* as);
+
+/* Unmaps code from install_code() whose function has been collected. */
+void release_code(void* code);
+void free_code();
+
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_compiler.h"
+#include "../../include/algo_register.h"
+
+/*
+ * A script's compiled form is stored as <hash>.algoc, where the hash
+ * covers its source and everything else that changes the code compiled
+ * from it: the backend, the optimization level and the bytecode version.
+ * An edited script, or the same one compiled differently, gets a file of
+ * its own. Files are only ever replaced whole (write_bytecode_file()), so
+ * processes sharing a directory need no locking; when two miss at once,
+ * both compile and the last rename wins.
+ */
+static char* directory = NULL;
+static bool stats = false;
+
+static int hits = 0;
+static int misses = 0;
+static int stores = 0;
+static double hash_ms = 0;
+static double load_ms = 0;
+static double compile_ms = 0;
+static double store_ms = 0;
+
+static double now_ms() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* ALGO_CACHE_DIR, else $XDG_CACHE_HOME/algolang, else ~/.cache/algolang; NULL if none. */
+static char* find_directory() {
+    const char* override = getenv("ALGO_CACHE_DIR");
+    if (override != NULL) return *override != '\0' ? strdup(override) : NULL;
+    
+    const char* base = getenv("XDG_CACHE_HOME");
+    const char* suffix = "/algolang";
+    if (base == NULL || *base == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache/algolang";
+        if (base == NULL || *base == '\0') return NULL;
+    }
+    char* path = malloc(strlen(base) + strlen(suffix) + 1);
+    strcpy(path, base);
+    strcat(path, suffix);
+    return path;
+}
+
+void set_compile_cache(bool enabled, bool print_stats) {
+    free(directory);
+    directory = enabled ? find_directory() : NULL;
+    stats = print_stats;
+}
+
+/* Creates the directory and any missing parents; false if it still does not exist. */
+static bool make_directory(const char* path) {
+    char* partial = strdup(path);
+    for (char* slash = strchr(partial + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(partial, 0755);
+        *slash = '/';
+    }
+    bool made = mkdir(partial, 0755) == 0 || errno == EEXIST;
+    free(partial);
+    return made;
+}
+
+/* 64-bit FNV-1a over the settings, then the source. */
+static uint64_t hash_source(const char* source, bool registers) {
+    uint64_t hash = 14695981039346656037u;
+    uint32_t settings[4] = {ALGOC_VERSION, registers ? R_OP_COUNT : OP_COUNT, registers,
+                            (uint32_t)get_optimize_level()};
+    const uint8_t* bytes = (const uint8_t*)settings;
+    for (size_t i = 0; i < sizeof(settings); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211u;
+    }
+    for (const uint8_t* c = (const uint8_t*)source; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 1099511628211u;
+    }
+    return hash;
+}
+
+static void print_cache_stats() {
+    fprintf(stderr, "== cache stats ==\n");
+    fprintf(stderr, "%-16s %12s\n", "directory", directory != NULL ? directory : "(none)");
+    fprintf(stderr, "%-16s %12d\n", "hits", hits);
+    fprintf(stderr, "%-16s %12d\n", "misses", misses);
+    fprintf(stderr, "%-16s %12d\n", "stores", stores);
+    fprintf(stderr, "%-16s %12.3f ms\n", "hash", hash_ms);
+    fprintf(stderr, "%-16s %12.3f ms\n", "load", load_ms);
+    fprintf(stderr, "%-16s %12.3f ms\n", "compile", compile_ms);
+    fprintf(stderr, "%-16s %12.3f ms\n", "store", store_ms);
+}
+
+ObjFunction* compile_cached(const char* source, bool registers) {
+    ObjFunction* script = NULL;
+    char* path = NULL;
+    double start = now_ms();
+    
+    if (directory != NULL) {
+        uint64_t hash = hash_source(source, registers);
+        path = malloc(strlen(directory) + 32);
+        sprintf(path, "%s/%016" PRIx64 ".algoc", directory, hash);
+        hash_ms += now_ms() - start;
+        
+        /*
+         * A missing, stale or damaged file is a miss; compiling replaces it.
+         * The quiet load refuses a truncated file or one whose operands point
+         * outside its tables before any of it runs.
+         */
+        start = now_ms();
+        script = load_bytecode_file(path, false);
+        load_ms += now_ms() - start;
+        if (script != NULL) {
+            hits++;
+        } else {
+            misses++;
+        }
+    }
+    
+    if (script == NULL) {
+        /* A stored file needs every function compiled, so a miss compiles them all at once. */
+        bool lazy = get_lazy_functions();
+        if (path != NULL) set_lazy_functions(false);
+        start = now_ms();
+        script = registers ? compile_registers(source) : compile(source);
+        compile_ms += now_ms() - start;
+        set_lazy_functions(lazy);
+        
+        if (script != NULL && path != NULL) {
+            start = now_ms();
+            if (make_directory(directory) && write_bytecode_file(script, path, false)) stores++;
+            store_ms += now_ms() - start;
+        }
+    }
+    
+    free(path);
+    if (stats) print_cache_stats();
+    return script;
+}
+
+void free_compile_cache() {
+    free(directory);
+    directory = NULL;
+}
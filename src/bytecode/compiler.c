@@ -4,21 +4,29 @@
 #include "../../include/algo_compiler.h"
 #include "../../include/algo_parser.h"
 #include "../../include/algo_bytecode.h"
+#include "../../include/algo_vm.h"
+#include "../../include/algo_register.h"
+#include "../../include/algo_memory.h"
 
 typedef struct {
     Parser parser;
     Compiler* current;
     bool had_error;
+    /* Source position the next bytes are recorded at. */
+    int line;
+    int column;
 } CompilerState;
 
 static CompilerState state;
+static int optimize_level = 2;
+static bool lazy_functions = true;
 
 static Chunk* current_chunk() {
     return &state.current->function->chunk;
 }
 
 static void emit_byte(uint8_t byte) {
-    write_chunk(current_chunk(), byte, 0);
+    write_chunk(current_chunk(), byte, state.line, state.column);
 }
 
 static void emit_bytes(uint8_t byte1, uint8_t byte2) {
@@ -31,17 +39,29 @@ static void emit_return() {
     emit_byte(OP_RETURN);
 }
 
-static uint8_t make_constant(Value value) {
-    int constant = add_constant(current_chunk(), value);
-    if (constant > 255) {
-        fprintf(stderr, "Too many constants in one chunk\n");
-        return 0;
+/* Emits a short instruction, or its _LONG form when the index needs 24 bits. */
+static void emit_indexed(uint8_t instruction, uint8_t long_instruction, int index) {
+    if (index <= UINT8_MAX) {
+        emit_bytes(instruction, (uint8_t)index);
+        return;
+    }
+    
+    if (index > MAX_LONG_INDEX) {
+        /* The function is thrown away; index 0 only keeps the chunk well formed. */
+        if (!state.had_error) fprintf(stderr, "Too many constants or globals\n");
+        state.had_error = true;
+        index = 0;
     }
-    return (uint8_t)constant;
+    
+    emit_byte(long_instruction);
+    emit_byte((index >> 16) & 0xff);
+    emit_byte((index >> 8) & 0xff);
+    emit_byte(index & 0xff);
 }
 
 static void emit_constant(Value value) {
-    emit_bytes(OP_CONSTANT, make_constant(value));
+    int constant = add_constant(state.current->function, value);
+    emit_indexed(OP_CONSTANT, OP_CONSTANT_LONG, constant);
 }
 
 static int emit_jump(uint8_t instruction) {
@@ -51,11 +71,26 @@ static int emit_jump(uint8_t instruction) {
     return current_chunk()->count - 2;
 }
 
+/*
+ * A forward jump that lands more than 64 KiB away is recorded and left
+ * for end_compiler() to widen; the common case keeps its 16-bit operand.
+ */
 static void patch_jump(int offset) {
     int jump = current_chunk()->count - offset - 2;
     
     if (jump > 65535) {
-        fprintf(stderr, "Too much code to jump over\n");
+        Compiler* compiler = state.current;
+        if (compiler->jump_patch_capacity < compiler->jump_patch_count + 1) {
+            int old_capacity = compiler->jump_patch_capacity;
+            compiler->jump_patch_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+            compiler->jump_patches = realloc(compiler->jump_patches,
+                                             compiler->jump_patch_capacity * sizeof(JumpPatch));
+        }
+        
+        JumpPatch* patch = &compiler->jump_patches[compiler->jump_patch_count++];
+        patch->offset = offset - 1;
+        patch->target = current_chunk()->count;
+        return;
     }
     
     current_chunk()->code[offset] = (jump >> 8) & 0xff;
@@ -63,30 +98,72 @@ static void patch_jump(int offset) {
 }
 
 static void emit_loop(int loop_start) {
-    emit_byte(OP_LOOP);
+    int offset = current_chunk()->count - loop_start + 3;
     
-    int offset = current_chunk()->count - loop_start + 2;
     if (offset > 65535) {
-        fprintf(stderr, "Loop body too large\n");
+        offset += 2;
+        emit_byte(OP_LOOP_LONG);
+        emit_byte((offset >> 24) & 0xff);
+        emit_byte((offset >> 16) & 0xff);
+        emit_byte((offset >> 8) & 0xff);
+        emit_byte(offset & 0xff);
+        return;
     }
     
+    emit_byte(OP_LOOP);
     emit_byte((offset >> 8) & 0xff);
     emit_byte(offset & 0xff);
 }
 
-static void init_compiler(Compiler* compiler, FunctionType type) {
+/*
+ * Runs the peephole pass and widens the jumps patch_jump() could not
+ * fit. Both work on the decoded instruction list, so the chunk is only
+ * decoded and re-encoded once.
+ */
+static void rewrite_chunk(Compiler* compiler) {
+    bool peephole = optimize_level >= 1;
+    if (!peephole && compiler->jump_patch_count == 0) return;
+    
+    Chunk* chunk = &compiler->function->chunk;
+    InstructionList list;
+    decode_chunk(chunk, compiler->jump_patches, compiler->jump_patch_count, &list);
+    if (peephole) optimize_instructions(&list);
+    encode_chunk(chunk, &list);
+    free_instruction_list(&list);
+    
+    free(compiler->jump_patches);
+    compiler->jump_patches = NULL;
+    compiler->jump_patch_count = 0;
+    compiler->jump_patch_capacity = 0;
+}
+
+/* Compiles into `function`, or a new function when it is NULL. */
+static void init_compiler(Compiler* compiler, FunctionType type, ObjFunction* function) {
     compiler->enclosing = state.current;
     compiler->function = NULL;
     compiler->type = type;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->function = new_function();
+    compiler->jump_patches = NULL;
+    compiler->jump_patch_count = 0;
+    compiler->jump_patch_capacity = 0;
+    compiler->function = function != NULL ? function : new_function();
     state.current = compiler;
+    
+    Local* local = &compiler->locals[compiler->local_count++];
+    local->depth = 0;
+    local->name.start = "";
+    local->name.length = 0;
 }
 
 static ObjFunction* end_compiler() {
     emit_return();
+    rewrite_chunk(state.current);
     ObjFunction* function = state.current->function;
+    function->max_slots = chunk_max_stack(&function->chunk, 1 + function->arity);
+    function->code = malloc(function->chunk.count);
+    count_bytes(function->chunk.count);
+    memcpy(function->code, function->chunk.code, function->chunk.count);
     state.current = state.current->enclosing;
     return function;
 }
@@ -105,8 +182,8 @@ static void end_scope() {
     }
 }
 
-static uint8_t identifier_constant(Token* name) {
-    return make_constant(OBJ_VAL(copy_string(name->start, name->length)));
+static int global_variable(Token* name) {
+    return global_slot(copy_string(name->start, name->length));
 }
 
 static bool identifiers_equal(Token* a, Token* b) {
@@ -138,11 +215,9 @@ static void add_local(Token name) {
     local->depth = -1;
 }
 
-static void declare_variable() {
+static void declare_variable(Token* name) {
     if (state.current->scope_depth == 0) return;
     
-    Token* name = &state.parser.previous;
-    
     for (int i = state.current->local_count - 1; i >= 0; i--) {
         Local* local = &state.current->locals[i];
         if (local->depth != -1 && local->depth < state.current->scope_depth) {
@@ -220,8 +295,10 @@ static void compile_variable(VariableExpr* expr) {
     if (arg != -1) {
         emit_bytes(OP_GET_LOCAL, (uint8_t)arg);
     } else {
-        uint8_t name = identifier_constant(&expr->name);
-        emit_bytes(OP_GET_GLOBAL, name);
+        state.line = expr->name.line;
+        state.column = expr->name.column;
+        int global = global_variable(&expr->name);
+        emit_indexed(OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, global);
     }
 }
 
@@ -232,19 +309,19 @@ static void compile_assign(AssignExpr* expr) {
     if (arg != -1) {
         emit_bytes(OP_SET_LOCAL, (uint8_t)arg);
     } else {
-        uint8_t name = identifier_constant(&expr->name);
-        emit_bytes(OP_SET_GLOBAL, name);
+        int global = global_variable(&expr->name);
+        emit_indexed(OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, global);
     }
 }
 
-static void compile_call(CallExpr* expr) {
+static void compile_call(CallExpr* expr, uint8_t instruction) {
     compile_expr(expr->callee);
     
     for (size_t i = 0; i < expr->arg_count; i++) {
         compile_expr(expr->arguments[i]);
     }
     
-    emit_bytes(OP_CALL, (uint8_t)expr->arg_count);
+    emit_bytes(instruction, (uint8_t)expr->arg_count);
 }
 
 static void compile_logical(LogicalExpr* expr) {
@@ -270,6 +347,18 @@ static void compile_logical(LogicalExpr* expr) {
 }
 
 static void compile_expr(Expr* expr) {
+    int line = state.line;
+    int column = state.column;
+    /*
+     * Literals, locals and `and`/`or` cannot fail themselves, so they stay
+     * in the run of the code around them; compile_variable() moves the
+     * position for a global.
+     */
+    if (expr->type != EXPR_LITERAL && expr->type != EXPR_VARIABLE && expr->type != EXPR_LOGICAL) {
+        state.line = expr->line;
+        state.column = expr->column;
+    }
+    
     switch (expr->type) {
         case EXPR_LITERAL:
             compile_literal(&expr->as.literal);
@@ -287,12 +376,15 @@ static void compile_expr(Expr* expr) {
             compile_assign(&expr->as.assign);
             break;
         case EXPR_CALL:
-            compile_call(&expr->as.call);
+            compile_call(&expr->as.call, OP_CALL);
             break;
         case EXPR_LOGICAL:
             compile_logical(&expr->as.logical);
             break;
     }
+    
+    state.line = line;
+    state.column = column;
 }
 
 static void compile_expr_stmt(ExprStmt* stmt) {
@@ -308,11 +400,11 @@ static void compile_let_stmt(LetStmt* stmt) {
     }
     
     if (state.current->scope_depth > 0) {
-        declare_variable();
+        declare_variable(&stmt->name);
         mark_initialized();
     } else {
-        uint8_t global = identifier_constant(&stmt->name);
-        emit_bytes(OP_DEFINE_GLOBAL, global);
+        int global = global_variable(&stmt->name);
+        emit_indexed(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
     }
 }
 
@@ -356,17 +448,13 @@ static void compile_while_stmt(WhileStmt* stmt) {
     emit_byte(OP_POP);
 }
 
-static void compile_function_stmt(FunctionStmt* stmt) {
+static void compile_function_body(ObjFunction* function, FunctionStmt* stmt) {
     Compiler compiler;
-    init_compiler(&compiler, TYPE_FUNCTION);
+    init_compiler(&compiler, TYPE_FUNCTION, function);
     begin_scope();
     
-    state.current->function->name = copy_string(stmt->name.start, stmt->name.length);
-    state.current->function->arity = stmt->param_count;
-    
     for (size_t i = 0; i < stmt->param_count; i++) {
-        uint8_t constant = identifier_constant(&stmt->params[i]);
-        declare_variable();
+        declare_variable(&stmt->params[i]);
         mark_initialized();
     }
     
@@ -374,20 +462,53 @@ static void compile_function_stmt(FunctionStmt* stmt) {
         compile_stmt(stmt->body[i]);
     }
     
-    ObjFunction* function = end_compiler();
-    emit_bytes(OP_CONSTANT, make_constant(OBJ_VAL(function)));
+    end_compiler();
+}
+
+/*
+ * The function is a constant of the enclosing one before anything else
+ * is allocated, which keeps it reachable. Unless functions are compiled
+ * eagerly, its body is left for compile_pending().
+ */
+static void compile_function_stmt(Stmt* declaration) {
+    FunctionStmt* stmt = &declaration->as.function;
+    ObjFunction* function = new_function();
+    emit_constant(OBJ_VAL(function));
+    
+    function->name = copy_string(stmt->name.start, stmt->name.length);
+    object_barrier((Obj*)function, OBJ_VAL(function->name));
+    function->arity = stmt->param_count;
+    
+    if (lazy_functions) {
+        PendingSource* pending = malloc(sizeof(PendingSource));
+        pending->text = malloc(stmt->text_length + 1);
+        memcpy(pending->text, stmt->text, stmt->text_length);
+        pending->text[stmt->text_length] = '\0';
+        pending->length = stmt->text_length;
+        pending->line = declaration->line;
+        pending->column = declaration->column;
+        count_bytes(sizeof(PendingSource) + stmt->text_length);
+        function->pending = pending;
+    } else {
+        compile_function_body(function, stmt);
+    }
     
     if (state.current->scope_depth > 0) {
-        declare_variable();
+        declare_variable(&stmt->name);
         mark_initialized();
     } else {
-        uint8_t global = identifier_constant(&stmt->name);
-        emit_bytes(OP_DEFINE_GLOBAL, global);
+        int global = global_variable(&stmt->name);
+        emit_indexed(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
     }
 }
 
 static void compile_return_stmt(ReturnStmt* stmt) {
-    if (stmt->value != NULL) {
+    if (stmt->value != NULL && stmt->value->type == EXPR_CALL) {
+        /* `return f(args)` is in tail position: the caller's frame can be reused. */
+        state.line = stmt->value->line;
+        state.column = stmt->value->column;
+        compile_call(&stmt->value->as.call, OP_TAIL_CALL);
+    } else if (stmt->value != NULL) {
         compile_expr(stmt->value);
     } else {
         emit_byte(OP_NIL);
@@ -401,6 +522,11 @@ static void compile_print_stmt(PrintStmt* stmt) {
 }
 
 static void compile_stmt(Stmt* stmt) {
+    int line = state.line;
+    int column = state.column;
+    state.line = stmt->line;
+    state.column = stmt->column;
+    
     switch (stmt->type) {
         case STMT_EXPR:
             compile_expr_stmt(&stmt->as.expr_stmt);
@@ -420,7 +546,7 @@ static void compile_stmt(Stmt* stmt) {
             compile_while_stmt(&stmt->as.while_stmt);
             break;
         case STMT_FUNCTION:
-            compile_function_stmt(&stmt->as.function);
+            compile_function_stmt(stmt);
             break;
         case STMT_RETURN:
             compile_return_stmt(&stmt->as.return_stmt);
@@ -429,32 +555,109 @@ static void compile_stmt(Stmt* stmt) {
             compile_print_stmt(&stmt->as.print_stmt);
             break;
     }
+    
+    state.line = line;
+    state.column = column;
+}
+
+void mark_compiler_roots() {
+    for (Compiler* compiler = state.current; compiler != NULL; compiler = compiler->enclosing) {
+        mark_object((Obj*)compiler->function);
+    }
 }
 
-ObjFunction* compile(const char* source) {
+/* Parses and optimizes `source`; NULL after a syntax error. */
+static Program* parse_source(const char* source) {
     parser_init(&state.parser, source);
-    
-    Compiler compiler;
-    init_compiler(&compiler, TYPE_SCRIPT);
-    
-    state.had_error = false;
-    
     Program* program = parse(&state.parser);
     
     if (state.parser.had_error) {
         free_program(program);
-        free(program);
         return NULL;
     }
     
+    if (optimize_level >= 2) optimize_program(program);
+    return program;
+}
+
+ObjFunction* compile(const char* source) {
+    Program* program = parse_source(source);
+    if (program == NULL) return NULL;
+    
+    Compiler compiler;
+    init_compiler(&compiler, TYPE_SCRIPT, NULL);
+    
+    state.had_error = false;
+    
     for (size_t i = 0; i < program->count; i++) {
         compile_stmt(program->statements[i]);
     }
     
     free_program(program);
-    free(program);
     
     ObjFunction* function = end_compiler();
     
     return state.had_error ? NULL : function;
 }
+
+/* Compiles the same AST to register bytecode for run_registers(). */
+ObjFunction* compile_registers(const char* source) {
+    Program* program = parse_source(source);
+    if (program == NULL) return NULL;
+    
+    ObjFunction* function = compile_program_registers(program);
+    
+    free_program(program);
+    return function;
+}
+
+/* 0 compiles the AST as parsed, 1 adds superinstructions, 2 also folds constants. */
+void set_optimize_level(int level) {
+    optimize_level = level;
+}
+
+int get_optimize_level() {
+    return optimize_level;
+}
+
+/* When false, every function is compiled with the script rather than on its first call. */
+void set_lazy_functions(bool enabled) {
+    lazy_functions = enabled;
+}
+
+bool get_lazy_functions() {
+    return lazy_functions;
+}
+
+/*
+ * Parses the declaration `function` was left with again and compiles its
+ * body into the same object, which constants and globals already hold.
+ * The text parsed once already, but the body may run out of constant or
+ * global indexes; then the code is dropped, the function stays pending
+ * and this returns false. Functions declared inside are left pending in turn.
+ */
+bool compile_pending(ObjFunction* function) {
+    PendingSource* pending = function->pending;
+    state.had_error = false;
+    parser_init_at(&state.parser, pending->text, pending->line, pending->column);
+    Program* program = parse(&state.parser);
+    if (optimize_level >= 2) optimize_program(program);
+    
+    /* Where the declaration itself would have set it, for the implicit return. */
+    state.line = pending->line;
+    state.column = pending->column;
+    compile_function_body(function, &program->statements[0]->as.function);
+    
+    free_program(program);
+    if (state.had_error) {
+        free_chunk(&function->chunk);
+        free(function->code);
+        function->code = NULL;
+        return false;
+    }
+    
+    function->pending = NULL;
+    free(pending->text);
+    free(pending);
+    return true;
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include "../../include/algo_bytecode.h"
+
+const OpInfo op_info[OP_COUNT] = {
+    [OP_CONSTANT]             = {"OP_CONSTANT",            2,  1,  0},
+    [OP_NIL]                  = {"OP_NIL",                 1,  1,  0},
+    [OP_TRUE]                 = {"OP_TRUE",                1,  1,  0},
+    [OP_FALSE]                = {"OP_FALSE",               1,  1,  0},
+    [OP_POP]                  = {"OP_POP",                 1, -1,  0},
+    [OP_GET_LOCAL]            = {"OP_GET_LOCAL",           2,  1,  0},
+    [OP_SET_LOCAL]            = {"OP_SET_LOCAL",           2,  0,  0},
+    [OP_GET_GLOBAL]           = {"OP_GET_GLOBAL",          2,  1,  0},
+    [OP_DEFINE_GLOBAL]        = {"OP_DEFINE_GLOBAL",       2, -1,  0},
+    [OP_SET_GLOBAL]           = {"OP_SET_GLOBAL",          2,  0,  0},
+    [OP_EQUAL]                = {"OP_EQUAL",               1, -1,  0},
+    [OP_GREATER]              = {"OP_GREATER",             1, -1,  0},
+    [OP_LESS]                 = {"OP_LESS",                1, -1,  0},
+    [OP_ADD]                  = {"OP_ADD",                 1, -1,  0},
+    [OP_SUBTRACT]             = {"OP_SUBTRACT",            1, -1,  0},
+    [OP_MULTIPLY]             = {"OP_MULTIPLY",            1, -1,  0},
+    [OP_DIVIDE]               = {"OP_DIVIDE",              1, -1,  0},
+    [OP_MODULO]               = {"OP_MODULO",              1, -1,  0},
+    [OP_NOT]                  = {"OP_NOT",                 1,  0,  0},
+    [OP_NEGATE]               = {"OP_NEGATE",              1,  0,  0},
+    [OP_PRINT]                = {"OP_PRINT",               1, -1,  0},
+    [OP_JUMP]                 = {"OP_JUMP",                3,  0,  1},
+    [OP_JUMP_IF_FALSE]        = {"OP_JUMP_IF_FALSE",       3,  0,  1},
+    [OP_LOOP]                 = {"OP_LOOP",                3,  0, -1},
+    [OP_CALL]                 = {"OP_CALL",                2,  0,  0},
+    [OP_RETURN]               = {"OP_RETURN",              1, -1,  0},
+    [OP_TAIL_CALL]            = {"OP_TAIL_CALL",           2,  0,  0},
+    [OP_CONSTANT_LONG]        = {"OP_CONSTANT_LONG",       4,  1,  0},
+    [OP_GET_GLOBAL_LONG]      = {"OP_GET_GLOBAL_LONG",     4,  1,  0},
+    [OP_DEFINE_GLOBAL_LONG]   = {"OP_DEFINE_GLOBAL_LONG",  4, -1,  0},
+    [OP_SET_GLOBAL_LONG]      = {"OP_SET_GLOBAL_LONG",     4,  0,  0},
+    [OP_JUMP_LONG]            = {"OP_JUMP_LONG",           5,  0,  1},
+    [OP_JUMP_IF_FALSE_LONG]   = {"OP_JUMP_IF_FALSE_LONG",  5,  0,  1},
+    [OP_LOOP_LONG]            = {"OP_LOOP_LONG",           5,  0, -1},
+    [OP_GREATER_EQUAL]        = {"OP_GREATER_EQUAL",       1, -1,  0},
+    [OP_LESS_EQUAL]           = {"OP_LESS_EQUAL",          1, -1,  0},
+    [OP_NOT_EQUAL]            = {"OP_NOT_EQUAL",           1, -1,  0},
+    [OP_JUMP_IF_LESS]         = {"OP_JUMP_IF_LESS",        3, -2,  1},
+    [OP_JUMP_IF_NOT_LESS]     = {"OP_JUMP_IF_NOT_LESS",    3, -2,  1},
+    [OP_JUMP_IF_GREATER]      = {"OP_JUMP_IF_GREATER",     3, -2,  1},
+    [OP_JUMP_IF_NOT_GREATER]  = {"OP_JUMP_IF_NOT_GREATER", 3, -2,  1},
+    [OP_JUMP_IF_EQUAL]        = {"OP_JUMP_IF_EQUAL",       3, -2,  1},
+    [OP_JUMP_IF_NOT_EQUAL]    = {"OP_JUMP_IF_NOT_EQUAL",   3, -2,  1},
+    [OP_ADD_LOCALS]           = {"OP_ADD_LOCALS",          3,  1,  0},
+    [OP_LESS_LOCAL_CONSTANT]  = {"OP_LESS_LOCAL_CONSTANT", 3,  1,  0},
+    [OP_ADD_NUMBER]                   = {"OP_ADD_NUMBER",                  1, -1,  0},
+    [OP_SUBTRACT_NUMBER]              = {"OP_SUBTRACT_NUMBER",             1, -1,  0},
+    [OP_MULTIPLY_NUMBER]              = {"OP_MULTIPLY_NUMBER",             1, -1,  0},
+    [OP_DIVIDE_NUMBER]                = {"OP_DIVIDE_NUMBER",               1, -1,  0},
+    [OP_MODULO_NUMBER]                = {"OP_MODULO_NUMBER",               1, -1,  0},
+    [OP_GREATER_NUMBER]               = {"OP_GREATER_NUMBER",              1, -1,  0},
+    [OP_LESS_NUMBER]                  = {"OP_LESS_NUMBER",                 1, -1,  0},
+    [OP_GREATER_EQUAL_NUMBER]         = {"OP_GREATER_EQUAL_NUMBER",        1, -1,  0},
+    [OP_LESS_EQUAL_NUMBER]            = {"OP_LESS_EQUAL_NUMBER",           1, -1,  0},
+    [OP_JUMP_IF_LESS_NUMBER]          = {"OP_JUMP_IF_LESS_NUMBER",         3, -2,  1},
+    [OP_JUMP_IF_NOT_LESS_NUMBER]      = {"OP_JUMP_IF_NOT_LESS_NUMBER",     3, -2,  1},
+    [OP_JUMP_IF_GREATER_NUMBER]       = {"OP_JUMP_IF_GREATER_NUMBER",      3, -2,  1},
+    [OP_JUMP_IF_NOT_GREATER_NUMBER]   = {"OP_JUMP_IF_NOT_GREATER_NUMBER",  3, -2,  1}
+};
+
+int instruction_stack_effect(const uint8_t* ip) {
+    if (ip[0] == OP_CALL || ip[0] == OP_TAIL_CALL) {
+        /* The callee and its arguments are replaced by the result. */
+        return -ip[1];
+    }
+    return op_info[ip[0]].stack_effect;
+}
+
+/*
+ * Decodes the destination of a jump instruction at the given offset.
+ * Returns false for instructions that do not jump.
+ */
+bool instruction_jump_target(const uint8_t* ip, size_t offset, size_t* target) {
+    const OpInfo* info = &op_info[ip[0]];
+    if (info->jump == 0) return false;
+    
+    uint32_t distance = 0;
+    for (int i = 1; i < info->length; i++) {
+        distance = (distance << 8) | ip[i];
+    }
+    
+    size_t next = offset + info->length;
+    *target = info->jump > 0 ? next + distance : next - distance;
+    return true;
+}
+
+/*
+ * Walks every reachable path through the chunk and returns the deepest
+ * the value stack can get, counted from the frame's slot 0. The VM
+ * reserves this much room once per call instead of checking each push.
+ */
+int chunk_max_stack(const Chunk* chunk, int initial_depth) {
+    if (chunk->count == 0) return initial_depth;
+    
+    int* depth_at = malloc(chunk->count * sizeof(int));
+    size_t* worklist = malloc(chunk->count * sizeof(size_t));
+    for (size_t i = 0; i < chunk->count; i++) depth_at[i] = -1;
+    
+    size_t pending = 0;
+    int max_depth = initial_depth;
+    depth_at[0] = initial_depth;
+    worklist[pending++] = 0;
+    
+    while (pending > 0) {
+        size_t offset = worklist[--pending];
+        int depth = depth_at[offset];
+        
+        while (offset < chunk->count) {
+            const uint8_t* ip = &chunk->code[offset];
+            depth += instruction_stack_effect(ip);
+            if (depth > max_depth) max_depth = depth;
+            
+            size_t next = offset + op_info[ip[0]].length;
+            size_t target = next;
+            instruction_jump_target(ip, offset, &target);
+            
+            bool falls_through = true;
+            switch (ip[0]) {
+                case OP_JUMP:
+                case OP_JUMP_LONG:
+                case OP_LOOP:
+                case OP_LOOP_LONG:
+                case OP_RETURN:
+                    falls_through = false;
+                    break;
+                default:
+                    break;
+            }
+            
+            if (target != next && target < chunk->count && depth_at[target] == -1) {
+                depth_at[target] = depth;
+                worklist[pending++] = target;
+            }
+            
+            if (!falls_through || next >= chunk->count || depth_at[next] != -1) break;
+            depth_at[next] = depth;
+            offset = next;
+        }
+    }
+    
+    free(depth_at);
+    free(worklist);
+    return max_depth;
+}
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include "../../include/algo_bytecode.h"
+
+/*
+ * Peephole pass over a decoded chunk. Each rule replaces a short run of
+ * instructions with one superinstruction; a run is only fused when no
+ * jump lands in the middle of it, so control flow is unchanged.
+ */
+
+/* Longest encoding of any instruction, used to bound a jump's byte distance. */
+#define MAX_INSTRUCTION_LENGTH 5
+
+typedef int (*FuseRule)(InstructionList* list, int i, const int* targets,
+                        bool* removed, Instruction* fused);
+
+static bool falls_through(uint8_t op) {
+    return op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+}
+
+static bool op_at(const InstructionList* list, int i, uint8_t op) {
+    return i < list->count && list->code[i].op == op;
+}
+
+/* `a >= b` compiles to `a < b, !`; the fused forms keep that NaN behavior. */
+static int fuse_negated_compare(InstructionList* list, int i, const int* targets,
+                                bool* removed, Instruction* fused) {
+    (void)removed;
+    if (!op_at(list, i + 1, OP_NOT) || targets[i + 1] != 0) return 0;
+    
+    switch (list->code[i].op) {
+        case OP_LESS:    fused->op = OP_GREATER_EQUAL; break;
+        case OP_GREATER: fused->op = OP_LESS_EQUAL; break;
+        case OP_EQUAL:   fused->op = OP_NOT_EQUAL; break;
+        default:         return 0;
+    }
+    
+    fused->operand = 0;
+    fused->line = list->code[i].line;
+    fused->column = list->code[i].column;
+    return 2;
+}
+
+static uint8_t compare_jump(uint8_t op) {
+    switch (op) {
+        case OP_LESS:          return OP_JUMP_IF_NOT_LESS;
+        case OP_GREATER:       return OP_JUMP_IF_NOT_GREATER;
+        case OP_EQUAL:         return OP_JUMP_IF_NOT_EQUAL;
+        case OP_GREATER_EQUAL: return OP_JUMP_IF_LESS;
+        case OP_LESS_EQUAL:    return OP_JUMP_IF_GREATER;
+        case OP_NOT_EQUAL:     return OP_JUMP_IF_EQUAL;
+        default:               return OP_COUNT;
+    }
+}
+
+/*
+ * `compare, JUMP_IF_FALSE t, POP` where t is a POP only reached by this
+ * jump (as in if and while statements) becomes one compare-and-jump that
+ * pops both operands on either path, and the POP at t is dropped.
+ */
+static int fuse_compare_jump(InstructionList* list, int i, const int* targets,
+                             bool* removed, Instruction* fused) {
+    uint8_t op = compare_jump(list->code[i].op);
+    if (op == OP_COUNT) return 0;
+    if (!op_at(list, i + 1, OP_JUMP_IF_FALSE) || targets[i + 1] != 0) return 0;
+    if (!op_at(list, i + 2, OP_POP) || targets[i + 2] != 0) return 0;
+    
+    int target = (int)list->code[i + 1].operand;
+    if (target <= i + 2 || !op_at(list, target, OP_POP)) return 0;
+    if (targets[target] != 1 || falls_through(list->code[target - 1].op)) return 0;
+    if ((target - i) * MAX_INSTRUCTION_LENGTH > UINT16_MAX) return 0;
+    
+    removed[target] = true;
+    fused->op = op;
+    fused->operand = (uint32_t)target;
+    fused->line = list->code[i].line;
+    fused->column = list->code[i].column;
+    return 3;
+}
+
+static int fuse_local_operands(InstructionList* list, int i, const int* targets,
+                               bool* removed, Instruction* fused) {
+    (void)removed;
+    if (list->code[i].op != OP_GET_LOCAL || i + 2 >= list->count) return 0;
+    if (targets[i + 1] != 0 || targets[i + 2] != 0) return 0;
+    
+    const Instruction* second = &list->code[i + 1];
+    const Instruction* third = &list->code[i + 2];
+    
+    if (second->op == OP_GET_LOCAL && third->op == OP_ADD) {
+        fused->op = OP_ADD_LOCALS;
+    } else if (second->op == OP_CONSTANT && second->operand <= UINT8_MAX && third->op == OP_LESS) {
+        fused->op = OP_LESS_LOCAL_CONSTANT;
+    } else {
+        return 0;
+    }
+    
+    fused->operand = (list->code[i].operand << 8) | second->operand;
+    fused->line = third->line;
+    fused->column = third->column;
+    return 3;
+}
+
+/*
+ * Applies one rule across the list. Removed instructions map to the
+ * instruction after them, so jumps into a fused run land on its start
+ * and jumps to a dropped POP land on what followed it.
+ */
+static void apply_rule(InstructionList* list, FuseRule rule) {
+    int* targets = calloc(list->count + 1, sizeof(int));
+    bool* removed = calloc(list->count + 1, sizeof(bool));
+    int* new_index = malloc((list->count + 1) * sizeof(int));
+    
+    for (int i = 0; i < list->count; i++) {
+        if (op_info[list->code[i].op].jump != 0) targets[list->code[i].operand]++;
+    }
+    
+    int count = 0;
+    int i = 0;
+    while (i < list->count) {
+        if (removed[i]) {
+            new_index[i++] = count;
+            continue;
+        }
+        
+        Instruction fused;
+        int consumed = rule(list, i, targets, removed, &fused);
+        if (consumed == 0) {
+            fused = list->code[i];
+            consumed = 1;
+        }
+        
+        for (int j = 0; j < consumed; j++) new_index[i + j] = count;
+        list->code[count++] = fused;
+        i += consumed;
+    }
+    new_index[list->count] = count;
+    
+    for (int j = 0; j < count; j++) {
+        Instruction* instruction = &list->code[j];
+        if (op_info[instruction->op].jump != 0) {
+            instruction->operand = new_index[instruction->operand];
+        }
+    }
+    list->count = count;
+    
+    free(targets);
+    free(removed);
+    free(new_index);
+}
+
+void optimize_instructions(InstructionList* list) {
+    apply_rule(list, fuse_negated_compare);
+    apply_rule(list, fuse_compare_jump);
+    apply_rule(list, fuse_local_operands);
+}
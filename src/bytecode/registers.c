@@ -0,0 +1,681 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../../include/algo_register.h"
+#include "../../include/algo_compiler.h"
+#include "../../include/algo_memory.h"
+
+/*
+ * Register backend. Locals are pinned to the register matching their
+ * stack slot, and temporaries are allocated above them in stack order:
+ * every expression gets a target register, and a statement frees all
+ * the temporaries it used. Arithmetic and comparisons read their
+ * operands straight from locals or the constant table, so `i = i + 2`
+ * is a single R_ADD.
+ */
+
+typedef struct RegisterCompiler {
+    struct RegisterCompiler* enclosing;
+    ObjFunction* function;
+    
+    Local locals[MAX_REGISTERS];
+    int local_count;
+    int scope_depth;
+    
+    /* Lowest register not holding a local or a live temporary. */
+    int free_register;
+} RegisterCompiler;
+
+/* Forward jumps waiting for their target. */
+typedef struct {
+    int* at;
+    int count;
+    int capacity;
+} JumpList;
+
+const char* const register_op_names[R_OP_COUNT] = {
+    [R_MOVE]      = "R_MOVE",
+    [R_LOADK]     = "R_LOADK",
+    [R_LOADNIL]   = "R_LOADNIL",
+    [R_LOADBOOL]  = "R_LOADBOOL",
+    [R_GETGLOBAL] = "R_GETGLOBAL",
+    [R_SETGLOBAL] = "R_SETGLOBAL",
+    [R_DEFGLOBAL] = "R_DEFGLOBAL",
+    [R_ADD]       = "R_ADD",
+    [R_SUB]       = "R_SUB",
+    [R_MUL]       = "R_MUL",
+    [R_DIV]       = "R_DIV",
+    [R_MOD]       = "R_MOD",
+    [R_NEG]       = "R_NEG",
+    [R_NOT]       = "R_NOT",
+    [R_EQ]        = "R_EQ",
+    [R_NE]        = "R_NE",
+    [R_LT]        = "R_LT",
+    [R_GT]        = "R_GT",
+    [R_GE]        = "R_GE",
+    [R_LE]        = "R_LE",
+    [R_JMP]       = "R_JMP",
+    [R_IFEQ]      = "R_IFEQ",
+    [R_IFLT]      = "R_IFLT",
+    [R_IFGT]      = "R_IFGT",
+    [R_TEST]      = "R_TEST",
+    [R_CALL]      = "R_CALL",
+    [R_TAILCALL]  = "R_TAILCALL",
+    [R_RETURN]    = "R_RETURN",
+    [R_PRINT]     = "R_PRINT"
+};
+
+static RegisterCompiler* current = NULL;
+static bool had_error;
+/* Source position the next instructions are recorded at. */
+static int current_line = 0;
+static int current_column = 0;
+
+/* Only the first error is reported; once a limit is hit, every later index hits it too. */
+static void error(const char* message) {
+    if (!had_error) fprintf(stderr, "%s\n", message);
+    had_error = true;
+}
+
+static RegisterCode* current_code() {
+    return &current->function->registers;
+}
+
+static int emit(uint32_t instruction) {
+    RegisterCode* code = current_code();
+    if (code->capacity < code->count + 1) {
+        int old_capacity = code->capacity;
+        code->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        count_bytes((code->capacity - old_capacity) * sizeof(uint32_t));
+        code->code = realloc(code->code, code->capacity * sizeof(uint32_t));
+    }
+    add_position(&code->lines, code->count, current_line, current_column);
+    code->code[code->count] = instruction;
+    return code->count++;
+}
+
+static void emit_abc(RegisterOpCode op, int a, int b, int c) {
+    emit(ENCODE_ABC(op, a, b, c));
+}
+
+static void emit_abx(RegisterOpCode op, int a, int bx) {
+    emit(ENCODE_ABX(op, a, bx));
+}
+
+static int allocate_register() {
+    int reg = current->free_register++;
+    if (reg >= MAX_REGISTERS) {
+        error("Too many registers in function");
+        current->free_register = MAX_REGISTERS;
+        return 0;
+    }
+    if (current->free_register > current_code()->frame_size) {
+        current_code()->frame_size = current->free_register;
+    }
+    return reg;
+}
+
+static int check_index(int index) {
+    if (index > MAX_BX) {
+        error("Too many constants or globals");
+        return 0;
+    }
+    return index;
+}
+
+/* Numbers are shared so that as many as possible fit in an RK operand. */
+static int make_constant(Value value) {
+    Chunk* chunk = &current->function->chunk;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        for (size_t i = 0; i < chunk->constant_count; i++) {
+            Value constant = chunk->constants[i];
+            if (IS_NUMBER(constant) && AS_NUMBER(constant) == number &&
+                signbit(AS_NUMBER(constant)) == signbit(number)) {
+                return (int)i;
+            }
+        }
+    }
+    return check_index(add_constant(current->function, value));
+}
+
+static int global_index(Token* name) {
+    return check_index(global_slot(copy_string(name->start, name->length)));
+}
+
+static int emit_jump() {
+    return emit(ENCODE_ABX(R_JMP, 0, MAX_SBX));
+}
+
+static void set_jump(int at, int target) {
+    int offset = target - (at + 1);
+    if (offset > MAX_SBX || offset < -MAX_SBX) {
+        error("Too much code to jump over");
+        offset = 0;
+    }
+    current_code()->code[at] = ENCODE_ABX(R_JMP, 0, offset + MAX_SBX);
+}
+
+static void patch_jump(int at) {
+    set_jump(at, current_code()->count);
+}
+
+static void add_jump(JumpList* list, int at) {
+    if (list->capacity < list->count + 1) {
+        int old_capacity = list->capacity;
+        list->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        list->at = realloc(list->at, list->capacity * sizeof(int));
+    }
+    list->at[list->count++] = at;
+}
+
+static void patch_jumps(JumpList* list, int target) {
+    for (int i = 0; i < list->count; i++) set_jump(list->at[i], target);
+    free(list->at);
+    list->at = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+static bool identifiers_equal(Token* a, Token* b) {
+    if (a->length != b->length) return false;
+    return memcmp(a->start, b->start, a->length) == 0;
+}
+
+static int resolve_local(Token* name) {
+    for (int i = current->local_count - 1; i >= 0; i--) {
+        if (identifiers_equal(name, &current->locals[i].name)) return i;
+    }
+    return -1;
+}
+
+/* Makes the register just allocated for `name` a local of the current scope. */
+static void add_local(Token name) {
+    for (int i = current->local_count - 1; i >= 0; i--) {
+        Local* local = &current->locals[i];
+        if (local->depth < current->scope_depth) break;
+        if (identifiers_equal(&name, &local->name)) {
+            fprintf(stderr, "Already a variable with this name in this scope\n");
+        }
+    }
+    
+    Local* local = &current->locals[current->local_count++];
+    local->name = name;
+    local->depth = current->scope_depth;
+}
+
+/* Whether evaluating `expr` may store to a local. */
+static bool has_assignment(Expr* expr) {
+    switch (expr->type) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            return false;
+        case EXPR_ASSIGN:
+            return true;
+        case EXPR_UNARY:
+            return has_assignment(expr->as.unary.operand);
+        case EXPR_BINARY:
+            return has_assignment(expr->as.binary.left) || has_assignment(expr->as.binary.right);
+        case EXPR_LOGICAL:
+            return has_assignment(expr->as.logical.left) || has_assignment(expr->as.logical.right);
+        case EXPR_CALL:
+            if (has_assignment(expr->as.call.callee)) return true;
+            for (size_t i = 0; i < expr->as.call.arg_count; i++) {
+                if (has_assignment(expr->as.call.arguments[i])) return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+static void compile_expr(Expr* expr, int target);
+static void compile_stmt(Stmt* stmt);
+
+/* A register holding the value of `expr`: a local's own register, or a new temporary. */
+static int compile_to_register(Expr* expr) {
+    if (expr->type == EXPR_VARIABLE) {
+        int local = resolve_local(&expr->as.variable.name);
+        if (local != -1) return local;
+    }
+    int reg = allocate_register();
+    compile_expr(expr, reg);
+    return reg;
+}
+
+/* An RK operand for `expr`; `pinned` copies a local first, in case a later operand assigns it. */
+static int compile_operand(Expr* expr, bool pinned) {
+    if (expr->type == EXPR_LITERAL && expr->as.literal.type == LITERAL_NUMBER) {
+        int constant = make_constant(NUMBER_VAL(expr->as.literal.as.number.value));
+        if (constant < RK_CONSTANT) return RK_CONSTANT + constant;
+    }
+    if (pinned) {
+        int reg = allocate_register();
+        compile_expr(expr, reg);
+        return reg;
+    }
+    return compile_to_register(expr);
+}
+
+static void compile_literal(LiteralExpr* expr, int target) {
+    switch (expr->type) {
+        case LITERAL_NUMBER:
+            emit_abx(R_LOADK, target, make_constant(NUMBER_VAL(expr->as.number.value)));
+            break;
+        case LITERAL_BOOL:
+            emit_abc(R_LOADBOOL, target, expr->as.boolean.value, 0);
+            break;
+        case LITERAL_NIL:
+            emit_abc(R_LOADNIL, target, 0, 0);
+            break;
+    }
+}
+
+static void compile_unary(UnaryExpr* expr, int target) {
+    int saved = current->free_register;
+    int operand = compile_to_register(expr->operand);
+    
+    switch (expr->op) {
+        case TOKEN_MINUS: emit_abc(R_NEG, target, operand, 0); break;
+        case TOKEN_BANG:  emit_abc(R_NOT, target, operand, 0); break;
+        default: break;
+    }
+    current->free_register = saved;
+}
+
+static void compile_binary(BinaryExpr* expr, int target) {
+    RegisterOpCode op;
+    switch (expr->op) {
+        case TOKEN_PLUS:    op = R_ADD; break;
+        case TOKEN_MINUS:   op = R_SUB; break;
+        case TOKEN_STAR:    op = R_MUL; break;
+        case TOKEN_SLASH:   op = R_DIV; break;
+        case TOKEN_PERCENT: op = R_MOD; break;
+        case TOKEN_EQ_EQ:   op = R_EQ; break;
+        case TOKEN_BANG_EQ: op = R_NE; break;
+        case TOKEN_GT:      op = R_GT; break;
+        case TOKEN_GT_EQ:   op = R_GE; break;
+        case TOKEN_LT:      op = R_LT; break;
+        case TOKEN_LT_EQ:   op = R_LE; break;
+        default:
+            return;
+    }
+    
+    int saved = current->free_register;
+    int b = compile_operand(expr->left, has_assignment(expr->right));
+    int c = compile_operand(expr->right, false);
+    emit_abc(op, target, b, c);
+    current->free_register = saved;
+}
+
+static void compile_variable(VariableExpr* expr, int target) {
+    int local = resolve_local(&expr->name);
+    if (local == -1) {
+        current_line = expr->name.line;
+        current_column = expr->name.column;
+        emit_abx(R_GETGLOBAL, target, global_index(&expr->name));
+    } else if (local != target) {
+        emit_abc(R_MOVE, target, local, 0);
+    }
+}
+
+/* A negative target discards the value, as in an expression statement. */
+static void compile_assign(AssignExpr* expr, int target) {
+    int local = resolve_local(&expr->name);
+    if (local != -1) {
+        compile_expr(expr->value, local);
+        if (target >= 0 && target != local) emit_abc(R_MOVE, target, local, 0);
+        return;
+    }
+    
+    int saved = current->free_register;
+    int reg = target >= 0 ? target : allocate_register();
+    compile_expr(expr->value, reg);
+    emit_abx(R_SETGLOBAL, reg, global_index(&expr->name));
+    current->free_register = saved;
+}
+
+static void compile_call(CallExpr* expr, int target, RegisterOpCode op) {
+    int saved = current->free_register;
+    
+    /* A fresh temporary on top of the frame can take the result in place. */
+    int base = target == saved - 1 && target >= current->local_count ? target : allocate_register();
+    compile_expr(expr->callee, base);
+    for (size_t i = 0; i < expr->arg_count; i++) {
+        int reg = allocate_register();
+        compile_expr(expr->arguments[i], reg);
+    }
+    
+    emit_abc(op, base, (int)expr->arg_count, 0);
+    if (op == R_TAILCALL) {
+        /* Reached when the callee is native or tail calls are off. */
+        emit_abc(R_RETURN, base, 1, 0);
+    } else if (target >= 0 && target != base) {
+        emit_abc(R_MOVE, target, base, 0);
+    }
+    current->free_register = saved;
+}
+
+static void compile_logical(LogicalExpr* expr, int target) {
+    /* The left value is stored before the right side runs, so never straight into a local. */
+    int saved = current->free_register;
+    int reg = target < current->local_count ? allocate_register() : target;
+    
+    compile_expr(expr->left, reg);
+    emit_abc(R_TEST, expr->op == TOKEN_OR, reg, 0);
+    int end = emit_jump();
+    compile_expr(expr->right, reg);
+    patch_jump(end);
+    
+    if (reg != target) emit_abc(R_MOVE, target, reg, 0);
+    current->free_register = saved;
+}
+
+static void compile_expr(Expr* expr, int target) {
+    int line = current_line;
+    int column = current_column;
+    /*
+     * Literals, locals and `and`/`or` cannot fail themselves, so they stay
+     * in the run of the code around them; compile_variable() moves the
+     * position for a global.
+     */
+    if (expr->type != EXPR_LITERAL && expr->type != EXPR_VARIABLE && expr->type != EXPR_LOGICAL) {
+        current_line = expr->line;
+        current_column = expr->column;
+    }
+    
+    switch (expr->type) {
+        case EXPR_LITERAL:
+            compile_literal(&expr->as.literal, target);
+            break;
+        case EXPR_UNARY:
+            compile_unary(&expr->as.unary, target);
+            break;
+        case EXPR_BINARY:
+            compile_binary(&expr->as.binary, target);
+            break;
+        case EXPR_VARIABLE:
+            compile_variable(&expr->as.variable, target);
+            break;
+        case EXPR_ASSIGN:
+            compile_assign(&expr->as.assign, target);
+            break;
+        case EXPR_CALL:
+            compile_call(&expr->as.call, target, R_CALL);
+            break;
+        case EXPR_LOGICAL:
+            compile_logical(&expr->as.logical, target);
+            break;
+    }
+    
+    current_line = line;
+    current_column = column;
+}
+
+static bool literal_truthy(LiteralExpr* expr) {
+    if (expr->type == LITERAL_NIL) return false;
+    if (expr->type == LITERAL_BOOL) return expr->as.boolean.value;
+    return true;
+}
+
+/*
+ * Emits the jumps (added to `jumps`) taken when the truthiness of
+ * `expr` equals `when`, and falls through otherwise. Comparisons
+ * become a single R_IF* with the jump word after it; `!`, `and` and
+ * `or` turn into control flow instead of building a bool.
+ */
+static void compile_condition(Expr* expr, bool when, JumpList* jumps) {
+    if (expr->type == EXPR_UNARY && expr->as.unary.op == TOKEN_BANG) {
+        compile_condition(expr->as.unary.operand, !when, jumps);
+        return;
+    }
+    
+    if (expr->type == EXPR_LOGICAL) {
+        /* `a and b` is truthy when both are; `a or b` when either is. */
+        bool both = expr->as.logical.op == TOKEN_AND;
+        if (both != when) {
+            compile_condition(expr->as.logical.left, when, jumps);
+            compile_condition(expr->as.logical.right, when, jumps);
+        } else {
+            JumpList skip = {NULL, 0, 0};
+            compile_condition(expr->as.logical.left, !when, &skip);
+            compile_condition(expr->as.logical.right, when, jumps);
+            patch_jumps(&skip, current_code()->count);
+        }
+        return;
+    }
+    
+    if (expr->type == EXPR_LITERAL) {
+        if (literal_truthy(&expr->as.literal) == when) add_jump(jumps, emit_jump());
+        return;
+    }
+    
+    int saved = current->free_register;
+    if (expr->type == EXPR_BINARY) {
+        BinaryExpr* binary = &expr->as.binary;
+        RegisterOpCode op = R_JMP;
+        bool polarity = when;
+        
+        /* `a >= b` is `!(a < b)` and `a <= b` is `!(a > b)`, as in the stack VM. */
+        switch (binary->op) {
+            case TOKEN_EQ_EQ: op = R_IFEQ; break;
+            case TOKEN_BANG_EQ: op = R_IFEQ; polarity = !when; break;
+            case TOKEN_LT:    op = R_IFLT; break;
+            case TOKEN_GT_EQ: op = R_IFLT; polarity = !when; break;
+            case TOKEN_GT:    op = R_IFGT; break;
+            case TOKEN_LT_EQ: op = R_IFGT; polarity = !when; break;
+            default: break;
+        }
+        
+        if (op != R_JMP) {
+            int line = current_line;
+            int column = current_column;
+            current_line = expr->line;
+            current_column = expr->column;
+            
+            int b = compile_operand(binary->left, has_assignment(binary->right));
+            int c = compile_operand(binary->right, false);
+            emit_abc(op, polarity, b, c);
+            add_jump(jumps, emit_jump());
+            current->free_register = saved;
+            
+            current_line = line;
+            current_column = column;
+            return;
+        }
+    }
+    
+    int reg = compile_to_register(expr);
+    emit_abc(R_TEST, when, reg, 0);
+    add_jump(jumps, emit_jump());
+    current->free_register = saved;
+}
+
+static void compile_expr_stmt(ExprStmt* stmt) {
+    Expr* expr = stmt->expression;
+    current_line = expr->line;
+    current_column = expr->column;
+    if (expr->type == EXPR_ASSIGN) {
+        compile_assign(&expr->as.assign, -1);
+    } else if (expr->type == EXPR_CALL) {
+        compile_call(&expr->as.call, -1, R_CALL);
+    } else {
+        compile_expr(expr, allocate_register());
+    }
+}
+
+static void compile_let_stmt(LetStmt* stmt) {
+    int reg = allocate_register();
+    if (stmt->initializer != NULL) {
+        compile_expr(stmt->initializer, reg);
+    } else {
+        emit_abc(R_LOADNIL, reg, 0, 0);
+    }
+    
+    if (current->scope_depth > 0) {
+        add_local(stmt->name);
+    } else {
+        emit_abx(R_DEFGLOBAL, reg, global_index(&stmt->name));
+    }
+}
+
+static void compile_if_stmt(IfStmt* stmt) {
+    JumpList else_jumps = {NULL, 0, 0};
+    compile_condition(stmt->condition, false, &else_jumps);
+    compile_stmt(stmt->then_branch);
+    
+    if (stmt->else_branch == NULL) {
+        patch_jumps(&else_jumps, current_code()->count);
+        return;
+    }
+    
+    int end = emit_jump();
+    patch_jumps(&else_jumps, current_code()->count);
+    compile_stmt(stmt->else_branch);
+    patch_jump(end);
+}
+
+/* The condition goes after the body, so each iteration ends in one R_IF* that jumps back. */
+static void compile_while_stmt(WhileStmt* stmt) {
+    int enter = emit_jump();
+    int body = current_code()->count;
+    compile_stmt(stmt->body);
+    
+    patch_jump(enter);
+    JumpList repeat = {NULL, 0, 0};
+    compile_condition(stmt->condition, true, &repeat);
+    patch_jumps(&repeat, body);
+}
+
+static void init_register_compiler(RegisterCompiler* compiler) {
+    compiler->enclosing = current;
+    compiler->function = new_function();
+    compiler->local_count = 0;
+    compiler->scope_depth = 0;
+    compiler->free_register = 0;
+    current = compiler;
+    
+    /* Register 0 holds the callee, like stack slot 0. */
+    Local* local = &compiler->locals[compiler->local_count++];
+    local->depth = 0;
+    local->name.start = "";
+    local->name.length = 0;
+    allocate_register();
+}
+
+static ObjFunction* end_register_compiler() {
+    emit_abc(R_RETURN, 0, 0, 0);
+    ObjFunction* function = current->function;
+    current = current->enclosing;
+    return function;
+}
+
+static void compile_function_stmt(FunctionStmt* stmt) {
+    RegisterCompiler compiler;
+    init_register_compiler(&compiler);
+    current->scope_depth = 1;
+    current->function->name = copy_string(stmt->name.start, stmt->name.length);
+    object_barrier((Obj*)current->function, OBJ_VAL(current->function->name));
+    current->function->arity = stmt->param_count;
+    
+    for (size_t i = 0; i < stmt->param_count; i++) {
+        allocate_register();
+        add_local(stmt->params[i]);
+    }
+    for (size_t i = 0; i < stmt->body_count; i++) {
+        compile_stmt(stmt->body[i]);
+    }
+    
+    ObjFunction* function = end_register_compiler();
+    int reg = allocate_register();
+    emit_abx(R_LOADK, reg, make_constant(OBJ_VAL(function)));
+    
+    if (current->scope_depth > 0) {
+        add_local(stmt->name);
+    } else {
+        emit_abx(R_DEFGLOBAL, reg, global_index(&stmt->name));
+    }
+}
+
+static void compile_return_stmt(ReturnStmt* stmt) {
+    if (stmt->value == NULL) {
+        emit_abc(R_RETURN, 0, 0, 0);
+    } else if (stmt->value->type == EXPR_CALL) {
+        current_line = stmt->value->line;
+        current_column = stmt->value->column;
+        compile_call(&stmt->value->as.call, -1, R_TAILCALL);
+    } else {
+        emit_abc(R_RETURN, compile_to_register(stmt->value), 1, 0);
+    }
+}
+
+static void compile_print_stmt(PrintStmt* stmt) {
+    emit_abc(R_PRINT, compile_to_register(stmt->expression), 0, 0);
+}
+
+static void compile_stmt(Stmt* stmt) {
+    int line = current_line;
+    int column = current_column;
+    current_line = stmt->line;
+    current_column = stmt->column;
+    
+    switch (stmt->type) {
+        case STMT_EXPR:
+            compile_expr_stmt(&stmt->as.expr_stmt);
+            break;
+        case STMT_LET:
+            compile_let_stmt(&stmt->as.let_stmt);
+            break;
+        case STMT_BLOCK:
+            current->scope_depth++;
+            for (size_t i = 0; i < stmt->as.block.count; i++) {
+                compile_stmt(stmt->as.block.statements[i]);
+            }
+            current->scope_depth--;
+            while (current->local_count > 0 &&
+                   current->locals[current->local_count - 1].depth > current->scope_depth) {
+                current->local_count--;
+            }
+            break;
+        case STMT_IF:
+            compile_if_stmt(&stmt->as.if_stmt);
+            break;
+        case STMT_WHILE:
+            compile_while_stmt(&stmt->as.while_stmt);
+            break;
+        case STMT_FUNCTION:
+            compile_function_stmt(&stmt->as.function);
+            break;
+        case STMT_RETURN:
+            compile_return_stmt(&stmt->as.return_stmt);
+            break;
+        case STMT_PRINT:
+            compile_print_stmt(&stmt->as.print_stmt);
+            break;
+    }
+    
+    /* Temporaries never outlive their statement. */
+    current->free_register = current->local_count;
+    current_line = line;
+    current_column = column;
+}
+
+void mark_register_compiler_roots() {
+    for (RegisterCompiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+        mark_object((Obj*)compiler->function);
+    }
+}
+
+ObjFunction* compile_program_registers(Program* program) {
+    RegisterCompiler compiler;
+    current = NULL;
+    had_error = false;
+    init_register_compiler(&compiler);
+    
+    for (size_t i = 0; i < program->count; i++) {
+        compile_stmt(program->statements[i]);
+    }
+    
+    ObjFunction* function = end_register_compiler();
+    return had_error ? NULL : function;
+}
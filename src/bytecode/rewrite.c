@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include "../../include/algo_bytecode.h"
+
+static uint8_t long_form(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:      return OP_CONSTANT_LONG;
+        case OP_GET_GLOBAL:    return OP_GET_GLOBAL_LONG;
+        case OP_DEFINE_GLOBAL: return OP_DEFINE_GLOBAL_LONG;
+        case OP_SET_GLOBAL:    return OP_SET_GLOBAL_LONG;
+        case OP_JUMP:          return OP_JUMP_LONG;
+        case OP_JUMP_IF_FALSE: return OP_JUMP_IF_FALSE_LONG;
+        case OP_LOOP:          return OP_LOOP_LONG;
+        default:               return op;
+    }
+}
+
+static uint8_t short_form(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT_LONG:      return OP_CONSTANT;
+        case OP_GET_GLOBAL_LONG:    return OP_GET_GLOBAL;
+        case OP_DEFINE_GLOBAL_LONG: return OP_DEFINE_GLOBAL;
+        case OP_SET_GLOBAL_LONG:    return OP_SET_GLOBAL;
+        case OP_JUMP_LONG:          return OP_JUMP;
+        case OP_JUMP_IF_FALSE_LONG: return OP_JUMP_IF_FALSE;
+        case OP_LOOP_LONG:          return OP_LOOP;
+        default:                    return op;
+    }
+}
+
+static bool is_jump(uint8_t op) {
+    return op_info[op].jump != 0;
+}
+
+static void append_instruction(InstructionList* list, Instruction instruction) {
+    if (list->capacity < list->count + 1) {
+        int old_capacity = list->capacity;
+        list->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        list->code = realloc(list->code, list->capacity * sizeof(Instruction));
+    }
+    list->code[list->count++] = instruction;
+}
+
+/*
+ * Jump operands are decoded as byte offsets first and turned into
+ * instruction indices once every instruction's offset is known. The
+ * patches override the operand of forward jumps the compiler could not
+ * encode in 16 bits.
+ */
+void decode_chunk(const Chunk* chunk, const JumpPatch* patches, int patch_count,
+                  InstructionList* list) {
+    list->code = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    
+    int* index_at = malloc((chunk->count + 1) * sizeof(int));
+    
+    LineCursor cursor = {0, 0, 0, 0};
+    size_t offset = 0;
+    while (offset < chunk->count) {
+        const uint8_t* ip = &chunk->code[offset];
+        int length = op_info[ip[0]].length;
+        
+        Instruction instruction;
+        instruction.op = short_form(ip[0]);
+        find_position(&chunk->lines, offset, &cursor);
+        instruction.line = cursor.line;
+        instruction.column = cursor.column;
+        instruction.operand = 0;
+        for (int i = 1; i < length; i++) {
+            instruction.operand = (instruction.operand << 8) | ip[i];
+        }
+        
+        size_t target;
+        if (instruction_jump_target(ip, offset, &target)) {
+            for (int i = 0; i < patch_count; i++) {
+                if (patches[i].offset == offset) target = patches[i].target;
+            }
+            instruction.operand = (uint32_t)target;
+        }
+        
+        index_at[offset] = list->count;
+        append_instruction(list, instruction);
+        offset += length;
+    }
+    index_at[chunk->count] = list->count;
+    
+    for (int i = 0; i < list->count; i++) {
+        Instruction* instruction = &list->code[i];
+        if (is_jump(instruction->op)) {
+            instruction->operand = index_at[instruction->operand];
+        }
+    }
+    
+    free(index_at);
+}
+
+static int encoded_length(const Instruction* instruction, bool wide) {
+    return op_info[wide ? long_form(instruction->op) : instruction->op].length;
+}
+
+static void emit(Chunk* chunk, uint8_t op, uint32_t operand, int operand_bytes,
+                 const Instruction* position) {
+    write_chunk(chunk, op, position->line, position->column);
+    for (int shift = (operand_bytes - 1) * 8; shift >= 0; shift -= 8) {
+        write_chunk(chunk, (operand >> shift) & 0xff, position->line, position->column);
+    }
+}
+
+/*
+ * Jumps start out in their short form and are widened until every
+ * distance fits. Widening only ever moves code apart, so the loop
+ * settles after a few rounds at most. Fused compare-and-jump
+ * instructions have no long form; the peephole pass only creates them
+ * when the jump is short enough to fit whatever the encoding.
+ */
+void encode_chunk(Chunk* chunk, const InstructionList* list) {
+    bool* wide = malloc((list->count + 1) * sizeof(bool));
+    size_t* offsets = malloc((list->count + 1) * sizeof(size_t));
+    
+    for (int i = 0; i < list->count; i++) {
+        const Instruction* instruction = &list->code[i];
+        wide[i] = !is_jump(instruction->op) && long_form(instruction->op) != instruction->op &&
+                  instruction->operand > UINT8_MAX;
+    }
+    
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        
+        offsets[0] = 0;
+        for (int i = 0; i < list->count; i++) {
+            offsets[i + 1] = offsets[i] + encoded_length(&list->code[i], wide[i]);
+        }
+        
+        for (int i = 0; i < list->count; i++) {
+            const Instruction* instruction = &list->code[i];
+            if (!is_jump(instruction->op) || wide[i]) continue;
+            if (long_form(instruction->op) == instruction->op) continue;
+            
+            size_t next = offsets[i + 1];
+            size_t target = offsets[instruction->operand];
+            size_t distance = op_info[instruction->op].jump < 0 ? next - target : target - next;
+            if (distance > UINT16_MAX) {
+                wide[i] = true;
+                changed = true;
+            }
+        }
+    }
+    
+    free(chunk->code);
+    free_line_table(&chunk->lines);
+    chunk->code = NULL;
+    chunk->count = 0;
+    chunk->capacity = 0;
+    
+    for (int i = 0; i < list->count; i++) {
+        const Instruction* instruction = &list->code[i];
+        uint8_t op = wide[i] ? long_form(instruction->op) : instruction->op;
+        uint32_t operand = instruction->operand;
+        
+        if (is_jump(instruction->op)) {
+            size_t next = offsets[i + 1];
+            size_t target = offsets[operand];
+            operand = (uint32_t)(op_info[instruction->op].jump < 0 ? next - target : target - next);
+        }
+        
+        emit(chunk, op, operand, op_info[op].length - 1, instruction);
+    }
+    
+    free(wide);
+    free(offsets);
+}
+
+void free_instruction_list(InstructionList* list) {
+    free(list->code);
+    list->code = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
@@ -0,0 +1,882 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_compiler.h"
+#include "../../include/algo_register.h"
+#include "../../include/algo_memory.h"
+#include "../../include/algo_vm.h"
+
+/*
+ * An .algoc file, in the byte order of the machine that wrote it. Every
+ * offset is from the start of the file and every section starts on an
+ * 8-byte boundary, so the loader can point functions straight into a
+ * mapping of the file:
+ *
+ *   header
+ *   StringRecord[string_count]       the interned name table
+ *   string bytes                     each followed by a NUL
+ *   u32[global_count]                the name of each global slot
+ *   FunctionRecord[function_count]   the script first
+ *   ConstantRecord[]                 each function's constants in turn
+ *   code, line tables, register code
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    /* OP_COUNT or R_OP_COUNT of the compiler that wrote the file. */
+    uint32_t op_count;
+    uint32_t string_count;
+    uint32_t strings;
+    uint32_t global_count;
+    uint32_t globals;
+    uint32_t function_count;
+    uint32_t functions;
+} FileHeader;
+
+#define FILE_REGISTERS 1
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} StringRecord;
+
+/* A name of NO_NAME is the script's. */
+#define NO_NAME UINT32_MAX
+
+typedef struct {
+    uint32_t name;
+    int32_t arity;
+    int32_t max_slots;
+    int32_t frame_size;
+    uint32_t code;
+    uint32_t code_count;
+    uint32_t lines;
+    uint32_t lines_count;
+    uint32_t registers;
+    uint32_t register_count;
+    uint32_t register_lines;
+    uint32_t register_lines_count;
+    uint32_t constants;
+    uint32_t constant_count;
+} FunctionRecord;
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantType;
+
+/* `index` names a string or function record; `number` holds a number. */
+typedef struct {
+    uint32_t type;
+    uint32_t index;
+    double number;
+} ConstantRecord;
+
+/* ---- Writing ---- */
+
+typedef struct {
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+} Buffer;
+
+/* Objects already given an index, found by address. */
+typedef struct {
+    Obj** keys;
+    uint32_t* indexes;
+    size_t count;
+    size_t capacity;
+} IndexTable;
+
+typedef struct {
+    Buffer out;
+    IndexTable string_indexes;
+    IndexTable function_indexes;
+    ObjString** strings;
+    size_t string_count;
+    size_t string_capacity;
+    ObjFunction** functions;
+    size_t function_count;
+    size_t function_capacity;
+    bool failed;
+} Writer;
+
+static void* grow_array(void* array, size_t* capacity, size_t needed, size_t size) {
+    if (*capacity >= needed) return array;
+    size_t old_capacity = *capacity;
+    *capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    if (*capacity < needed) *capacity = needed;
+    array = realloc(array, *capacity * size);
+    if (array == NULL) {
+        fprintf(stderr, "Out of memory writing bytecode\n");
+        exit(74);
+    }
+    return array;
+}
+
+/* Appends `length` bytes, zeroed when `bytes` is NULL, and returns their offset. */
+static size_t append(Buffer* buffer, const void* bytes, size_t length) {
+    size_t offset = buffer->count;
+    buffer->bytes = grow_array(buffer->bytes, &buffer->capacity, offset + length, 1);
+    if (bytes != NULL) {
+        memcpy(buffer->bytes + offset, bytes, length);
+    } else {
+        memset(buffer->bytes + offset, 0, length);
+    }
+    buffer->count += length;
+    return offset;
+}
+
+static void align(Buffer* buffer) {
+    append(buffer, NULL, (8 - buffer->count % 8) % 8);
+}
+
+static size_t hash_pointer(Obj* key, size_t capacity) {
+    return ((uintptr_t)key >> 4) * 2654435761u & (capacity - 1);
+}
+
+static uint32_t* find_index(IndexTable* table, Obj* key) {
+    if (table->capacity == 0) return NULL;
+    for (size_t i = hash_pointer(key, table->capacity);; i = (i + 1) & (table->capacity - 1)) {
+        if (table->keys[i] == key) return &table->indexes[i];
+        if (table->keys[i] == NULL) return NULL;
+    }
+}
+
+static void add_index(IndexTable* table, Obj* key, uint32_t index) {
+    if (table->count + 1 > table->capacity * 3 / 4) {
+        IndexTable grown;
+        grown.capacity = table->capacity < 8 ? 8 : table->capacity * 2;
+        grown.count = 0;
+        grown.keys = calloc(grown.capacity, sizeof(Obj*));
+        grown.indexes = malloc(grown.capacity * sizeof(uint32_t));
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (table->keys[i] != NULL) add_index(&grown, table->keys[i], table->indexes[i]);
+        }
+        free(table->keys);
+        free(table->indexes);
+        *table = grown;
+    }
+    size_t i = hash_pointer(key, table->capacity);
+    while (table->keys[i] != NULL) i = (i + 1) & (table->capacity - 1);
+    table->keys[i] = key;
+    table->indexes[i] = index;
+    table->count++;
+}
+
+/* Strings are interned, so one record serves every use of a name or literal. */
+static uint32_t string_index(Writer* writer, ObjString* string) {
+    uint32_t* found = find_index(&writer->string_indexes, (Obj*)string);
+    if (found != NULL) return *found;
+    
+    uint32_t index = (uint32_t)writer->string_count;
+    writer->strings = grow_array(writer->strings, &writer->string_capacity,
+                                 writer->string_count + 1, sizeof(ObjString*));
+    writer->strings[writer->string_count++] = string;
+    add_index(&writer->string_indexes, (Obj*)string, index);
+    return index;
+}
+
+/* Numbers every function reachable from `function`, depth first, compiling any still pending. */
+static void collect_functions(Writer* writer, ObjFunction* function) {
+    if (find_index(&writer->function_indexes, (Obj*)function) != NULL) return;
+    if (function->pending != NULL && !compile_pending(function)) {
+        writer->failed = true;
+        return;
+    }
+    
+    add_index(&writer->function_indexes, (Obj*)function, (uint32_t)writer->function_count);
+    writer->functions = grow_array(writer->functions, &writer->function_capacity,
+                                   writer->function_count + 1, sizeof(ObjFunction*));
+    writer->functions[writer->function_count++] = function;
+    
+    for (size_t i = 0; i < function->chunk.constant_count; i++) {
+        Value constant = function->chunk.constants[i];
+        if (IS_FUNCTION(constant)) collect_functions(writer, AS_FUNCTION(constant));
+    }
+}
+
+static ConstantRecord constant_record(Writer* writer, Value value) {
+    ConstantRecord record = {CONSTANT_NIL, 0, 0};
+    if (IS_BOOL(value)) {
+        record.type = AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE;
+    } else if (IS_NUMBER(value)) {
+        record.type = CONSTANT_NUMBER;
+        record.number = AS_NUMBER(value);
+    } else if (IS_STRING(value)) {
+        record.type = CONSTANT_STRING;
+        record.index = string_index(writer, AS_STRING(value));
+    } else if (IS_FUNCTION(value)) {
+        record.type = CONSTANT_FUNCTION;
+        record.index = *find_index(&writer->function_indexes, AS_OBJ(value));
+    } else if (!IS_NIL(value)) {
+        writer->failed = true;
+    }
+    return record;
+}
+
+static uint32_t append_section(Buffer* buffer, const void* bytes, size_t length) {
+    align(buffer);
+    return (uint32_t)append(buffer, bytes, length);
+}
+
+static void free_writer(Writer* writer) {
+    free(writer->out.bytes);
+    free(writer->string_indexes.keys);
+    free(writer->string_indexes.indexes);
+    free(writer->function_indexes.keys);
+    free(writer->function_indexes.indexes);
+    free(writer->strings);
+    free(writer->functions);
+}
+
+bool write_bytecode_file(ObjFunction* script, const char* path, bool report) {
+    Writer writer;
+    memset(&writer, 0, sizeof(Writer));
+    
+    /* Compiling may collect; nothing after this allocates objects. */
+    push(OBJ_VAL(script));
+    collect_functions(&writer, script);
+    pop();
+    bool registers = script->registers.count > 0;
+    
+    /* Global names take the first records, in slot order. */
+    uint32_t* globals = malloc((global_slots.count + 1) * sizeof(uint32_t));
+    for (int i = 0; i < global_slots.count; i++) {
+        globals[i] = string_index(&writer, global_slots.names[i]);
+    }
+    
+    FunctionRecord* functions = calloc(writer.function_count, sizeof(FunctionRecord));
+    ConstantRecord** constants = malloc(writer.function_count * sizeof(ConstantRecord*));
+    for (size_t i = 0; i < writer.function_count; i++) {
+        ObjFunction* function = writer.functions[i];
+        FunctionRecord* record = &functions[i];
+        record->name = function->name != NULL ? string_index(&writer, function->name) : NO_NAME;
+        record->arity = function->arity;
+        record->max_slots = function->max_slots;
+        record->frame_size = function->registers.frame_size;
+        record->constant_count = (uint32_t)function->chunk.constant_count;
+        constants[i] = malloc((function->chunk.constant_count + 1) * sizeof(ConstantRecord));
+        for (size_t j = 0; j < function->chunk.constant_count; j++) {
+            constants[i][j] = constant_record(&writer, function->chunk.constants[j]);
+        }
+    }
+    
+    Buffer* out = &writer.out;
+    FileHeader header;
+    memset(&header, 0, sizeof(FileHeader));
+    memcpy(header.magic, ALGOC_MAGIC, 4);
+    header.version = ALGOC_VERSION;
+    header.flags = registers ? FILE_REGISTERS : 0;
+    header.op_count = registers ? R_OP_COUNT : OP_COUNT;
+    header.string_count = (uint32_t)writer.string_count;
+    header.global_count = (uint32_t)global_slots.count;
+    header.function_count = (uint32_t)writer.function_count;
+    append(out, NULL, sizeof(FileHeader));
+    
+    header.strings = append_section(out, NULL, writer.string_count * sizeof(StringRecord));
+    for (size_t i = 0; i < writer.string_count; i++) {
+        ObjString* string = writer.strings[i];
+        StringRecord record = {(uint32_t)out->count, (uint32_t)string->length};
+        memcpy(out->bytes + header.strings + i * sizeof(StringRecord), &record, sizeof(record));
+        append(out, string->chars, string->length + 1);
+    }
+    header.globals = append_section(out, globals, global_slots.count * sizeof(uint32_t));
+    header.functions = append_section(out, NULL, writer.function_count * sizeof(FunctionRecord));
+    
+    for (size_t i = 0; i < writer.function_count; i++) {
+        ObjFunction* function = writer.functions[i];
+        FunctionRecord* record = &functions[i];
+        record->constants = append_section(out, constants[i],
+                                           function->chunk.constant_count * sizeof(ConstantRecord));
+        record->code = append_section(out, function->chunk.code, function->chunk.count);
+        record->code_count = (uint32_t)function->chunk.count;
+        record->lines = append_section(out, function->chunk.lines.bytes, function->chunk.lines.count);
+        record->lines_count = (uint32_t)function->chunk.lines.count;
+        record->registers = append_section(out, function->registers.code,
+                                           function->registers.count * sizeof(uint32_t));
+        record->register_count = (uint32_t)function->registers.count;
+        record->register_lines = append_section(out, function->registers.lines.bytes,
+                                                function->registers.lines.count);
+        record->register_lines_count = (uint32_t)function->registers.lines.count;
+        free(constants[i]);
+    }
+    memcpy(out->bytes + header.functions, functions, writer.function_count * sizeof(FunctionRecord));
+    memcpy(out->bytes, &header, sizeof(FileHeader));
+    free(functions);
+    free(constants);
+    free(globals);
+    
+    if (writer.failed || out->count > UINT32_MAX) {
+        if (report) fprintf(stderr, "Cannot save this program as bytecode\n");
+        free_writer(&writer);
+        return false;
+    }
+    
+    /*
+     * Written under a name of this process's own and then renamed, so a
+     * process loading `path` meanwhile sees the old file or the new one,
+     * never part of one.
+     */
+    char* temporary = malloc(strlen(path) + 32);
+    sprintf(temporary, "%s.%ld.tmp", path, (long)getpid());
+    FILE* file = fopen(temporary, "wb");
+    bool written = file != NULL && fwrite(out->bytes, 1, out->count, file) == out->count;
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (written && rename(temporary, path) != 0) written = false;
+    if (!written) {
+        if (file != NULL) remove(temporary);
+        if (report) fprintf(stderr, "Could not write file \"%s\"\n", path);
+    }
+    free(temporary);
+    free_writer(&writer);
+    return written;
+}
+
+/* ---- Loading ---- */
+
+/*
+ * The file is mapped twice. Chunks, line tables and register code point
+ * into a read-only mapping; ObjFunction.code points into a private
+ * writable one, so the pages quickening writes to are copied on first
+ * write and the rest stay shared with the page cache.
+ */
+typedef struct {
+    const uint8_t* bytes;
+    uint8_t* writable;
+    size_t size;
+} Mapping;
+
+static Mapping mapping = {NULL, NULL, 0};
+
+/* Functions made so far; they are only reachable from here until loading ends. */
+static ObjFunction** loading = NULL;
+static size_t loading_count = 0;
+
+void mark_loader_roots() {
+    for (size_t i = 0; i < loading_count; i++) {
+        mark_object((Obj*)loading[i]);
+    }
+}
+
+bool is_bytecode_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    char magic[4];
+    bool found = fread(magic, 1, 4, file) == 4 && memcmp(magic, ALGOC_MAGIC, 4) == 0;
+    fclose(file);
+    return found;
+}
+
+static bool in_file(uint32_t offset, size_t count, size_t size) {
+    return offset % 8 == 0 && offset <= mapping.size && count <= (mapping.size - offset) / size;
+}
+
+/* No call passes more than 255 arguments, so no larger arity can be called. */
+static bool valid_function(const FunctionRecord* record, const FileHeader* header) {
+    return (record->name == NO_NAME || record->name < header->string_count) &&
+           record->arity >= 0 && record->arity <= UINT8_MAX &&
+           record->max_slots >= 0 && record->frame_size >= 0 &&
+           in_file(record->code, record->code_count, 1) &&
+           in_file(record->lines, record->lines_count, 1) &&
+           in_file(record->registers, record->register_count, sizeof(uint32_t)) &&
+           in_file(record->register_lines, record->register_lines_count, 1) &&
+           in_file(record->constants, record->constant_count, sizeof(ConstantRecord));
+}
+
+/* Why a file starting with `header` cannot be loaded, or NULL when it can. */
+static const char* check_header(const FileHeader* header) {
+    if (memcmp(header->magic, ALGOC_MAGIC, 4) != 0) return "is not a bytecode file";
+    if (header->version != ALGOC_VERSION) {
+        return "is from another version of Algolang; compile it again";
+    }
+    uint32_t op_count = header->flags & FILE_REGISTERS ? R_OP_COUNT : OP_COUNT;
+    if (header->op_count != op_count) {
+        return "was compiled for a different instruction set; compile it again";
+    }
+    if (!in_file(header->strings, header->string_count, sizeof(StringRecord)) ||
+        !in_file(header->globals, header->global_count, sizeof(uint32_t)) ||
+        !in_file(header->functions, header->function_count, sizeof(FunctionRecord)) ||
+        header->function_count == 0) {
+        return "is not a valid bytecode file";
+    }
+    return NULL;
+}
+
+static ObjString* load_string(const FileHeader* header, uint32_t index) {
+    const StringRecord* record = (const StringRecord*)(mapping.bytes + header->strings) + index;
+    if (record->offset > mapping.size || record->length >= mapping.size - record->offset) return NULL;
+    return copy_string((const char*)mapping.bytes + record->offset, record->length);
+}
+
+/* Reads a varint of a line table, failing where find_position() would read past its end. */
+static bool skip_varint(const uint8_t* bytes, uint32_t count, uint32_t* read, uint32_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35 && *read < count; shift += 7) {
+        uint8_t byte = bytes[(*read)++];
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static bool valid_lines(const uint8_t* bytes, uint32_t count) {
+    uint32_t read = 0;
+    while (read < count) {
+        uint32_t value;
+        if (!skip_varint(bytes, count, &read, &value)) return false;
+        if (!skip_varint(bytes, count, &read, &value)) return false;
+        if ((value & 1) && !skip_varint(bytes, count, &read, &value)) return false;
+    }
+    return true;
+}
+
+static uint32_t read_operand(const uint8_t* ip) {
+    uint32_t operand = 0;
+    for (int i = 1; i < op_info[ip[0]].length; i++) operand = (operand << 8) | ip[i];
+    return operand;
+}
+
+/* An instruction start whose stack depth is not known, being unreachable so far. */
+#define UNREACHED (-2)
+
+/*
+ * Checks stack code in one pass, in the order it was compiled: every
+ * instruction must fit in the code, constants and globals must exist and
+ * jumps must land on an instruction. Along every reachable path a local
+ * must be below the top of the stack, nothing may pop slot 0, the depth
+ * must agree where paths meet and no path may run off the end; the
+ * deepest point must be max_slots, which the VM reserves per call. A
+ * backward jump only reaches a loop head, so its depth is already known.
+ */
+static bool verify_chunk(const ObjFunction* function, uint32_t global_count) {
+    const Chunk* chunk = &function->chunk;
+    size_t count = chunk->count;
+    const uint8_t* code = chunk->code;
+    if (count == 0) return false;
+    
+    /* Depths of instruction starts passed and of forward jump targets; -1 for neither. */
+    int* depth_at = malloc(count * sizeof(int));
+    for (size_t i = 0; i < count; i++) depth_at[i] = -1;
+    int depth = 1 + function->arity;
+    int max_depth = depth;
+    size_t pending_targets = 0;
+    bool valid = true;
+    
+    size_t offset = 0;
+    while (offset < count && valid) {
+        const uint8_t* ip = &code[offset];
+        if (ip[0] >= OP_COUNT || (size_t)op_info[ip[0]].length > count - offset) {
+            valid = false;
+            break;
+        }
+        size_t next = offset + op_info[ip[0]].length;
+        
+        if (depth_at[offset] != -1) {
+            pending_targets--;
+            if (depth_at[offset] != UNREACHED) {
+                if (depth != UNREACHED && depth != depth_at[offset]) valid = false;
+                depth = depth_at[offset];
+            }
+        }
+        depth_at[offset] = depth;
+        
+        switch (ip[0]) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+                valid = valid && read_operand(ip) < chunk->constant_count;
+                break;
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_GET_GLOBAL_LONG:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_SET_GLOBAL_LONG:
+                valid = valid && read_operand(ip) < global_count;
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                valid = valid && (depth == UNREACHED || ip[1] < depth);
+                break;
+            case OP_ADD_LOCALS:
+                valid = valid && (depth == UNREACHED || (ip[1] < depth && ip[2] < depth));
+                break;
+            case OP_LESS_LOCAL_CONSTANT:
+                valid = valid && ip[2] < chunk->constant_count &&
+                        (depth == UNREACHED || ip[1] < depth);
+                break;
+            default:
+                break;
+        }
+        
+        if (depth != UNREACHED) {
+            depth += instruction_stack_effect(ip);
+            if (depth < 1) valid = false;
+            if (depth > max_depth) max_depth = depth;
+        }
+        
+        size_t target;
+        if (instruction_jump_target(ip, offset, &target)) {
+            if (target >= next) {
+                if (target >= count) {
+                    valid = false;
+                } else if (depth_at[target] == -1) {
+                    depth_at[target] = depth;
+                    pending_targets++;
+                } else if (depth_at[target] == UNREACHED) {
+                    depth_at[target] = depth;
+                } else if (depth != UNREACHED && depth != depth_at[target]) {
+                    valid = false;
+                }
+            } else if (depth_at[target] == -1 ||
+                       (depth != UNREACHED && depth != depth_at[target])) {
+                valid = false;
+            }
+        }
+        
+        switch (ip[0]) {
+            case OP_JUMP:
+            case OP_JUMP_LONG:
+            case OP_LOOP:
+            case OP_LOOP_LONG:
+            case OP_RETURN:
+                depth = UNREACHED;
+                break;
+            default:
+                if (next == count && depth != UNREACHED) valid = false;
+                break;
+        }
+        offset = next;
+    }
+    
+    free(depth_at);
+    /* A target never reached as an instruction start is inside one. */
+    return valid && pending_targets == 0 && max_depth == function->max_slots;
+}
+
+static bool valid_register(uint32_t operand, const ObjFunction* function) {
+    return operand < (uint32_t)function->registers.frame_size;
+}
+
+static bool valid_rk(uint32_t operand, const ObjFunction* function) {
+    if (operand < RK_CONSTANT) return valid_register(operand, function);
+    return operand - RK_CONSTANT < function->chunk.constant_count;
+}
+
+/*
+ * The register VM trusts its operands the same way: registers must be in
+ * the frame, constants and globals must exist, jumps must stay in the
+ * code and every conditional must be followed by the R_JMP it takes.
+ */
+static bool verify_registers(const ObjFunction* function, uint32_t global_count) {
+    const RegisterCode* registers = &function->registers;
+    int count = registers->count;
+    if (registers->frame_size < 1 + function->arity || registers->frame_size > MAX_REGISTERS) {
+        return false;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        uint32_t instruction = registers->code[i];
+        uint32_t a = GET_A(instruction);
+        uint32_t b = GET_B(instruction);
+        uint32_t c = GET_C(instruction);
+        bool valid;
+        switch (GET_OP(instruction)) {
+            case R_MOVE:
+            case R_NEG:
+            case R_NOT:
+                valid = valid_register(a, function) && valid_register(b, function);
+                break;
+            case R_LOADK:
+                valid = valid_register(a, function) &&
+                        GET_BX(instruction) < function->chunk.constant_count;
+                break;
+            case R_LOADNIL:
+            case R_LOADBOOL:
+            case R_PRINT:
+                valid = valid_register(a, function);
+                break;
+            case R_GETGLOBAL:
+            case R_SETGLOBAL:
+            case R_DEFGLOBAL:
+                valid = valid_register(a, function) && GET_BX(instruction) < global_count;
+                break;
+            case R_ADD: case R_SUB: case R_MUL: case R_DIV: case R_MOD:
+            case R_EQ: case R_NE: case R_LT: case R_GT: case R_GE: case R_LE:
+                valid = valid_register(a, function) && valid_rk(b, function) &&
+                        valid_rk(c, function);
+                break;
+            case R_JMP: {
+                int target = i + 1 + GET_SBX(instruction);
+                valid = target >= 0 && target < count;
+                break;
+            }
+            case R_IFEQ:
+            case R_IFLT:
+            case R_IFGT:
+                valid = valid_rk(b, function) && valid_rk(c, function) &&
+                        i + 1 < count && GET_OP(registers->code[i + 1]) == R_JMP;
+                break;
+            case R_TEST:
+                valid = valid_register(b, function) &&
+                        i + 1 < count && GET_OP(registers->code[i + 1]) == R_JMP;
+                break;
+            case R_CALL:
+            case R_TAILCALL:
+                valid = valid_register(a + b, function);
+                break;
+            case R_RETURN:
+                valid = b == 0 || valid_register(a, function);
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) return false;
+    }
+    
+    /* The last instruction must not fall off the end. */
+    uint8_t last = count > 0 ? GET_OP(registers->code[count - 1]) : R_OP_COUNT;
+    return last == R_RETURN || last == R_JMP;
+}
+
+/* Checks a function's code before anything runs or renumbers it; see verify_chunk(). */
+static bool verify_function(const ObjFunction* function, const FileHeader* header) {
+    if (!valid_lines(function->chunk.lines.bytes, (uint32_t)function->chunk.lines.count) ||
+        !valid_lines(function->registers.lines.bytes, (uint32_t)function->registers.lines.count)) {
+        return false;
+    }
+    /* Only the code the file was compiled to may be present; the rest would be freed as owned. */
+    if (header->flags & FILE_REGISTERS) {
+        return function->chunk.count == 0 && function->chunk.lines.count == 0 &&
+               verify_registers(function, header->global_count);
+    }
+    return function->registers.count == 0 && function->registers.lines.count == 0 &&
+           verify_chunk(function, header->global_count);
+}
+
+/*
+ * Slot numbers are baked into the code, so they only stay valid while
+ * the natives are defined in the same order as when the file was
+ * written. When they are not, a function gets its own copy of its code
+ * with every global operand renumbered.
+ */
+static bool renumber_globals(ObjFunction* function, const int* slots) {
+    if (function->registers.count > 0) {
+        uint32_t* code = malloc(function->registers.count * sizeof(uint32_t));
+        for (int i = 0; i < function->registers.count; i++) {
+            uint32_t instruction = function->registers.code[i];
+            uint8_t op = GET_OP(instruction);
+            if (op == R_GETGLOBAL || op == R_SETGLOBAL || op == R_DEFGLOBAL) {
+                if (slots[GET_BX(instruction)] > MAX_BX) {
+                    free(code);
+                    return false;
+                }
+                instruction = ENCODE_ABX(op, GET_A(instruction), slots[GET_BX(instruction)]);
+            }
+            code[i] = instruction;
+        }
+        function->registers.code = code;
+        function->registers.capacity = function->registers.count;
+        LineTable* lines = &function->registers.lines;
+        if (lines->count > 0) {
+            lines->bytes = memcpy(malloc(lines->count), lines->bytes, lines->count);
+            lines->capacity = lines->count;
+        }
+    }
+    
+    if (function->chunk.count > 0) {
+        InstructionList list;
+        decode_chunk(&function->chunk, NULL, 0, &list);
+        for (int i = 0; i < list.count; i++) {
+            Instruction* instruction = &list.code[i];
+            if (instruction->op == OP_GET_GLOBAL || instruction->op == OP_DEFINE_GLOBAL ||
+                instruction->op == OP_SET_GLOBAL) {
+                instruction->operand = slots[instruction->operand];
+            }
+        }
+        /* encode_chunk() frees the old code and lines, which are in the mapping. */
+        function->chunk.code = NULL;
+        init_line_table(&function->chunk.lines);
+        encode_chunk(&function->chunk, &list);
+        free_instruction_list(&list);
+        function->code = memcpy(malloc(function->chunk.count), function->chunk.code,
+                                function->chunk.count);
+    }
+    function->mapped = false;
+    return true;
+}
+
+static bool load_constants(ObjFunction* function, const FunctionRecord* record,
+                           const FileHeader* header) {
+    const ConstantRecord* constants = (const ConstantRecord*)(mapping.bytes + record->constants);
+    Chunk* chunk = &function->chunk;
+    chunk->constants = malloc((record->constant_count + 1) * sizeof(Value));
+    chunk->constant_capacity = record->constant_count;
+    count_bytes(record->constant_count * sizeof(Value));
+    
+    for (uint32_t i = 0; i < record->constant_count; i++) {
+        const ConstantRecord* constant = &constants[i];
+        Value value;
+        switch (constant->type) {
+            case CONSTANT_NIL: value = NIL_VAL; break;
+            case CONSTANT_FALSE: value = BOOL_VAL(false); break;
+            case CONSTANT_TRUE: value = BOOL_VAL(true); break;
+            case CONSTANT_NUMBER: value = NUMBER_VAL(constant->number); break;
+            case CONSTANT_STRING: {
+                if (constant->index >= header->string_count) return false;
+                ObjString* string = load_string(header, constant->index);
+                if (string == NULL) return false;
+                value = OBJ_VAL(string);
+                break;
+            }
+            case CONSTANT_FUNCTION:
+                if (constant->index >= header->function_count) return false;
+                value = OBJ_VAL(loading[constant->index]);
+                break;
+            default:
+                return false;
+        }
+        /* Counted only once stored, so a collection never marks an unset constant. */
+        chunk->constants[i] = value;
+        chunk->constant_count = i + 1;
+        object_barrier((Obj*)function, value);
+    }
+    return true;
+}
+
+static void point_into_mapping(ObjFunction* function, const FunctionRecord* record) {
+    function->arity = record->arity;
+    function->max_slots = record->max_slots;
+    function->mapped = true;
+    
+    /* Empty arrays stay NULL, so only arrays in the mapping need copying to own them. */
+    Chunk* chunk = &function->chunk;
+    chunk->count = record->code_count;
+    if (chunk->count > 0) {
+        chunk->code = (uint8_t*)mapping.bytes + record->code;
+        function->code = mapping.writable + record->code;
+    }
+    chunk->lines.count = record->lines_count;
+    if (chunk->lines.count > 0) chunk->lines.bytes = (uint8_t*)mapping.bytes + record->lines;
+    
+    RegisterCode* registers = &function->registers;
+    registers->count = (int)record->register_count;
+    if (registers->count > 0) registers->code = (uint32_t*)(mapping.bytes + record->registers);
+    registers->lines.count = record->register_lines_count;
+    if (registers->lines.count > 0) {
+        registers->lines.bytes = (uint8_t*)mapping.bytes + record->register_lines;
+    }
+    registers->frame_size = record->frame_size;
+}
+
+static ObjFunction* load_functions(const FileHeader* header) {
+    const FunctionRecord* records = (const FunctionRecord*)(mapping.bytes + header->functions);
+    for (uint32_t i = 0; i < header->function_count; i++) {
+        if (!valid_function(&records[i], header)) return NULL;
+    }
+    
+    /* Defines every global name first, so its slot can be checked against the file's. */
+    const uint32_t* globals = (const uint32_t*)(mapping.bytes + header->globals);
+    int* slots = malloc((header->global_count + 1) * sizeof(int));
+    bool renumber = false;
+    for (uint32_t i = 0; i < header->global_count; i++) {
+        if (globals[i] >= header->string_count) {
+            free(slots);
+            return NULL;
+        }
+        ObjString* name = load_string(header, globals[i]);
+        if (name == NULL) {
+            free(slots);
+            return NULL;
+        }
+        slots[i] = global_slot(name);
+        if (slots[i] != (int)i) renumber = true;
+    }
+    
+    loading = malloc(header->function_count * sizeof(ObjFunction*));
+    loading_count = 0;
+    for (uint32_t i = 0; i < header->function_count; i++) {
+        ObjFunction* function = new_function();
+        point_into_mapping(function, &records[i]);
+        loading[loading_count++] = function;
+    }
+    
+    bool loaded = true;
+    for (uint32_t i = 0; i < header->function_count && loaded; i++) {
+        ObjFunction* function = loading[i];
+        loaded = load_constants(function, &records[i], header) && verify_function(function, header);
+        if (loaded && records[i].name != NO_NAME) {
+            function->name = load_string(header, records[i].name);
+            loaded = function->name != NULL;
+            if (loaded) object_barrier((Obj*)function, OBJ_VAL(function->name));
+        }
+        if (loaded && renumber) loaded = renumber_globals(function, slots);
+    }
+    
+    ObjFunction* script = loading[0];
+    free(loading);
+    loading = NULL;
+    loading_count = 0;
+    free(slots);
+    return loaded ? script : NULL;
+}
+
+static bool map_file(int fd, size_t size) {
+    void* bytes = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    void* writable = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (bytes == MAP_FAILED || writable == MAP_FAILED) {
+        if (bytes != MAP_FAILED) munmap(bytes, size);
+        if (writable != MAP_FAILED) munmap(writable, size);
+        return false;
+    }
+    mapping = (Mapping){bytes, writable, size};
+    return true;
+}
+
+ObjFunction* load_bytecode_file(const char* path, bool report) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (report) fprintf(stderr, "Could not open file \"%s\"\n", path);
+        return NULL;
+    }
+    
+    const char* problem = NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FileHeader)) {
+        problem = "is not a valid bytecode file";
+    } else if (!map_file(fd, (size_t)info.st_size)) {
+        problem = "could not be mapped";
+    }
+    close(fd);
+    
+    ObjFunction* script = NULL;
+    if (problem == NULL) problem = check_header((const FileHeader*)mapping.bytes);
+    if (problem == NULL) {
+        script = load_functions((const FileHeader*)mapping.bytes);
+        if (script == NULL) problem = "is not a valid bytecode file";
+    }
+    if (problem != NULL) {
+        if (report) fprintf(stderr, "\"%s\" %s\n", path, problem);
+        unload_bytecode_file();
+    }
+    return script;
+}
+
+/* Call after the functions pointing into the file are freed. */
+void unload_bytecode_file() {
+    if (mapping.bytes == NULL) return;
+    munmap((void*)mapping.bytes, mapping.size);
+    munmap(mapping.writable, mapping.size);
+    mapping = (Mapping){NULL, NULL, 0};
+}
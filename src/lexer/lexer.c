@@ -1,9 +1,220 @@
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
 #include "../../include/algo_token.h"
 
+#ifdef ALGO_SIMD_LEXER
+#include <immintrin.h>
+#endif
+
+/*
+ * Character classes come from a table rather than <ctype.h>, whose calls
+ * depend on the locale. Bytes above 127 and the terminating NUL are in no
+ * class, so a scan stops at the end of the source without checking it.
+ */
+#define CHAR_BLANK 0x01
+#define CHAR_DIGIT 0x02
+#define CHAR_ALPHA 0x04
+#define CHAR_WORD (CHAR_DIGIT | CHAR_ALPHA)
+
+static uint8_t char_class[256];
+
+static void init_char_classes() {
+    char_class[' '] = CHAR_BLANK;
+    char_class['\t'] = CHAR_BLANK;
+    char_class['\r'] = CHAR_BLANK;
+    for (int c = '0'; c <= '9'; c++) char_class[c] = CHAR_DIGIT;
+    for (int c = 'a'; c <= 'z'; c++) char_class[c] = CHAR_ALPHA;
+    for (int c = 'A'; c <= 'Z'; c++) char_class[c] = CHAR_ALPHA;
+    char_class['_'] = CHAR_ALPHA;
+}
+
+static bool in_class(char c, uint8_t mask) {
+    return (char_class[(uint8_t)c] & mask) != 0;
+}
+
+/*
+ * Runs of blanks, comment bodies, identifier tails and digits are skipped
+ * by one of these, which return the first byte not in the run: at the
+ * latest the terminating NUL.
+ */
+typedef const char* (*ScanFn)(const char* p);
+
+typedef struct {
+    ScanFn blanks;
+    ScanFn comment;
+    ScanFn word;
+    ScanFn digits;
+} Scanners;
+
+static const char* scalar_blanks(const char* p) {
+    while (in_class(*p, CHAR_BLANK)) p++;
+    return p;
+}
+
+static const char* scalar_comment(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* scalar_word(const char* p) {
+    while (in_class(*p, CHAR_WORD)) p++;
+    return p;
+}
+
+static const char* scalar_digits(const char* p) {
+    while (in_class(*p, CHAR_DIGIT)) p++;
+    return p;
+}
+
+#ifdef ALGO_SIMD_LEXER
+/*
+ * The vector scans test 16 or 32 bytes at a time. A block may run past
+ * the NUL, whose class stops the scan there, but it never crosses into
+ * another page, which might not be mapped; a run reaching a page boundary
+ * is finished by the next narrower scan.
+ */
+#define LEXER_PAGE 4096
+#define IN_PAGE(p, size) (((uintptr_t)(p) & (LEXER_PAGE - 1)) <= LEXER_PAGE - (size))
+
+/* Bytes x with low <= x <= low + span, as unsigned. */
+static __m128i sse2_range(__m128i x, char low, char span) {
+    __m128i offset = _mm_sub_epi8(x, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(span)), offset);
+}
+
+static __m128i sse2_blank(__m128i x) {
+    __m128i space = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+    __m128i tab = _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'));
+    __m128i cr = _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'));
+    return _mm_or_si128(space, _mm_or_si128(tab, cr));
+}
+
+static __m128i sse2_line_end(__m128i x) {
+    __m128i newline = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+    return _mm_or_si128(newline, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+}
+
+/* Setting bit 5 folds upper case onto lower case and leaves digits and '_' apart. */
+static __m128i sse2_word(__m128i x) {
+    __m128i letter = sse2_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 25);
+    __m128i underscore = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(letter, underscore), sse2_range(x, '0', 9));
+}
+
+static __m128i sse2_digit(__m128i x) {
+    return sse2_range(x, '0', 9);
+}
+
+/* The first stop in a block: for a class test `in`, the first byte not matching it, else the first match. */
+#define FIRST_STOP(hits, in, all) ((in) ? ~(hits) & (all) : (hits))
+
+#define SSE2_SCAN(name, test, in, scalar) \
+    static const char* name(const char* p) { \
+        while (IN_PAGE(p, 16)) { \
+            __m128i x = _mm_loadu_si128((const __m128i*)p); \
+            uint32_t stops = FIRST_STOP((uint32_t)_mm_movemask_epi8(test(x)), in, 0xFFFFu); \
+            if (stops != 0) return p + __builtin_ctz(stops); \
+            p += 16; \
+        } \
+        return scalar(p); \
+    }
+
+SSE2_SCAN(sse2_blanks, sse2_blank, true, scalar_blanks)
+SSE2_SCAN(sse2_comment, sse2_line_end, false, scalar_comment)
+SSE2_SCAN(sse2_word_run, sse2_word, true, scalar_word)
+SSE2_SCAN(sse2_digits, sse2_digit, true, scalar_digits)
+
+#define AVX2 __attribute__((target("avx2")))
+
+static AVX2 __m256i avx2_range(__m256i x, char low, char span) {
+    __m256i offset = _mm256_sub_epi8(x, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(span)), offset);
+}
+
+static AVX2 __m256i avx2_blank(__m256i x) {
+    __m256i space = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+    __m256i tab = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'));
+    __m256i cr = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'));
+    return _mm256_or_si256(space, _mm256_or_si256(tab, cr));
+}
+
+static AVX2 __m256i avx2_line_end(__m256i x) {
+    __m256i newline = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'));
+    return _mm256_or_si256(newline, _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+}
+
+static AVX2 __m256i avx2_word(__m256i x) {
+    __m256i letter = avx2_range(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 25);
+    __m256i underscore = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(_mm256_or_si256(letter, underscore), avx2_range(x, '0', 9));
+}
+
+static AVX2 __m256i avx2_digit(__m256i x) {
+    return avx2_range(x, '0', 9);
+}
+
+/*
+ * Runs rarely fill a 32-byte block, so the first 16 bytes are tested as
+ * SSE2 does and only longer runs go on in 32-byte steps.
+ */
+#define AVX2_SCAN(name, test, test16, in, rest) \
+    static AVX2 const char* name(const char* p) { \
+        if (!IN_PAGE(p, 16)) return rest(p); \
+        __m128i first = _mm_loadu_si128((const __m128i*)p); \
+        uint32_t stops = FIRST_STOP((uint32_t)_mm_movemask_epi8(test16(first)), in, 0xFFFFu); \
+        if (stops != 0) return p + __builtin_ctz(stops); \
+        p += 16; \
+        while (IN_PAGE(p, 32)) { \
+            __m256i x = _mm256_loadu_si256((const __m256i*)p); \
+            stops = FIRST_STOP((uint32_t)_mm256_movemask_epi8(test(x)), in, 0xFFFFFFFFu); \
+            if (stops != 0) return p + __builtin_ctz(stops); \
+            p += 32; \
+        } \
+        return rest(p); \
+    }
+
+AVX2_SCAN(avx2_blanks, avx2_blank, sse2_blank, true, sse2_blanks)
+AVX2_SCAN(avx2_comment, avx2_line_end, sse2_line_end, false, sse2_comment)
+AVX2_SCAN(avx2_word_run, avx2_word, sse2_word, true, sse2_word_run)
+AVX2_SCAN(avx2_digits, avx2_digit, sse2_digit, true, sse2_digits)
+#endif
+
+static const Scanners scanners[] = {
+    [LEXER_SCALAR] = {scalar_blanks, scalar_comment, scalar_word, scalar_digits},
+#ifdef ALGO_SIMD_LEXER
+    [LEXER_SSE2] = {sse2_blanks, sse2_comment, sse2_word_run, sse2_digits},
+    [LEXER_AVX2] = {avx2_blanks, avx2_comment, avx2_word_run, avx2_digits},
+#endif
+};
+
+static bool scan_chosen = false;
+static LexerScan scan_level = LEXER_SCALAR;
+static const Scanners* scan = &scanners[LEXER_SCALAR];
+
+/* The widest scan this CPU runs, or `requested` if that is narrower. */
+static LexerScan supported_scan(LexerScan requested) {
+#ifdef ALGO_SIMD_LEXER
+    if (requested >= LEXER_AVX2 && __builtin_cpu_supports("avx2")) return LEXER_AVX2;
+    if (requested >= LEXER_SSE2) return LEXER_SSE2;
+#else
+    (void)requested;
+#endif
+    return LEXER_SCALAR;
+}
+
+void lexer_set_scan(LexerScan requested) {
+    if (!scan_chosen) init_char_classes();
+    scan_chosen = true;
+    scan_level = supported_scan(requested);
+    scan = &scanners[scan_level];
+}
+
+LexerScan lexer_get_scan() {
+    return scan_level;
+}
+
 void lexer_init(Lexer* lexer, const char* source) {
+    if (!scan_chosen) lexer_set_scan(LEXER_AVX2);
     lexer->source = source;
     lexer->start = source;
     lexer->current = source;
@@ -11,6 +222,29 @@ void lexer_init(Lexer* lexer, const char* source) {
     lexer->column = 1;
 }
 
+/* Moves past a run ending at `to`, which is on the current line. */
+static void skip_to(Lexer* lexer, const char* to) {
+    lexer->column += (int)(to - lexer->current);
+    lexer->current = to;
+}
+
+/*
+ * Most names, numbers and gaps between tokens are a few bytes long, which
+ * an inline loop finishes before a call into a vector scan would start.
+ */
+#define SHORT_RUN 8
+
+static void skip_run(Lexer* lexer, uint8_t mask, ScanFn long_run) {
+    const char* p = lexer->current;
+    for (int i = 0; i < SHORT_RUN; i++, p++) {
+        if (!in_class(*p, mask)) {
+            skip_to(lexer, p);
+            return;
+        }
+    }
+    skip_to(lexer, long_run(p));
+}
+
 static bool is_at_end(Lexer* lexer) {
     return *lexer->current == '\0';
 }
@@ -64,7 +298,7 @@ static void skip_whitespace(Lexer* lexer) {
             case ' ':
             case '\r':
             case '\t':
-                advance(lexer);
+                skip_run(lexer, CHAR_BLANK, scan->blanks);
                 break;
             case '\n':
                 lexer->line++;
@@ -72,9 +306,7 @@ static void skip_whitespace(Lexer* lexer) {
                 advance(lexer);
                 break;
             case '#':
-                while (peek(lexer) != '\n' && !is_at_end(lexer)) {
-                    advance(lexer);
-                }
+                skip_to(lexer, scan->comment(lexer->current + 1));
                 break;
             default:
                 return;
@@ -117,22 +349,16 @@ static TokenType identifier_type(Lexer* lexer) {
 }
 
 static Token identifier(Lexer* lexer) {
-    while (isalnum(peek(lexer)) || peek(lexer) == '_') {
-        advance(lexer);
-    }
+    skip_run(lexer, CHAR_WORD, scan->word);
     return make_token(lexer, identifier_type(lexer));
 }
 
 static Token number(Lexer* lexer) {
-    while (isdigit(peek(lexer))) {
-        advance(lexer);
-    }
+    skip_run(lexer, CHAR_DIGIT, scan->digits);
     
-    if (peek(lexer) == '.' && isdigit(peek_next(lexer))) {
+    if (peek(lexer) == '.' && in_class(peek_next(lexer), CHAR_DIGIT)) {
         advance(lexer);
-        while (isdigit(peek(lexer))) {
-            advance(lexer);
-        }
+        skip_run(lexer, CHAR_DIGIT, scan->digits);
     }
     
     return make_token(lexer, TOKEN_NUMBER);
@@ -165,11 +391,11 @@ Token lexer_next_token(Lexer* lexer) {
     
     char c = advance(lexer);
     
-    if (isalpha(c) || c == '_') {
+    if (in_class(c, CHAR_ALPHA)) {
         return identifier(lexer);
     }
     
-    if (isdigit(c)) {
+    if (in_class(c, CHAR_DIGIT)) {
         return number(lexer);
     }
     
@@ -4,9 +4,11 @@
 #include "../include/algo_common.h"
 #include "../include/algo_vm.h"
 #include "../include/algo_value.h"
+#include "../include/algo_compiler.h"
+#include "../include/algo_bytecode.h"
+#include "../include/algo_memory.h"
 
 extern void init_stdlib();
-extern void free_objects();
 
 static char* read_file(const char* path) {
     FILE* file = fopen(path, "rb");
@@ -59,45 +61,220 @@ static void repl() {
     }
 }
 
-static void run_file(const char* path) {
-    char* source = read_file(path);
-    InterpretResult result = interpret(source);
-    free(source);
+/*
+ * Files starting with the .algoc magic run from their compiled code;
+ * scripts are compiled through the cache.
+ */
+static void run_file(const char* path, bool registers) {
+    ObjFunction* script;
+    if (is_bytecode_file(path)) {
+        script = load_bytecode_file(path, true);
+    } else {
+        char* source = read_file(path);
+        script = compile_cached(source, registers);
+        free(source);
+    }
+    if (script == NULL) exit(65);
     
+    InterpretResult result = run_script(script);
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
-extern void global_set(ObjString* key, Value value);
-
-void define_native(const char* name, NativeFn function) {
-    ObjString* name_str = copy_string(name, strlen(name));
-    ObjNative* native = new_native(function);
+/* Writes `path` compiled to `output`, by default the path with a "c" appended to .algo. */
+static void compile_file(const char* path, const char* output, bool registers) {
+    char* source = read_file(path);
+    ObjFunction* script = registers ? compile_registers(source) : compile(source);
+    free(source);
+    if (script == NULL) exit(65);
     
-    push(OBJ_VAL(name_str));
-    push(OBJ_VAL(native));
+    char* default_output = NULL;
+    if (output == NULL) {
+        size_t length = strlen(path);
+        const char* suffix = length >= 5 && strcmp(path + length - 5, ".algo") == 0 ? "c" : ".algoc";
+        default_output = malloc(length + strlen(suffix) + 1);
+        memcpy(default_output, path, length);
+        strcpy(default_output + length, suffix);
+        output = default_output;
+    }
     
-    global_set(name_str, OBJ_VAL(native));
+    bool written = write_bytecode_file(script, output, true);
+    free(default_output);
+    if (!written) exit(74);
+}
+
+void define_native(const char* name, NativeFn function) {
+    /*
+     * Each object is on the stack before the next allocation can collect,
+     * and is read back from there in case a collection moved it.
+     */
+    push(OBJ_VAL(copy_string(name, strlen(name))));
+    push(OBJ_VAL(new_native(function)));
     
-    pop();
-    pop();
+    Value native = pop();
+    global_set(AS_STRING(pop()), native);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: algolang [options] [path]\n");
+    fprintf(stderr, "  --stack-max <n>   Maximum value stack size in slots (env ALGO_STACK_MAX)\n");
+    fprintf(stderr, "  --frames-max <n>  Maximum call depth (env ALGO_FRAMES_MAX)\n");
+    fprintf(stderr, "  --full-traces     Keep a frame for every call, including tail calls\n");
+    fprintf(stderr, "  --no-quicken      Keep arithmetic and comparisons generic in the interpreter\n");
+    fprintf(stderr, "  --jit, --no-jit   Compile hot functions to native code (default where supported)\n");
+    fprintf(stderr, "  --no-trace        Do not compile hot loops as traces (implied by --no-jit)\n");
+    fprintf(stderr, "  --trace-stats     Report trace entries and exits at exit\n");
+    fprintf(stderr, "  --registers       Compile to register bytecode and run the register VM\n");
+    fprintf(stderr, "  --eager           Compile every function up front rather than on its first call\n");
+    fprintf(stderr, "  --gc-growth <f>   Collect when the heap reaches f times its last live size (default 2)\n");
+    fprintf(stderr, "  --gc-budget <us>  Longest collection pause in microseconds, 0 for all at once (default 500)\n");
+    fprintf(stderr, "  --gc-nursery <kb> Nursery size for young strings in KB, 0 for none (default 256)\n");
+    fprintf(stderr, "  --gc-stats        Report each collection's pauses, bytes freed and heap size\n");
+    fprintf(stderr, "  -O<level>         0: no optimization, 1: superinstructions, 2: also fold constants (default)\n");
+    fprintf(stderr, "  --compile-only    Save the compiled program as path.algoc instead of running it\n");
+    fprintf(stderr, "  -o <file>         Save the compiled program as file (implies --compile-only)\n");
+    fprintf(stderr, "  --no-cache        Compile scripts without the compile cache (env ALGO_CACHE_DIR)\n");
+    fprintf(stderr, "  --cache-stats     Report compile cache hits, misses and timings\n");
+    exit(64);
+}
+
+static long parse_count(const char* text) {
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value <= 0) {
+        fprintf(stderr, "Invalid count \"%s\"\n", text);
+        exit(64);
+    }
+    return value;
+}
+
+static long parse_amount(const char* text) {
+    char* end;
+    long value = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value < 0) {
+        fprintf(stderr, "Invalid amount \"%s\"\n", text);
+        exit(64);
+    }
+    return value;
+}
+
+static double parse_factor(const char* text) {
+    char* end;
+    double value = strtod(text, &end);
+    if (*text == '\0' || *end != '\0' || !(value >= 1)) {
+        fprintf(stderr, "Invalid factor \"%s\"\n", text);
+        exit(64);
+    }
+    return value;
+}
+
+static int parse_level(const char* text) {
+    if (*text == '\0') return 2;
+    if (text[0] >= '0' && text[0] <= '2' && text[1] == '\0') return text[0] - '0';
+    fprintf(stderr, "Invalid optimization level \"%s\"\n", text);
+    exit(64);
 }
 
 int main(int argc, const char* argv[]) {
+    long stack_max = 0;
+    long frames_max = 0;
+    bool tail_calls = true;
+    bool quicken = true;
+    int optimize_level = 2;
+    int jit = -1;
+    bool traces = true;
+    bool trace_stats = false;
+    bool registers = false;
+    bool lazy = true;
+    double gc_growth = 0;
+    long gc_budget = -1;
+    long gc_nursery = -1;
+    bool gc_stats = false;
+    bool compile_only = false;
+    bool cache = true;
+    bool cache_stats = false;
+    const char* output = NULL;
+    const char* path = NULL;
+    
+    const char* env = getenv("ALGO_STACK_MAX");
+    if (env != NULL) stack_max = parse_count(env);
+    env = getenv("ALGO_FRAMES_MAX");
+    if (env != NULL) frames_max = parse_count(env);
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stack-max") == 0 && i + 1 < argc) {
+            stack_max = parse_count(argv[++i]);
+        } else if (strcmp(argv[i], "--frames-max") == 0 && i + 1 < argc) {
+            frames_max = parse_count(argv[++i]);
+        } else if (strcmp(argv[i], "--full-traces") == 0) {
+            tail_calls = false;
+        } else if (strcmp(argv[i], "--no-quicken") == 0) {
+            quicken = false;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = 1;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            jit = 0;
+        } else if (strcmp(argv[i], "--no-trace") == 0) {
+            traces = false;
+        } else if (strcmp(argv[i], "--trace-stats") == 0) {
+            trace_stats = true;
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            registers = true;
+        } else if (strcmp(argv[i], "--eager") == 0) {
+            lazy = false;
+        } else if (strcmp(argv[i], "--gc-growth") == 0 && i + 1 < argc) {
+            gc_growth = parse_factor(argv[++i]);
+        } else if (strcmp(argv[i], "--gc-budget") == 0 && i + 1 < argc) {
+            gc_budget = parse_amount(argv[++i]);
+        } else if (strcmp(argv[i], "--gc-nursery") == 0 && i + 1 < argc) {
+            gc_nursery = parse_amount(argv[++i]);
+        } else if (strcmp(argv[i], "--gc-stats") == 0) {
+            gc_stats = true;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            cache = false;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            cache_stats = true;
+        } else if (strcmp(argv[i], "--compile-only") == 0) {
+            compile_only = true;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+            compile_only = true;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            optimize_level = parse_level(argv[i] + 2);
+        } else if (argv[i][0] == '-' || path != NULL) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+    
     init_vm();
+    set_stack_limits((size_t)stack_max, (int)frames_max);
+    set_tail_calls(tail_calls);
+    set_quicken(quicken);
+    set_optimize_level(optimize_level);
+    set_lazy_functions(lazy && !compile_only);
+    if (jit != -1) set_jit(jit == 1);
+    set_traces(traces, trace_stats);
+    set_registers(registers);
+    set_gc(gc_growth, gc_budget, gc_nursery, gc_stats);
+    set_compile_cache(cache, cache_stats);
     init_stdlib();
     
-    if (argc == 1) {
+    if (compile_only) {
+        if (path == NULL) usage();
+        compile_file(path, output, registers);
+    } else if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
     } else {
-        fprintf(stderr, "Usage: algolang [path]\n");
-        exit(64);
+        run_file(path, registers);
     }
     
     free_vm();
     free_objects();
+    unload_bytecode_file();
+    free_compile_cache();
+    free_ast();
     
     return 0;
 }
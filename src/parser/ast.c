@@ -1,8 +1,78 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../../include/algo_ast.h"
 
+/* Chunks are at least this large; a bigger request gets a chunk of its own. */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaChunk;
+
+static struct {
+    ArenaChunk* first;
+    ArenaChunk* current;
+} arena = {NULL, NULL};
+
+static size_t align_size(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static ArenaChunk* new_chunk(size_t size) {
+    if (size < ARENA_CHUNK_SIZE) size = ARENA_CHUNK_SIZE;
+    
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL) {
+        fprintf(stderr, "Out of memory for the syntax tree\n");
+        exit(74);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void* ast_alloc(size_t size) {
+    size = align_size(size);
+    
+    if (arena.current == NULL) {
+        arena.first = new_chunk(size);
+        arena.current = arena.first;
+    } else if (arena.current->used + size > arena.current->size) {
+        ArenaChunk* chunk = new_chunk(size);
+        arena.current->next = chunk;
+        arena.current = chunk;
+    }
+    
+    void* result = arena.current->data + arena.current->used;
+    arena.current->used += size;
+    return result;
+}
+
+void* ast_grow(void* array, size_t old_size, size_t new_size) {
+    ArenaChunk* chunk = arena.current;
+    old_size = align_size(old_size);
+    new_size = align_size(new_size);
+    
+    /* The newest allocation can simply take more of its chunk. */
+    if (array != NULL && (char*)array + old_size == chunk->data + chunk->used &&
+        chunk->used - old_size + new_size <= chunk->size) {
+        chunk->used += new_size - old_size;
+        return array;
+    }
+    
+    void* result = ast_alloc(new_size);
+    if (array != NULL) memcpy(result, array, old_size);
+    return result;
+}
+
+
 Expr* new_literal_number(double value) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_LITERAL;
     expr->as.literal.type = LITERAL_NUMBER;
     expr->as.literal.as.number.value = value;
@@ -10,7 +80,7 @@ Expr* new_literal_number(double value) {
 }
 
 Expr* new_literal_bool(bool value) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_LITERAL;
     expr->as.literal.type = LITERAL_BOOL;
     expr->as.literal.as.boolean.value = value;
@@ -18,14 +88,14 @@ Expr* new_literal_bool(bool value) {
 }
 
 Expr* new_literal_nil() {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_LITERAL;
     expr->as.literal.type = LITERAL_NIL;
     return expr;
 }
 
 Expr* new_unary(TokenType op, Expr* operand) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_UNARY;
     expr->as.unary.op = op;
     expr->as.unary.operand = operand;
@@ -33,7 +103,7 @@ Expr* new_unary(TokenType op, Expr* operand) {
 }
 
 Expr* new_binary(TokenType op, Expr* left, Expr* right) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_BINARY;
     expr->as.binary.op = op;
     expr->as.binary.left = left;
@@ -42,14 +112,14 @@ Expr* new_binary(TokenType op, Expr* left, Expr* right) {
 }
 
 Expr* new_variable(Token name) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_VARIABLE;
     expr->as.variable.name = name;
     return expr;
 }
 
 Expr* new_assign(Token name, Expr* value) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_ASSIGN;
     expr->as.assign.name = name;
     expr->as.assign.value = value;
@@ -57,7 +127,7 @@ Expr* new_assign(Token name, Expr* value) {
 }
 
 Expr* new_call(Expr* callee, Expr** arguments, size_t arg_count) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_CALL;
     expr->as.call.callee = callee;
     expr->as.call.arguments = arguments;
@@ -66,7 +136,7 @@ Expr* new_call(Expr* callee, Expr** arguments, size_t arg_count) {
 }
 
 Expr* new_logical(TokenType op, Expr* left, Expr* right) {
-    Expr* expr = malloc(sizeof(Expr));
+    Expr* expr = ast_alloc(sizeof(Expr));
     expr->type = EXPR_LOGICAL;
     expr->as.logical.op = op;
     expr->as.logical.left = left;
@@ -75,14 +145,14 @@ Expr* new_logical(TokenType op, Expr* left, Expr* right) {
 }
 
 Stmt* new_expr_stmt(Expr* expression) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_EXPR;
     stmt->as.expr_stmt.expression = expression;
     return stmt;
 }
 
 Stmt* new_let_stmt(Token name, Expr* initializer) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_LET;
     stmt->as.let_stmt.name = name;
     stmt->as.let_stmt.initializer = initializer;
@@ -90,7 +160,7 @@ Stmt* new_let_stmt(Token name, Expr* initializer) {
 }
 
 Stmt* new_block_stmt(Stmt** statements, size_t count) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_BLOCK;
     stmt->as.block.statements = statements;
     stmt->as.block.count = count;
@@ -98,7 +168,7 @@ Stmt* new_block_stmt(Stmt** statements, size_t count) {
 }
 
 Stmt* new_if_stmt(Expr* condition, Stmt* then_branch, Stmt* else_branch) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_IF;
     stmt->as.if_stmt.condition = condition;
     stmt->as.if_stmt.then_branch = then_branch;
@@ -107,7 +177,7 @@ Stmt* new_if_stmt(Expr* condition, Stmt* then_branch, Stmt* else_branch) {
 }
 
 Stmt* new_while_stmt(Expr* condition, Stmt* body) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_WHILE;
     stmt->as.while_stmt.condition = condition;
     stmt->as.while_stmt.body = body;
@@ -115,108 +185,50 @@ Stmt* new_while_stmt(Expr* condition, Stmt* body) {
 }
 
 Stmt* new_function_stmt(Token name, Token* params, size_t param_count, Stmt** body, size_t body_count) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_FUNCTION;
     stmt->as.function.name = name;
     stmt->as.function.params = params;
     stmt->as.function.param_count = param_count;
     stmt->as.function.body = body;
     stmt->as.function.body_count = body_count;
+    stmt->as.function.text = NULL;
+    stmt->as.function.text_length = 0;
     return stmt;
 }
 
 Stmt* new_return_stmt(Expr* value) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_RETURN;
     stmt->as.return_stmt.value = value;
     return stmt;
 }
 
 Stmt* new_print_stmt(Expr* expression) {
-    Stmt* stmt = malloc(sizeof(Stmt));
+    Stmt* stmt = ast_alloc(sizeof(Stmt));
     stmt->type = STMT_PRINT;
     stmt->as.print_stmt.expression = expression;
     return stmt;
 }
 
-void free_expr(Expr* expr) {
-    if (!expr) return;
-    
-    switch (expr->type) {
-        case EXPR_LITERAL:
-            break;
-        case EXPR_UNARY:
-            free_expr(expr->as.unary.operand);
-            break;
-        case EXPR_BINARY:
-            free_expr(expr->as.binary.left);
-            free_expr(expr->as.binary.right);
-            break;
-        case EXPR_VARIABLE:
-            break;
-        case EXPR_ASSIGN:
-            free_expr(expr->as.assign.value);
-            break;
-        case EXPR_CALL:
-            free_expr(expr->as.call.callee);
-            for (size_t i = 0; i < expr->as.call.arg_count; i++) {
-                free_expr(expr->as.call.arguments[i]);
-            }
-            free(expr->as.call.arguments);
-            break;
-        case EXPR_LOGICAL:
-            free_expr(expr->as.logical.left);
-            free_expr(expr->as.logical.right);
-            break;
-    }
-    free(expr);
-}
-
-void free_stmt(Stmt* stmt) {
-    if (!stmt) return;
+void free_program(Program* program) {
+    (void)program;
+    if (arena.first == NULL) return;
     
-    switch (stmt->type) {
-        case STMT_EXPR:
-            free_expr(stmt->as.expr_stmt.expression);
-            break;
-        case STMT_LET:
-            free_expr(stmt->as.let_stmt.initializer);
-            break;
-        case STMT_BLOCK:
-            for (size_t i = 0; i < stmt->as.block.count; i++) {
-                free_stmt(stmt->as.block.statements[i]);
-            }
-            free(stmt->as.block.statements);
-            break;
-        case STMT_IF:
-            free_expr(stmt->as.if_stmt.condition);
-            free_stmt(stmt->as.if_stmt.then_branch);
-            free_stmt(stmt->as.if_stmt.else_branch);
-            break;
-        case STMT_WHILE:
-            free_expr(stmt->as.while_stmt.condition);
-            free_stmt(stmt->as.while_stmt.body);
-            break;
-        case STMT_FUNCTION:
-            free(stmt->as.function.params);
-            for (size_t i = 0; i < stmt->as.function.body_count; i++) {
-                free_stmt(stmt->as.function.body[i]);
-            }
-            free(stmt->as.function.body);
-            break;
-        case STMT_RETURN:
-            free_expr(stmt->as.return_stmt.value);
-            break;
-        case STMT_PRINT:
-            free_expr(stmt->as.print_stmt.expression);
-            break;
+    /* Chunks past the first came from one large program; keep only one around. */
+    ArenaChunk* chunk = arena.first->next;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-    free(stmt);
+    arena.first->next = NULL;
+    arena.first->used = 0;
+    arena.current = arena.first;
 }
 
-void free_program(Program* program) {
-    for (size_t i = 0; i < program->count; i++) {
-        free_stmt(program->statements[i]);
-    }
-    free(program->statements);
+void free_ast() {
+    free(arena.first);
+    arena.first = NULL;
+    arena.current = NULL;
 }
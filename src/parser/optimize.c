@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <math.h>
+#include "../../include/algo_ast.h"
+
+/*
+ * Constant folding and simplification over the parsed program, run
+ * before compilation. Every rewrite keeps the program's behavior,
+ * including its runtime errors: an identity such as `x * 1` is only
+ * dropped when `x` is known to be a number, since `x * 1` on a bool
+ * must still fail with "Operands must be numbers".
+ */
+
+static Expr* optimize_expr(Expr* expr);
+static Stmt* optimize_stmt(Stmt* stmt);
+
+static bool is_literal(Expr* expr, LiteralType type) {
+    return expr->type == EXPR_LITERAL && expr->as.literal.type == type;
+}
+
+static bool is_number_literal(Expr* expr, double value) {
+    return is_literal(expr, LITERAL_NUMBER) && expr->as.literal.as.number.value == value;
+}
+
+/* Matches the VM's is_falsey(): only nil and false are falsey. */
+static bool literal_falsey(LiteralExpr* literal) {
+    return literal->type == LITERAL_NIL ||
+           (literal->type == LITERAL_BOOL && !literal->as.boolean.value);
+}
+
+/* Matches values_equal(): values of different types are never equal. */
+static bool literals_equal(LiteralExpr* a, LiteralExpr* b) {
+    if (a->type != b->type) return false;
+    
+    switch (a->type) {
+        case LITERAL_NUMBER: return a->as.number.value == b->as.number.value;
+        case LITERAL_BOOL:   return a->as.boolean.value == b->as.boolean.value;
+        case LITERAL_NIL:    return true;
+    }
+    return false;
+}
+
+/* True when the expression either yields a number or raises a runtime error. */
+static bool yields_number(Expr* expr) {
+    switch (expr->type) {
+        case EXPR_LITERAL:
+            return expr->as.literal.type == LITERAL_NUMBER;
+        case EXPR_UNARY:
+            return expr->as.unary.op == TOKEN_MINUS;
+        case EXPR_BINARY:
+            switch (expr->as.binary.op) {
+                case TOKEN_PLUS:
+                case TOKEN_MINUS:
+                case TOKEN_STAR:
+                case TOKEN_SLASH:
+                case TOKEN_PERCENT:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+/* True when the expression either yields a bool or raises a runtime error. */
+static bool yields_bool(Expr* expr) {
+    switch (expr->type) {
+        case EXPR_LITERAL:
+            return expr->as.literal.type == LITERAL_BOOL;
+        case EXPR_UNARY:
+            return expr->as.unary.op == TOKEN_BANG;
+        case EXPR_BINARY:
+            switch (expr->as.binary.op) {
+                case TOKEN_EQ_EQ:
+                case TOKEN_BANG_EQ:
+                case TOKEN_GT:
+                case TOKEN_GT_EQ:
+                case TOKEN_LT:
+                case TOKEN_LT_EQ:
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+/*
+ * Folded nodes are rewritten into literals in place. Whatever a rewrite
+ * drops stays in the AST arena until free_program().
+ */
+static Expr* make_number(Expr* expr, double value) {
+    expr->type = EXPR_LITERAL;
+    expr->as.literal.type = LITERAL_NUMBER;
+    expr->as.literal.as.number.value = value;
+    return expr;
+}
+
+static Expr* make_bool(Expr* expr, bool value) {
+    expr->type = EXPR_LITERAL;
+    expr->as.literal.type = LITERAL_BOOL;
+    expr->as.literal.as.boolean.value = value;
+    return expr;
+}
+
+static Expr* optimize_unary(Expr* expr) {
+    UnaryExpr* unary = &expr->as.unary;
+    unary->operand = optimize_expr(unary->operand);
+    Expr* operand = unary->operand;
+    
+    if (unary->op == TOKEN_MINUS) {
+        if (is_literal(operand, LITERAL_NUMBER)) {
+            return make_number(expr, -operand->as.literal.as.number.value);
+        }
+        /* -(-x) is x once x is known to be a number. */
+        if (operand->type == EXPR_UNARY && operand->as.unary.op == TOKEN_MINUS &&
+            yields_number(operand->as.unary.operand)) {
+            return operand->as.unary.operand;
+        }
+    } else if (unary->op == TOKEN_BANG) {
+        if (operand->type == EXPR_LITERAL) {
+            return make_bool(expr, literal_falsey(&operand->as.literal));
+        }
+        /* !!x is x once x is known to be a bool. */
+        if (operand->type == EXPR_UNARY && operand->as.unary.op == TOKEN_BANG &&
+            yields_bool(operand->as.unary.operand)) {
+            return operand->as.unary.operand;
+        }
+    }
+    
+    return expr;
+}
+
+static Expr* fold_numbers(Expr* expr, double a, double b) {
+    switch (expr->as.binary.op) {
+        case TOKEN_PLUS:    return make_number(expr, a + b);
+        case TOKEN_MINUS:   return make_number(expr, a - b);
+        case TOKEN_STAR:    return make_number(expr, a * b);
+        case TOKEN_SLASH:   return make_number(expr, a / b);
+        case TOKEN_PERCENT: return make_number(expr, fmod(a, b));
+        case TOKEN_GT:      return make_bool(expr, a > b);
+        case TOKEN_LT:      return make_bool(expr, a < b);
+        /* Compiled as !(a < b) and !(a > b); keep that result for NaN. */
+        case TOKEN_GT_EQ:   return make_bool(expr, !(a < b));
+        case TOKEN_LT_EQ:   return make_bool(expr, !(a > b));
+        default:            return expr;
+    }
+}
+
+static Expr* optimize_binary(Expr* expr) {
+    BinaryExpr* binary = &expr->as.binary;
+    binary->left = optimize_expr(binary->left);
+    binary->right = optimize_expr(binary->right);
+    Expr* left = binary->left;
+    Expr* right = binary->right;
+    
+    if (left->type == EXPR_LITERAL && right->type == EXPR_LITERAL) {
+        if (binary->op == TOKEN_EQ_EQ) {
+            return make_bool(expr, literals_equal(&left->as.literal, &right->as.literal));
+        }
+        if (binary->op == TOKEN_BANG_EQ) {
+            return make_bool(expr, !literals_equal(&left->as.literal, &right->as.literal));
+        }
+        if (left->as.literal.type == LITERAL_NUMBER && right->as.literal.type == LITERAL_NUMBER) {
+            return fold_numbers(expr, left->as.literal.as.number.value,
+                                right->as.literal.as.number.value);
+        }
+        return expr;
+    }
+    
+    /* x + 0 is left alone: it turns -0 into 0. */
+    switch (binary->op) {
+        case TOKEN_STAR:
+            if (is_number_literal(right, 1) && yields_number(left)) {
+                return binary->left;
+            }
+            if (is_number_literal(left, 1) && yields_number(right)) {
+                return binary->right;
+            }
+            break;
+        case TOKEN_SLASH:
+            if (is_number_literal(right, 1) && yields_number(left)) {
+                return binary->left;
+            }
+            break;
+        case TOKEN_MINUS:
+            if (is_number_literal(right, 0) && yields_number(left)) {
+                return binary->left;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    return expr;
+}
+
+/* `and`/`or` yield one of their operands, so a literal left side decides which. */
+static Expr* optimize_logical(Expr* expr) {
+    LogicalExpr* logical = &expr->as.logical;
+    logical->left = optimize_expr(logical->left);
+    logical->right = optimize_expr(logical->right);
+    
+    if (logical->left->type != EXPR_LITERAL) return expr;
+    
+    bool falsey = literal_falsey(&logical->left->as.literal);
+    bool short_circuits = logical->op == TOKEN_OR ? !falsey : falsey;
+    return short_circuits ? logical->left : logical->right;
+}
+
+static Expr* optimize_expr(Expr* expr) {
+    switch (expr->type) {
+        case EXPR_LITERAL:
+        case EXPR_VARIABLE:
+            return expr;
+        case EXPR_UNARY:
+            return optimize_unary(expr);
+        case EXPR_BINARY:
+            return optimize_binary(expr);
+        case EXPR_LOGICAL:
+            return optimize_logical(expr);
+        case EXPR_ASSIGN:
+            expr->as.assign.value = optimize_expr(expr->as.assign.value);
+            return expr;
+        case EXPR_CALL:
+            expr->as.call.callee = optimize_expr(expr->as.call.callee);
+            for (size_t i = 0; i < expr->as.call.arg_count; i++) {
+                expr->as.call.arguments[i] = optimize_expr(expr->as.call.arguments[i]);
+            }
+            return expr;
+    }
+    return expr;
+}
+
+/*
+ * Optimizes a statement list in place: removed statements are dropped
+ * and anything after a return is unreachable.
+ */
+static void optimize_statements(Stmt** statements, size_t* count) {
+    size_t kept = 0;
+    size_t i = 0;
+    
+    while (i < *count) {
+        Stmt* stmt = optimize_stmt(statements[i++]);
+        if (stmt == NULL) continue;
+        
+        statements[kept++] = stmt;
+        if (stmt->type == STMT_RETURN) break;
+    }
+    
+    *count = kept;
+}
+
+static Stmt* optimize_if(Stmt* stmt) {
+    IfStmt* if_stmt = &stmt->as.if_stmt;
+    if_stmt->condition = optimize_expr(if_stmt->condition);
+    if_stmt->then_branch = optimize_stmt(if_stmt->then_branch);
+    if (if_stmt->else_branch != NULL) {
+        if_stmt->else_branch = optimize_stmt(if_stmt->else_branch);
+    }
+    
+    Expr* condition = if_stmt->condition;
+    if (condition->type == EXPR_LITERAL) {
+        bool falsey = literal_falsey(&condition->as.literal);
+        return falsey ? if_stmt->else_branch : if_stmt->then_branch;
+    }
+    
+    /* A branch that optimized away still needs a statement to compile. */
+    if (if_stmt->then_branch == NULL) {
+        if_stmt->then_branch = new_block_stmt(NULL, 0);
+    }
+    return stmt;
+}
+
+static Stmt* optimize_while(Stmt* stmt) {
+    WhileStmt* while_stmt = &stmt->as.while_stmt;
+    while_stmt->condition = optimize_expr(while_stmt->condition);
+    
+    Expr* condition = while_stmt->condition;
+    if (condition->type == EXPR_LITERAL && literal_falsey(&condition->as.literal)) {
+        return NULL;
+    }
+    
+    while_stmt->body = optimize_stmt(while_stmt->body);
+    if (while_stmt->body == NULL) {
+        while_stmt->body = new_block_stmt(NULL, 0);
+    }
+    return stmt;
+}
+
+static Stmt* optimize_stmt(Stmt* stmt) {
+    switch (stmt->type) {
+        case STMT_EXPR:
+            stmt->as.expr_stmt.expression = optimize_expr(stmt->as.expr_stmt.expression);
+            return stmt;
+        case STMT_LET:
+            if (stmt->as.let_stmt.initializer != NULL) {
+                stmt->as.let_stmt.initializer = optimize_expr(stmt->as.let_stmt.initializer);
+            }
+            return stmt;
+        case STMT_BLOCK:
+            optimize_statements(stmt->as.block.statements, &stmt->as.block.count);
+            return stmt;
+        case STMT_IF:
+            return optimize_if(stmt);
+        case STMT_WHILE:
+            return optimize_while(stmt);
+        case STMT_FUNCTION:
+            optimize_statements(stmt->as.function.body, &stmt->as.function.body_count);
+            return stmt;
+        case STMT_RETURN:
+            if (stmt->as.return_stmt.value != NULL) {
+                stmt->as.return_stmt.value = optimize_expr(stmt->as.return_stmt.value);
+            }
+            return stmt;
+        case STMT_PRINT:
+            stmt->as.print_stmt.expression = optimize_expr(stmt->as.print_stmt.expression);
+            return stmt;
+    }
+    return stmt;
+}
+
+void optimize_program(Program* program) {
+    optimize_statements(program->statements, &program->count);
+}
@@ -12,7 +12,7 @@ static void error_at(Parser* parser, Token* token, const char* message) {
     if (token->type == TOKEN_EOF) {
         fprintf(stderr, " at end");
     } else if (token->type == TOKEN_ERROR) {
-        
+    
     } else {
         fprintf(stderr, " at '%.*s'", (int)token->length, token->start);
     }
@@ -59,27 +59,45 @@ static void consume(Parser* parser, TokenType type, const char* message) {
     error_at_current(parser, message);
 }
 
+/*
+ * Nodes take the position of the token that decides what they are: the
+ * literal or name itself, the operator of a unary or binary expression,
+ * the `(` of a call, the keyword of a statement, so a runtime error
+ * points at the operation that failed.
+ */
+static Expr* expr_at(Expr* expr, const Token* token) {
+    expr->line = token->line;
+    expr->column = token->column;
+    return expr;
+}
+
+static Stmt* stmt_at(Stmt* stmt, const Token* token) {
+    stmt->line = token->line;
+    stmt->column = token->column;
+    return stmt;
+}
+
 static Expr* expression(Parser* parser);
 static Stmt* declaration(Parser* parser);
 static Stmt* statement(Parser* parser);
 
 static Expr* primary(Parser* parser) {
     if (match(parser, TOKEN_TRUE)) {
-        return new_literal_bool(true);
+        return expr_at(new_literal_bool(true), &parser->previous);
     }
     
     if (match(parser, TOKEN_FALSE)) {
-        return new_literal_bool(false);
+        return expr_at(new_literal_bool(false), &parser->previous);
     }
     
     if (match(parser, TOKEN_NUMBER)) {
         char* end;
         double value = strtod(parser->previous.start, &end);
-        return new_literal_number(value);
+        return expr_at(new_literal_number(value), &parser->previous);
     }
     
     if (match(parser, TOKEN_IDENTIFIER)) {
-        return new_variable(parser->previous);
+        return expr_at(new_variable(parser->previous), &parser->previous);
     }
     
     if (match(parser, TOKEN_LPAREN)) {
@@ -89,10 +107,11 @@ static Expr* primary(Parser* parser) {
     }
     
     error(parser, "Expected expression");
-    return new_literal_nil();
+    return expr_at(new_literal_nil(), &parser->previous);
 }
 
 static Expr* finish_call(Parser* parser, Expr* callee) {
+    Token paren = parser->previous;
     Expr** arguments = NULL;
     size_t arg_count = 0;
     size_t arg_capacity = 0;
@@ -102,14 +121,14 @@ static Expr* finish_call(Parser* parser, Expr* callee) {
             if (arg_count >= arg_capacity) {
                 size_t old_capacity = arg_capacity;
                 arg_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-                arguments = realloc(arguments, arg_capacity * sizeof(Expr*));
+                arguments = ast_grow(arguments, old_capacity * sizeof(Expr*), arg_capacity * sizeof(Expr*));
             }
             arguments[arg_count++] = expression(parser);
         } while (match(parser, TOKEN_COMMA));
     }
     
     consume(parser, TOKEN_RPAREN, "Expected ')' after arguments");
-    return new_call(callee, arguments, arg_count);
+    return expr_at(new_call(callee, arguments, arg_count), &paren);
 }
 
 static Expr* call(Parser* parser) {
@@ -128,9 +147,9 @@ static Expr* call(Parser* parser) {
 
 static Expr* unary(Parser* parser) {
     if (match(parser, TOKEN_BANG) || match(parser, TOKEN_MINUS)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = unary(parser);
-        return new_unary(op, right);
+        return expr_at(new_unary(op.type, right), &op);
     }
     
     return call(parser);
@@ -140,9 +159,9 @@ static Expr* factor(Parser* parser) {
     Expr* expr = unary(parser);
     
     while (match(parser, TOKEN_STAR) || match(parser, TOKEN_SLASH) || match(parser, TOKEN_PERCENT)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = unary(parser);
-        expr = new_binary(op, expr, right);
+        expr = expr_at(new_binary(op.type, expr, right), &op);
     }
     
     return expr;
@@ -152,9 +171,9 @@ static Expr* term(Parser* parser) {
     Expr* expr = factor(parser);
     
     while (match(parser, TOKEN_PLUS) || match(parser, TOKEN_MINUS)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = factor(parser);
-        expr = new_binary(op, expr, right);
+        expr = expr_at(new_binary(op.type, expr, right), &op);
     }
     
     return expr;
@@ -165,9 +184,9 @@ static Expr* comparison(Parser* parser) {
     
     while (match(parser, TOKEN_GT) || match(parser, TOKEN_GT_EQ) ||
            match(parser, TOKEN_LT) || match(parser, TOKEN_LT_EQ)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = term(parser);
-        expr = new_binary(op, expr, right);
+        expr = expr_at(new_binary(op.type, expr, right), &op);
     }
     
     return expr;
@@ -177,9 +196,9 @@ static Expr* equality(Parser* parser) {
     Expr* expr = comparison(parser);
     
     while (match(parser, TOKEN_EQ_EQ) || match(parser, TOKEN_BANG_EQ)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = comparison(parser);
-        expr = new_binary(op, expr, right);
+        expr = expr_at(new_binary(op.type, expr, right), &op);
     }
     
     return expr;
@@ -189,9 +208,9 @@ static Expr* logical_and(Parser* parser) {
     Expr* expr = equality(parser);
     
     while (match(parser, TOKEN_AND)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = equality(parser);
-        expr = new_logical(op, expr, right);
+        expr = expr_at(new_logical(op.type, expr, right), &op);
     }
     
     return expr;
@@ -201,9 +220,9 @@ static Expr* logical_or(Parser* parser) {
     Expr* expr = logical_and(parser);
     
     while (match(parser, TOKEN_OR)) {
-        TokenType op = parser->previous.type;
+        Token op = parser->previous;
         Expr* right = logical_and(parser);
-        expr = new_logical(op, expr, right);
+        expr = expr_at(new_logical(op.type, expr, right), &op);
     }
     
     return expr;
@@ -217,8 +236,7 @@ static Expr* assignment(Parser* parser) {
         
         if (expr->type == EXPR_VARIABLE) {
             Token name = expr->as.variable.name;
-            free(expr);
-            return new_assign(name, value);
+            return expr_at(new_assign(name, value), &name);
         }
         
         error(parser, "Invalid assignment target");
@@ -232,6 +250,7 @@ static Expr* expression(Parser* parser) {
 }
 
 static Stmt* block_statement(Parser* parser) {
+    Token brace = parser->previous;
     Stmt** statements = NULL;
     size_t count = 0;
     size_t capacity = 0;
@@ -240,16 +259,17 @@ static Stmt* block_statement(Parser* parser) {
         if (count >= capacity) {
             size_t old_capacity = capacity;
             capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-            statements = realloc(statements, capacity * sizeof(Stmt*));
+            statements = ast_grow(statements, old_capacity * sizeof(Stmt*), capacity * sizeof(Stmt*));
         }
         statements[count++] = declaration(parser);
     }
     
     consume(parser, TOKEN_RBRACE, "Expected '}' after block");
-    return new_block_stmt(statements, count);
+    return stmt_at(new_block_stmt(statements, count), &brace);
 }
 
 static Stmt* if_statement(Parser* parser) {
+    Token keyword = parser->previous;
     Expr* condition = expression(parser);
     
     consume(parser, TOKEN_LBRACE, "Expected '{' after if condition");
@@ -265,36 +285,40 @@ static Stmt* if_statement(Parser* parser) {
         }
     }
     
-    return new_if_stmt(condition, then_branch, else_branch);
+    return stmt_at(new_if_stmt(condition, then_branch, else_branch), &keyword);
 }
 
 static Stmt* while_statement(Parser* parser) {
+    Token keyword = parser->previous;
     Expr* condition = expression(parser);
     
     consume(parser, TOKEN_LBRACE, "Expected '{' after while condition");
     Stmt* body = block_statement(parser);
     
-    return new_while_stmt(condition, body);
+    return stmt_at(new_while_stmt(condition, body), &keyword);
 }
 
 static Stmt* return_statement(Parser* parser) {
+    Token keyword = parser->previous;
     Expr* value = NULL;
     
     if (!check(parser, TOKEN_SEMICOLON) && !check(parser, TOKEN_RBRACE)) {
         value = expression(parser);
     }
     
-    return new_return_stmt(value);
+    return stmt_at(new_return_stmt(value), &keyword);
 }
 
 static Stmt* print_statement(Parser* parser) {
+    Token keyword = parser->previous;
     Expr* value = expression(parser);
-    return new_print_stmt(value);
+    return stmt_at(new_print_stmt(value), &keyword);
 }
 
 static Stmt* expression_statement(Parser* parser) {
+    Token start = parser->current;
     Expr* expr = expression(parser);
-    return new_expr_stmt(expr);
+    return stmt_at(new_expr_stmt(expr), &start);
 }
 
 static Stmt* statement(Parser* parser) {
@@ -322,6 +346,7 @@ static Stmt* statement(Parser* parser) {
 }
 
 static Stmt* let_declaration(Parser* parser) {
+    Token keyword = parser->previous;
     consume(parser, TOKEN_IDENTIFIER, "Expected variable name");
     Token name = parser->previous;
     
@@ -330,10 +355,11 @@ static Stmt* let_declaration(Parser* parser) {
         initializer = expression(parser);
     }
     
-    return new_let_stmt(name, initializer);
+    return stmt_at(new_let_stmt(name, initializer), &keyword);
 }
 
 static Stmt* function_declaration(Parser* parser) {
+    Token keyword = parser->previous;
     consume(parser, TOKEN_IDENTIFIER, "Expected function name");
     Token name = parser->previous;
     
@@ -348,7 +374,7 @@ static Stmt* function_declaration(Parser* parser) {
             if (param_count >= param_capacity) {
                 size_t old_capacity = param_capacity;
                 param_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-                params = realloc(params, param_capacity * sizeof(Token));
+                params = ast_grow(params, old_capacity * sizeof(Token), param_capacity * sizeof(Token));
             }
             
             consume(parser, TOKEN_IDENTIFIER, "Expected parameter name");
@@ -367,14 +393,17 @@ static Stmt* function_declaration(Parser* parser) {
         if (body_count >= body_capacity) {
             size_t old_capacity = body_capacity;
             body_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-            body = realloc(body, body_capacity * sizeof(Stmt*));
+            body = ast_grow(body, old_capacity * sizeof(Stmt*), body_capacity * sizeof(Stmt*));
         }
         body[body_count++] = declaration(parser);
     }
     
     consume(parser, TOKEN_RBRACE, "Expected '}' after function body");
     
-    return new_function_stmt(name, params, param_count, body, body_count);
+    Stmt* function = new_function_stmt(name, params, param_count, body, body_count);
+    function->as.function.text = keyword.start;
+    function->as.function.text_length = parser->previous.start + parser->previous.length - keyword.start;
+    return stmt_at(function, &keyword);
 }
 
 static Stmt* declaration(Parser* parser) {
@@ -390,14 +419,20 @@ static Stmt* declaration(Parser* parser) {
 }
 
 void parser_init(Parser* parser, const char* source) {
+    parser_init_at(parser, source, 1, 1);
+}
+
+void parser_init_at(Parser* parser, const char* source, int line, int column) {
     lexer_init(&parser->lexer, source);
+    parser->lexer.line = line;
+    parser->lexer.column = column;
     parser->had_error = false;
     parser->panic_mode = false;
     advance(parser);
 }
 
 Program* parse(Parser* parser) {
-    Program* program = malloc(sizeof(Program));
+    Program* program = ast_alloc(sizeof(Program));
     program->statements = NULL;
     program->count = 0;
     program->capacity = 0;
@@ -406,7 +441,8 @@ Program* parse(Parser* parser) {
         if (program->count >= program->capacity) {
             size_t old_capacity = program->capacity;
             program->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-            program->statements = realloc(program->statements, program->capacity * sizeof(Stmt*));
+            program->statements = ast_grow(program->statements, old_capacity * sizeof(Stmt*),
+                                           program->capacity * sizeof(Stmt*));
         }
         
         program->statements[program->count++] = declaration(parser);
@@ -0,0 +1,689 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../../include/algo_memory.h"
+#include "../../include/algo_vm.h"
+#include "../../include/algo_compiler.h"
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_register.h"
+#include "../../include/algo_jit.h"
+#include "../../include/algo_x64.h"
+
+static Obj* objects = NULL;
+
+/*
+ * A cycle marks a little at a time, clears dead strings from the intern
+ * table, then frees a little at a time. Until sweeping, allocation returns
+ * black objects and stores go through write_barrier(); sweeping walks
+ * `sweep_list`, the objects that existed when marking finished, while new
+ * ones go on `objects` untouched.
+ */
+typedef enum {
+    GC_IDLE,
+    GC_MARKING,
+    GC_CLEARING,
+    GC_SWEEPING
+} GcPhase;
+
+static GcPhase phase = GC_IDLE;
+bool gc_marking = false;
+static int global_cursor = 0;
+static Obj* sweep_list = NULL;
+static size_t swept_live = 0;
+static size_t swept_freed = 0;
+static size_t bytes_at_sweep = 0;
+
+/* Marked objects whose references have not been traced yet. */
+static Obj** gray_stack = NULL;
+static int gray_count = 0;
+static int gray_capacity = 0;
+
+/* Bytes in live objects, as of the last collection plus what was allocated since. */
+static size_t bytes_allocated = 0;
+static size_t next_gc = GC_HEAP_MIN;
+static double gc_growth = GC_GROWTH_DEFAULT;
+static long gc_budget_us = GC_BUDGET_DEFAULT;
+
+static bool gc_stats = false;
+static int collections = 0;
+static size_t cycle_before = 0;
+static int cycle_steps = 0;
+static double cycle_max_ms = 0;
+static double total_pause_ms = 0;
+static double max_pause_ms = 0;
+static size_t total_freed = 0;
+static size_t peak_heap = 0;
+static size_t objects_allocated = 0;
+
+/* Every step's pause, for the percentiles in the summary. */
+static double* pauses = NULL;
+static int pause_count = 0;
+static int pause_capacity = 0;
+
+/*
+ * The nursery. Strings and arrays are bump-allocated here, and a minor
+ * collection copies the ones still reachable into the old space when it
+ * fills up, so objects that die young never cost a malloc or a free.
+ * Functions and natives are allocated old: the compilers and the trace
+ * table hold their addresses. A young object's `next` is its forwarding
+ * address once copied, NULL before.
+ */
+static char* nursery = NULL;
+static char* young_top = NULL;
+static size_t nursery_size = GC_NURSERY_SIZE;
+
+/* Young objects in allocation order, to find dead ones' arrays and stale marks. */
+static Obj** young_objects = NULL;
+static int young_count = 0;
+static int young_capacity = 0;
+
+/* Old objects that may point into the nursery, from object_barrier(). */
+static Obj** remembered = NULL;
+static int remembered_count = 0;
+static int remembered_capacity = 0;
+
+/* Objects copied out of the nursery whose fields are still to be forwarded. */
+static Obj** scan_stack = NULL;
+static int scan_count = 0;
+static int scan_capacity = 0;
+
+static int minor_collections = 0;
+static size_t young_allocated = 0;
+static size_t total_promoted = 0;
+static double* minor_pauses = NULL;
+static int minor_pause_count = 0;
+static int minor_pause_capacity = 0;
+
+/* Bytes an object owns, including its arrays at their current capacity. */
+static size_t object_size(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            return sizeof(ObjFunction) +
+                   function->chunk.capacity + function->chunk.lines.capacity +
+                   function->chunk.constant_capacity * sizeof(Value) +
+                   (function->code != NULL && !function->mapped ? function->chunk.count : 0) +
+                   function->registers.capacity * sizeof(uint32_t) +
+                   function->registers.lines.capacity +
+                   (function->pending != NULL ? sizeof(PendingSource) + function->pending->length : 0);
+        }
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_ARRAY:
+            return sizeof(ObjArray) + ((ObjArray*)object)->capacity * sizeof(Value);
+    }
+    return 0;
+}
+
+static void gc_step();
+static void collect_young();
+
+/* Appends to one of the object stacks above, growing it like every other array. */
+static void push_object(Obj*** stack, int* count, int* capacity, Obj* object) {
+    if (*capacity < *count + 1) {
+        int old_capacity = *capacity;
+        *capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        *stack = realloc(*stack, *capacity * sizeof(Obj*));
+    }
+    (*stack)[(*count)++] = object;
+}
+
+static size_t align_size(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+/* Bytes of the object itself, without arrays it points to: what was allocated for it. */
+static size_t header_size(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+        case OBJ_FUNCTION:
+            return sizeof(ObjFunction);
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_ARRAY:
+            return sizeof(ObjArray);
+    }
+    return 0;
+}
+
+bool is_young(Obj* object) {
+    return (char*)object >= nursery && (char*)object < young_top;
+}
+
+static Obj* allocate_young(size_t size, ObjType type) {
+    if (nursery == NULL) {
+        nursery = malloc(nursery_size);
+        young_top = nursery;
+    }
+#ifdef ALGO_STRESS_GC
+    if (young_top != nursery) collect_young();
+#endif
+    if (young_top + align_size(size) > nursery + nursery_size) collect_young();
+    
+    Obj* object = (Obj*)young_top;
+    young_top += align_size(size);
+    young_allocated += size;
+    push_object(&young_objects, &young_count, &young_capacity, object);
+    
+    object->type = type;
+    object->marked = gc_marking;
+    object->remembered = false;
+    object->next = NULL;
+    return object;
+}
+
+Obj* allocate_object(size_t size, ObjType type) {
+    objects_allocated++;
+    if ((type == OBJ_STRING || type == OBJ_ARRAY) && size <= nursery_size / 8) {
+        return allocate_young(size, type);
+    }
+
+#ifdef ALGO_STRESS_GC
+    if (phase == GC_IDLE || gc_budget_us == 0) {
+        collect_garbage();
+    } else {
+        gc_step();
+    }
+#else
+    if (phase != GC_IDLE) {
+        gc_step();
+    } else if (bytes_allocated + size > next_gc) {
+        collect_garbage();
+    }
+#endif
+    bytes_allocated += size;
+    
+    Obj* object = pool_alloc(size);
+    object->type = type;
+    object->marked = gc_marking;
+    object->remembered = false;
+    object->next = objects;
+    objects = object;
+    return object;
+}
+
+void count_bytes(size_t bytes) {
+    bytes_allocated += bytes;
+}
+
+/* Frees the arrays an object owns but not the object, which may be in the nursery. */
+static void free_buffers(Obj* object) {
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+#ifdef ALGO_JIT
+            if (function->native != NULL) release_code(function->native);
+#endif
+            if (function->mapped) {
+                free(function->chunk.constants);
+                break;
+            }
+            free_chunk(&function->chunk);
+            free(function->code);
+            free(function->registers.code);
+            free_line_table(&function->registers.lines);
+            if (function->pending != NULL) {
+                free(function->pending->text);
+                free(function->pending);
+            }
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+            break;
+        case OBJ_ARRAY:
+            free(((ObjArray*)object)->elements);
+            break;
+    }
+}
+
+static void free_object(Obj* object) {
+    size_t size = header_size(object);
+    free_buffers(object);
+    pool_free(object, size);
+}
+
+void mark_object(Obj* object) {
+    if (object == NULL || object->marked) return;
+    object->marked = true;
+    
+    if (gray_capacity < gray_count + 1) {
+        int old_capacity = gray_capacity;
+        gray_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        gray_stack = realloc(gray_stack, gray_capacity * sizeof(Obj*));
+    }
+    gray_stack[gray_count++] = object;
+}
+
+void mark_value(Value value) {
+    if (IS_OBJ(value)) mark_object(AS_OBJ(value));
+}
+
+static void blacken_object(Obj* object) {
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            mark_object((Obj*)function->name);
+            for (size_t i = 0; i < function->chunk.constant_count; i++) {
+                mark_value(function->chunk.constants[i]);
+            }
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            for (size_t i = 0; i < array->count; i++) mark_value(array->elements[i]);
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+            break;
+    }
+}
+
+/*
+ * Copies a young object to the old space, once. It keeps its mark only
+ * while a major cycle is marking, where white, gray and black all mean
+ * the same in either space; otherwise old objects are white.
+ */
+static Obj* promote(Obj* object) {
+    if (object->next != NULL) return object->next;
+    
+    size_t size = header_size(object);
+    Obj* copy = pool_alloc(size);
+    memcpy(copy, object, size);
+    copy->marked = gc_marking && object->marked;
+    copy->next = objects;
+    objects = copy;
+    object->next = copy;
+    
+    bytes_allocated += object_size(copy);
+    total_promoted += size;
+    push_object(&scan_stack, &scan_count, &scan_capacity, copy);
+    return copy;
+}
+
+void forward_object(Obj** slot) {
+    if (*slot != NULL && is_young(*slot)) *slot = promote(*slot);
+}
+
+void forward_value(Value* slot) {
+    if (!IS_OBJ(*slot) || !is_young(AS_OBJ(*slot))) return;
+    *slot = OBJ_VAL(promote(AS_OBJ(*slot)));
+}
+
+static void forward_fields(Obj* object) {
+    switch (object->type) {
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            forward_object((Obj**)&function->name);
+            for (size_t i = 0; i < function->chunk.constant_count; i++) {
+                forward_value(&function->chunk.constants[i]);
+            }
+            break;
+        }
+        case OBJ_ARRAY: {
+            ObjArray* array = (ObjArray*)object;
+            for (size_t i = 0; i < array->count; i++) forward_value(&array->elements[i]);
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+            break;
+    }
+}
+
+void object_barrier(Obj* owner, Value value) {
+    write_barrier(value);
+    if (owner->remembered || is_young(owner) || !IS_OBJ(value) || !is_young(AS_OBJ(value))) return;
+    owner->remembered = true;
+    push_object(&remembered, &remembered_count, &remembered_capacity, owner);
+}
+
+/* Drops a dead object from the remembered set; the set is small and this is rare. */
+static void forget_object(Obj* object) {
+    for (int i = 0; i < remembered_count; i++) {
+        if (remembered[i] == object) {
+            remembered[i] = remembered[--remembered_count];
+            return;
+        }
+    }
+}
+
+static void record_minor_pause(double pause) {
+    if (minor_pause_capacity < minor_pause_count + 1) {
+        int old_capacity = minor_pause_capacity;
+        minor_pause_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        minor_pauses = realloc(minor_pauses, minor_pause_capacity * sizeof(double));
+    }
+    minor_pauses[minor_pause_count++] = pause;
+}
+
+static double now_ms();
+
+/*
+ * A minor collection: copies every young object reachable from the roots
+ * that can hold one (the value stack, globals, the gray stack and the
+ * remembered old objects) and from the copies themselves, then empties
+ * the nursery. Interned strings left behind are dropped from the table.
+ */
+static void collect_young() {
+    double start = now_ms();
+    
+    forward_vm_roots();
+    forward_globals();
+    for (int i = 0; i < gray_count; i++) forward_object(&gray_stack[i]);
+    for (int i = 0; i < remembered_count; i++) {
+        remembered[i]->remembered = false;
+        forward_fields(remembered[i]);
+    }
+    remembered_count = 0;
+    while (scan_count > 0) forward_fields(scan_stack[--scan_count]);
+    
+    for (int i = 0; i < young_count; i++) {
+        Obj* object = young_objects[i];
+        if (object->type == OBJ_STRING) {
+            intern_moved((ObjString*)object, (ObjString*)object->next);
+        }
+        if (object->next == NULL) free_buffers(object);
+    }
+    young_count = 0;
+    young_top = nursery;
+    
+    minor_collections++;
+    record_minor_pause(now_ms() - start);
+    
+    /* Promotion is the old space's allocation once most objects start young. */
+    if (phase != GC_IDLE) {
+        gc_step();
+    } else if (bytes_allocated > next_gc) {
+        collect_garbage();
+    }
+}
+
+/* The roots no barrier covers; they are scanned again when marking finishes. */
+static void mark_unbarriered_roots() {
+    mark_vm_roots();
+    mark_compiler_roots();
+    mark_register_compiler_roots();
+    mark_loader_roots();
+}
+
+static double now_ms() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void start_cycle() {
+    cycle_before = bytes_allocated;
+    cycle_steps = 0;
+    cycle_max_ms = 0;
+    if (cycle_before > peak_heap) peak_heap = cycle_before;
+    
+    /* Young objects keep marks from the last cycle until they are copied. */
+    for (int i = 0; i < young_count; i++) young_objects[i]->marked = false;
+    
+    phase = GC_MARKING;
+    gc_marking = true;
+    global_cursor = 0;
+    mark_unbarriered_roots();
+}
+
+/* Scans up to `limit` globals or gray objects; finishes marking when none are left. */
+static void mark_some(int limit) {
+    if (!mark_globals(&global_cursor, limit)) return;
+    for (int done = 0; done < limit && gray_count > 0; done++) {
+        blacken_object(gray_stack[--gray_count]);
+    }
+    if (gray_count > 0) return;
+    
+    mark_unbarriered_roots();
+    if (gray_count == 0) phase = GC_CLEARING;
+}
+
+static void clear_some(int limit) {
+    if (!clear_white_strings(limit)) return;
+    
+#ifdef ALGO_JIT
+    sweep_traces();
+#endif
+    gc_marking = false;
+    phase = GC_SWEEPING;
+    sweep_list = objects;
+    objects = NULL;
+    swept_live = 0;
+    swept_freed = 0;
+    bytes_at_sweep = bytes_allocated;
+}
+
+static void finish_cycle() {
+    phase = GC_IDLE;
+    
+    /* Recounting the survivors drops arrays the compiler freed and regrew. */
+    bytes_allocated = swept_live + (bytes_allocated - bytes_at_sweep);
+    next_gc = (size_t)(bytes_allocated * gc_growth);
+    if (next_gc < GC_HEAP_MIN) next_gc = GC_HEAP_MIN;
+    
+    collections++;
+    total_freed += swept_freed;
+}
+
+/* Frees up to `limit` unmarked objects, moving survivors back to the heap white. */
+static void sweep_some(int limit) {
+    for (int done = 0; done < limit && sweep_list != NULL; done++) {
+        Obj* object = sweep_list;
+        sweep_list = object->next;
+        if (object->marked) {
+            object->marked = false;
+            swept_live += object_size(object);
+            object->next = objects;
+            objects = object;
+        } else {
+            swept_freed += object_size(object);
+            if (object->remembered) forget_object(object);
+            free_object(object);
+        }
+    }
+    if (sweep_list == NULL) finish_cycle();
+}
+
+/* Advances the cycle by about `limit` objects or entries. */
+static void gc_work(int limit) {
+    switch (phase) {
+        case GC_MARKING:  mark_some(limit); break;
+        case GC_CLEARING: clear_some(limit); break;
+        case GC_SWEEPING: sweep_some(limit); break;
+        case GC_IDLE:     break;
+    }
+}
+
+/* Reports a cycle once the step that finished it has been timed. */
+static void report_cycle() {
+    if (!gc_stats) return;
+    fprintf(stderr, "[gc %d] heap %zu -> %zu bytes, freed %zu, %d steps, max pause %.3f ms, next at %zu\n",
+            collections, cycle_before, bytes_allocated, swept_freed, cycle_steps, cycle_max_ms, next_gc);
+}
+
+static void record_pause(double pause) {
+    if (pause_capacity < pause_count + 1) {
+        int old_capacity = pause_capacity;
+        pause_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        pauses = realloc(pauses, pause_capacity * sizeof(double));
+    }
+    pauses[pause_count++] = pause;
+    
+    cycle_steps++;
+    total_pause_ms += pause;
+    if (pause > cycle_max_ms) cycle_max_ms = pause;
+    if (pause > max_pause_ms) max_pause_ms = pause;
+}
+
+/*
+ * One increment of the current cycle: marks or sweeps in batches of
+ * GC_STEP_OBJECTS until the pause budget is spent or the cycle ends.
+ * Stress builds do a single batch per step so cycles stay interleaved
+ * with the program and the barriers are exercised.
+ */
+static void gc_step() {
+    double start = now_ms();
+    double budget_ms = gc_budget_us / 1000.0;
+    
+    do {
+        gc_work(GC_STEP_OBJECTS);
+#ifdef ALGO_STRESS_GC
+        break;
+#endif
+    } while (phase != GC_IDLE && now_ms() - start < budget_ms);
+    
+    record_pause(now_ms() - start);
+    if (phase == GC_IDLE) report_cycle();
+}
+
+/* Starts a cycle; with a zero budget, runs it to the end in one pause. */
+void collect_garbage() {
+    double start = now_ms();
+    if (phase == GC_IDLE) start_cycle();
+    if (gc_budget_us != 0) {
+        record_pause(now_ms() - start);
+        return;
+    }
+    
+    while (phase != GC_IDLE) gc_work(INT_MAX);
+    record_pause(now_ms() - start);
+    report_cycle();
+}
+
+/*
+ * `growth` of 0 and negative `budget_us` or `nursery_kb` keep the
+ * defaults; growth below 1 is raised to 1 and a nursery of 0 puts every
+ * object in the old space.
+ */
+void set_gc(double growth, long budget_us, long nursery_kb, bool stats) {
+    if (growth > 0) gc_growth = growth < 1 ? 1 : growth;
+    if (budget_us >= 0) gc_budget_us = budget_us;
+    if (nursery_kb >= 0) nursery_size = (size_t)nursery_kb * 1024;
+    gc_stats = stats;
+}
+
+static int compare_pauses(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* `samples` must be sorted. */
+static double percentile(double* samples, int count, double fraction) {
+    if (count == 0) return 0;
+    return samples[(int)(fraction * (count - 1) + 0.5)];
+}
+
+/* Adds a function's bytecode and line table bytes, in both backends, to the totals. */
+static void count_code(Obj* object, size_t* code, size_t* lines) {
+    if (object->type != OBJ_FUNCTION) return;
+    ObjFunction* function = (ObjFunction*)object;
+    *code += function->chunk.count + function->registers.count * sizeof(uint32_t);
+    *lines += function->chunk.lines.count + function->registers.lines.count;
+}
+
+/* The process's resident high-water mark, compiler and mappings included. */
+static long peak_rss_kib() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+}
+
+static void print_gc_stats() {
+    size_t heap = 0;
+    size_t code = 0;
+    size_t lines = 0;
+    for (Obj* object = objects; object != NULL; object = object->next) {
+        heap += object_size(object);
+        count_code(object, &code, &lines);
+    }
+    for (Obj* object = sweep_list; object != NULL; object = object->next) {
+        heap += object_size(object);
+        count_code(object, &code, &lines);
+    }
+    heap += young_top - nursery;
+    if (heap > peak_heap) peak_heap = heap;
+    qsort(pauses, pause_count, sizeof(double), compare_pauses);
+    qsort(minor_pauses, minor_pause_count, sizeof(double), compare_pauses);
+    
+    fprintf(stderr, "== gc stats ==\n");
+    fprintf(stderr, "%-16s %12d\n", "collections", collections);
+    fprintf(stderr, "%-16s %12d\n", "pauses", pause_count);
+    fprintf(stderr, "%-16s %12.3f ms\n", "total pause", total_pause_ms);
+    fprintf(stderr, "%-16s %12.3f ms\n", "p50 pause", percentile(pauses, pause_count, 0.50));
+    fprintf(stderr, "%-16s %12.3f ms\n", "p99 pause", percentile(pauses, pause_count, 0.99));
+    fprintf(stderr, "%-16s %12.3f ms\n", "max pause", max_pause_ms);
+    fprintf(stderr, "%-16s %12zu bytes\n", "freed", total_freed);
+    fprintf(stderr, "%-16s %12zu bytes\n", "heap at exit", heap);
+    fprintf(stderr, "%-16s %12zu bytes\n", "peak heap", peak_heap);
+    fprintf(stderr, "%-16s %12ld KiB\n", "peak rss", peak_rss_kib());
+    fprintf(stderr, "%-16s %12zu\n", "objects", objects_allocated);
+    fprintf(stderr, "%-16s %12zu bytes\n", "code", code);
+    fprintf(stderr, "%-16s %12zu bytes\n", "line tables", lines);
+    fprintf(stderr, "%-16s %12d\n", "minor gcs", minor_collections);
+    fprintf(stderr, "%-16s %12.3f ms\n", "minor p50", percentile(minor_pauses, minor_pause_count, 0.50));
+    fprintf(stderr, "%-16s %12.3f ms\n", "minor p99", percentile(minor_pauses, minor_pause_count, 0.99));
+    fprintf(stderr, "%-16s %12.3f ms\n", "minor max",
+            percentile(minor_pauses, minor_pause_count, 1.0));
+    fprintf(stderr, "%-16s %12zu bytes\n", "young allocated", young_allocated);
+    fprintf(stderr, "%-16s %12zu bytes\n", "promoted", total_promoted);
+    print_pool_stats();
+}
+
+void free_objects() {
+    if (gc_stats) print_gc_stats();
+    free_string_table();
+    
+    Obj* lists[] = {objects, sweep_list};
+    for (int i = 0; i < 2; i++) {
+        Obj* object = lists[i];
+        while (object != NULL) {
+            Obj* next = object->next;
+            free_object(object);
+            object = next;
+        }
+    }
+    for (int i = 0; i < young_count; i++) free_buffers(young_objects[i]);
+    objects = NULL;
+    sweep_list = NULL;
+    phase = GC_IDLE;
+    gc_marking = false;
+    
+    free(gray_stack);
+    gray_stack = NULL;
+    gray_count = 0;
+    gray_capacity = 0;
+    free(pauses);
+    pauses = NULL;
+    pause_count = 0;
+    pause_capacity = 0;
+    
+    free(nursery);
+    nursery = NULL;
+    young_top = NULL;
+    free(young_objects);
+    young_objects = NULL;
+    young_count = 0;
+    young_capacity = 0;
+    free(remembered);
+    remembered = NULL;
+    remembered_count = 0;
+    remembered_capacity = 0;
+    free(scan_stack);
+    scan_stack = NULL;
+    scan_capacity = 0;
+    free(minor_pauses);
+    minor_pauses = NULL;
+    minor_pause_count = 0;
+    minor_pause_capacity = 0;
+    free_pools();
+}
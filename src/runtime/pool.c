@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../include/algo_memory.h"
+
+/*
+ * Old-space objects up to POOL_MAX_SIZE bytes come from slabs of
+ * POOL_SLAB_SIZE, one size class per POOL_GRANULE bytes, so each class
+ * holds objects of one size and usually one type: every function header
+ * sits in one class, natives in another, strings by length. A slab is
+ * carved from the front as it is needed and never returned before exit;
+ * freed objects go on their class's free list and are reused first.
+ * Larger objects go to malloc.
+ */
+#define POOL_GRANULE 16
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_PAGE 4096
+
+/*
+ * A free list hands a freed object straight back out, which hides a use
+ * after free from AddressSanitizer; its builds keep every object on malloc.
+ */
+#ifdef __SANITIZE_ADDRESS__
+#define POOL_LIMIT 0
+#else
+#define POOL_LIMIT POOL_MAX_SIZE
+#endif
+
+/* Slabs are chained through their first granule. */
+typedef struct Slab {
+    struct Slab* next;
+} Slab;
+
+typedef struct FreeObject {
+    struct FreeObject* next;
+} FreeObject;
+
+typedef struct {
+    Slab* slabs;
+    char* top;
+    char* end;
+    FreeObject* free_list;
+    int slab_count;
+    size_t live;
+    size_t allocated;
+} SizeClass;
+
+static SizeClass classes[POOL_CLASSES];
+static size_t large_live = 0;
+
+static int class_index(size_t size) {
+    return size == 0 ? 0 : (int)((size - 1) / POOL_GRANULE);
+}
+
+static void new_slab(SizeClass* size_class) {
+    Slab* slab = aligned_alloc(POOL_PAGE, POOL_SLAB_SIZE);
+    if (slab == NULL) {
+        fprintf(stderr, "Out of memory for objects\n");
+        exit(74);
+    }
+    slab->next = size_class->slabs;
+    size_class->slabs = slab;
+    size_class->slab_count++;
+    size_class->top = (char*)slab + POOL_GRANULE;
+    size_class->end = (char*)slab + POOL_SLAB_SIZE;
+}
+
+void* pool_alloc(size_t size) {
+    if (size > POOL_LIMIT) {
+        large_live++;
+        return malloc(size);
+    }
+    
+    int index = class_index(size);
+    SizeClass* size_class = &classes[index];
+    size_t object_size = (size_t)(index + 1) * POOL_GRANULE;
+    size_class->live++;
+    size_class->allocated++;
+    
+    FreeObject* object = size_class->free_list;
+    if (object != NULL) {
+        size_class->free_list = object->next;
+        return object;
+    }
+    
+    if (size_class->top == NULL || size_class->top + object_size > size_class->end) {
+        new_slab(size_class);
+    }
+    void* result = size_class->top;
+    size_class->top += object_size;
+    return result;
+}
+
+void pool_free(void* pointer, size_t size) {
+    if (size > POOL_LIMIT) {
+        large_live--;
+        free(pointer);
+        return;
+    }
+    
+    SizeClass* size_class = &classes[class_index(size)];
+    FreeObject* object = pointer;
+    object->next = size_class->free_list;
+    size_class->free_list = object;
+    size_class->live--;
+}
+
+/* One line per class in use: slabs, live objects and how full its slabs are. */
+void print_pool_stats() {
+    fprintf(stderr, "%-16s %8s %8s %10s %10s %9s\n",
+            "pool", "slabs", "live", "free", "allocated", "occupied");
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        SizeClass* size_class = &classes[i];
+        if (size_class->slab_count == 0) continue;
+        
+        size_t object_size = (size_t)(i + 1) * POOL_GRANULE;
+        size_t capacity = size_class->slab_count * ((POOL_SLAB_SIZE - POOL_GRANULE) / object_size);
+        size_t free_count = capacity - size_class->live;
+        fprintf(stderr, "%4zu bytes       %8d %8zu %10zu %10zu %8.1f%%\n",
+                object_size, size_class->slab_count, size_class->live, free_count,
+                size_class->allocated, 100.0 * size_class->live / capacity);
+    }
+    fprintf(stderr, "%-16s %8s %8zu\n", "larger (malloc)", "-", large_live);
+}
+
+void free_pools() {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        Slab* slab = classes[i].slabs;
+        while (slab != NULL) {
+            Slab* next = slab->next;
+            free(slab);
+            slab = next;
+        }
+        classes[i] = (SizeClass){NULL, NULL, NULL, NULL, 0, 0, 0};
+    }
+    large_live = 0;
+}
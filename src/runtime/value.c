@@ -2,54 +2,151 @@
 #include <stdlib.h>
 #include <string.h>
 #include "../../include/algo_value.h"
+#include "../../include/algo_memory.h"
 
-static Obj* objects = NULL;
+/*
+ * The intern table. Strings the collector frees leave a tombstone so
+ * probe sequences stay intact; string_count includes tombstones until
+ * the table next grows.
+ */
+static ObjString** strings = NULL;
+static size_t string_capacity = 0;
+static size_t string_count = 0;
+static ObjString tombstone;
+#define TOMBSTONE (&tombstone)
+
+/* Next entry clear_white_strings() looks at; growing the table starts it over. */
+static size_t clear_cursor = 0;
 
 void init_chunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
-    chunk->lines = NULL;
+    init_line_table(&chunk->lines);
     chunk->constants = NULL;
     chunk->constant_count = 0;
     chunk->constant_capacity = 0;
 }
 
-void write_chunk(Chunk* chunk, uint8_t byte, int line) {
+void write_chunk(Chunk* chunk, uint8_t byte, int line, int column) {
     if (chunk->capacity < chunk->count + 1) {
         size_t old_capacity = chunk->capacity;
         chunk->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        count_bytes(chunk->capacity - old_capacity);
         chunk->code = realloc(chunk->code, chunk->capacity);
-        chunk->lines = realloc(chunk->lines, chunk->capacity * sizeof(int));
     }
+    add_position(&chunk->lines, chunk->count, line, column);
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
 }
 
-int add_constant(Chunk* chunk, Value value) {
+int add_constant(ObjFunction* function, Value value) {
+    Chunk* chunk = &function->chunk;
     if (chunk->constant_capacity < chunk->constant_count + 1) {
         size_t old_capacity = chunk->constant_capacity;
         chunk->constant_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        count_bytes((chunk->constant_capacity - old_capacity) * sizeof(Value));
         chunk->constants = realloc(chunk->constants, chunk->constant_capacity * sizeof(Value));
     }
     chunk->constants[chunk->constant_count] = value;
+    object_barrier((Obj*)function, value);
     return chunk->constant_count++;
 }
 
 void free_chunk(Chunk* chunk) {
     free(chunk->code);
-    free(chunk->lines);
+    free_line_table(&chunk->lines);
     free(chunk->constants);
     init_chunk(chunk);
 }
 
-static Obj* allocate_object(size_t size, ObjType type) {
-    Obj* object = malloc(size);
-    object->type = type;
-    object->next = objects;
-    objects = object;
-    return object;
+void init_line_table(LineTable* table) {
+    table->bytes = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->offset = 0;
+    table->line = 0;
+    table->column = 0;
+}
+
+static uint8_t* write_varint(uint8_t* out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static uint32_t read_varint(const LineTable* table, size_t* read) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = table->bytes[(*read)++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+/* Zigzag: small deltas of either sign take one byte. */
+static uint32_t zigzag(int delta) {
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta < 0 ? -1 : 0);
+}
+
+static int unzigzag(uint32_t value) {
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+/* The most a run can take: three varints of up to five bytes each. */
+#define MAX_RUN_BYTES 15
+
+void add_position(LineTable* table, size_t offset, int line, int column) {
+    if (line == table->line && column == table->column) return;
+    
+    if (table->capacity < table->count + MAX_RUN_BYTES) {
+        size_t old_capacity = table->capacity;
+        table->capacity = old_capacity < 16 ? 16 : old_capacity * 2;
+        count_bytes(table->capacity - old_capacity);
+        table->bytes = realloc(table->bytes, table->capacity);
+    }
+    
+    uint8_t* out = table->bytes + table->count;
+    out = write_varint(out, (uint32_t)(offset - table->offset));
+    if (line == table->line) {
+        out = write_varint(out, zigzag(column - table->column) << 1);
+    } else {
+        out = write_varint(out, zigzag(line - table->line) << 1 | 1);
+        out = write_varint(out, (uint32_t)column);
+    }
+    table->count = out - table->bytes;
+    table->offset = offset;
+    table->line = line;
+    table->column = column;
+}
+
+void find_position(const LineTable* table, size_t offset, LineCursor* cursor) {
+    while (cursor->read < table->count) {
+        size_t read = cursor->read;
+        size_t start = cursor->offset + read_varint(table, &read);
+        if (start > offset) break;
+        
+        uint32_t delta = read_varint(table, &read);
+        if (delta & 1) {
+            cursor->line += unzigzag(delta >> 1);
+            cursor->column = (int)read_varint(table, &read);
+        } else {
+            cursor->column += unzigzag(delta >> 1);
+        }
+        cursor->offset = start;
+        cursor->read = read;
+    }
+}
+
+void free_line_table(LineTable* table) {
+    free(table->bytes);
+    init_line_table(table);
 }
 
 static uint32_t hash_string(const char* key, size_t length) {
@@ -61,31 +158,86 @@ static uint32_t hash_string(const char* key, size_t length) {
     return hash;
 }
 
-ObjString* allocate_string(char* chars, size_t length, uint32_t hash) {
-    ObjString* string = (ObjString*)allocate_object(sizeof(ObjString), OBJ_STRING);
-    string->length = length;
-    string->chars = chars;
-    string->hash = hash;
-    return string;
+static ObjString* find_string(const char* chars, size_t length, uint32_t hash) {
+    if (string_count == 0) return NULL;
+    
+    size_t index = hash & (string_capacity - 1);
+    while (true) {
+        ObjString* string = strings[index];
+        if (string == NULL) return NULL;
+        if (string != TOMBSTONE && string->hash == hash && string->length == length &&
+            memcmp(string->chars, chars, length) == 0) {
+            /*
+             * Until clearing is done the table can hold strings marking
+             * found dead, and the caller may keep this one where no barrier
+             * sees it. Strings hold no references, so marking needs no gray.
+             */
+            if (gc_marking) string->obj.marked = true;
+            return string;
+        }
+        index = (index + 1) & (string_capacity - 1);
+    }
 }
 
-ObjString* copy_string(const char* chars, size_t length) {
-    uint32_t hash = hash_string(chars, length);
-    char* heap_chars = malloc(length + 1);
-    memcpy(heap_chars, chars, length);
-    heap_chars[length] = '\0';
-    return allocate_string(heap_chars, length, hash);
+static void intern_string(ObjString* string) {
+    if (string_count + 1 > string_capacity * 3 / 4) {
+        size_t capacity = string_capacity < 64 ? 64 : string_capacity * 2;
+        ObjString** entries = calloc(capacity, sizeof(ObjString*));
+        
+        string_count = 0;
+        for (size_t i = 0; i < string_capacity; i++) {
+            ObjString* old = strings[i];
+            if (old == NULL || old == TOMBSTONE) continue;
+            
+            size_t index = old->hash & (capacity - 1);
+            while (entries[index] != NULL) index = (index + 1) & (capacity - 1);
+            entries[index] = old;
+            string_count++;
+        }
+        
+        free(strings);
+        strings = entries;
+        string_capacity = capacity;
+        clear_cursor = 0;
+    }
+    
+    size_t index = string->hash & (string_capacity - 1);
+    while (strings[index] != NULL && strings[index] != TOMBSTONE) {
+        index = (index + 1) & (string_capacity - 1);
+    }
+    if (strings[index] == NULL) string_count++;
+    strings[index] = string;
 }
 
-ObjString* take_string(char* chars, size_t length) {
+ObjString* copy_string(const char* chars, size_t length) {
     uint32_t hash = hash_string(chars, length);
-    return allocate_string(chars, length, hash);
+    ObjString* interned = find_string(chars, length, hash);
+    if (interned != NULL) return interned;
+    
+    ObjString* string = (ObjString*)allocate_object(sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->hash = hash;
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    intern_string(string);
+    return string;
 }
 
 ObjFunction* new_function() {
     ObjFunction* function = (ObjFunction*)allocate_object(sizeof(ObjFunction), OBJ_FUNCTION);
     function->arity = 0;
+    function->max_slots = 0;
+    function->call_count = 0;
+    function->native = NULL;
+    function->code = NULL;
+    function->registers.code = NULL;
+    init_line_table(&function->registers.lines);
+    function->registers.count = 0;
+    function->registers.capacity = 0;
+    function->registers.frame_size = 0;
     function->name = NULL;
+    function->mapped = false;
+    function->pending = NULL;
     init_chunk(&function->chunk);
     return function;
 }
@@ -105,33 +257,37 @@ static void print_function(ObjFunction* function) {
 }
 
 void print_value(Value value) {
-    switch (value.type) {
-        case VAL_NIL:
-            printf("nil");
-            break;
-        case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
-            break;
-        case VAL_NUMBER:
-            printf("%g", AS_NUMBER(value));
-            break;
-        case VAL_OBJ:
-            switch (AS_OBJ(value)->type) {
-                case OBJ_STRING:
-                    printf("%s", AS_CSTRING(value));
-                    break;
-                case OBJ_FUNCTION:
-                    print_function(AS_FUNCTION(value));
-                    break;
-                case OBJ_NATIVE:
-                    printf("<native fn>");
-                    break;
-            }
-            break;
+    if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    } else {
+        switch (AS_OBJ(value)->type) {
+            case OBJ_STRING:
+                printf("%s", AS_CSTRING(value));
+                break;
+            case OBJ_FUNCTION:
+                print_function(AS_FUNCTION(value));
+                break;
+            case OBJ_NATIVE:
+                printf("<native fn>");
+                break;
+            case OBJ_ARRAY:
+                printf("<array>");
+                break;
+        }
     }
 }
 
 bool values_equal(Value a, Value b) {
+#ifdef ALGO_NAN_BOXING
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    return a == b;
+#else
     if (a.type != b.type) return false;
     
     switch (a.type) {
@@ -146,29 +302,44 @@ bool values_equal(Value a, Value b) {
         default:
             return false;
     }
+#endif
 }
 
-void free_objects() {
-    Obj* object = objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        switch (object->type) {
-            case OBJ_STRING: {
-                ObjString* string = (ObjString*)object;
-                free(string->chars);
-                free(object);
-                break;
-            }
-            case OBJ_FUNCTION: {
-                ObjFunction* function = (ObjFunction*)object;
-                free_chunk(&function->chunk);
-                free(object);
-                break;
-            }
-            case OBJ_NATIVE:
-                free(object);
-                break;
+/*
+ * Replaces strings the collector did not mark with tombstones, at most
+ * `limit` entries per call, resuming at clear_cursor. Returns true once
+ * the whole table has been cleared.
+ */
+bool clear_white_strings(int limit) {
+    for (int done = 0; done < limit && clear_cursor < string_capacity; done++, clear_cursor++) {
+        ObjString* string = strings[clear_cursor];
+        if (string != NULL && string != TOMBSTONE && !string->obj.marked) {
+            strings[clear_cursor] = TOMBSTONE;
         }
-        object = next;
     }
+    if (clear_cursor < string_capacity) return false;
+    
+    clear_cursor = 0;
+    return true;
+}
+
+void intern_moved(ObjString* string, ObjString* survivor) {
+    if (string_capacity == 0) return;
+    
+    size_t index = string->hash & (string_capacity - 1);
+    while (strings[index] != NULL) {
+        if (strings[index] == string) {
+            strings[index] = survivor != NULL ? survivor : TOMBSTONE;
+            return;
+        }
+        index = (index + 1) & (string_capacity - 1);
+    }
+}
+
+void free_string_table() {
+    free(strings);
+    strings = NULL;
+    string_capacity = 0;
+    string_count = 0;
+    clear_cursor = 0;
 }
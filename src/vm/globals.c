@@ -2,23 +2,30 @@
 #include <string.h>
 #include "../../include/algo_vm.h"
 #include "../../include/algo_value.h"
+#include "../../include/algo_memory.h"
 
+/*
+ * Globals live in a dense slot array indexed directly by the bytecode.
+ * The hash table below is only the name -> slot side table, consulted
+ * when the compiler resolves a name or a native is registered.
+ */
 typedef struct {
     ObjString* key;
-    Value value;
+    int slot;
     bool exists;
 } GlobalEntry;
 
+GlobalSlots global_slots = {NULL, NULL, 0, 0};
+
 static GlobalEntry* global_table = NULL;
 static int global_capacity = 0;
 static int global_count = 0;
+/* Slots before this one were named before the last minor collection, so by old strings. */
+static int forwarded_names = 0;
 
-static uint32_t hash_combine(uint32_t a, uint32_t b) {
-    return a ^ (b + 0x9e3779b9 + (a << 6) + (a >> 2));
-}
-
+/* Keys are interned by copy_string, so pointer equality is name equality. */
 static GlobalEntry* find_entry(GlobalEntry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
+    uint32_t index = key->hash & (capacity - 1);
     GlobalEntry* tombstone = NULL;
     
     while (true) {
@@ -34,7 +41,7 @@ static GlobalEntry* find_entry(GlobalEntry* entries, int capacity, ObjString* ke
             return entry;
         }
         
-        index = (index + 1) % capacity;
+        index = (index + 1) & (capacity - 1);
     }
 }
 
@@ -53,7 +60,7 @@ static void adjust_capacity(int capacity) {
         
         GlobalEntry* dest = find_entry(entries, capacity, entry->key);
         dest->key = entry->key;
-        dest->value = entry->value;
+        dest->slot = entry->slot;
         dest->exists = true;
         global_count++;
     }
@@ -63,30 +70,54 @@ static void adjust_capacity(int capacity) {
     global_capacity = capacity;
 }
 
-bool global_get(ObjString* key, Value* value) {
-    if (global_count == 0) return false;
-    
-    GlobalEntry* entry = find_entry(global_table, global_capacity, key);
-    if (!entry->exists) return false;
+static int add_slot(ObjString* name) {
+    if (global_slots.capacity < global_slots.count + 1) {
+        int old_capacity = global_slots.capacity;
+        global_slots.capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        global_slots.values = realloc(global_slots.values, global_slots.capacity * sizeof(Value));
+        global_slots.names = realloc(global_slots.names, global_slots.capacity * sizeof(ObjString*));
+    }
     
-    *value = entry->value;
-    return true;
+    global_slots.values[global_slots.count] = UNDEFINED_VAL;
+    global_slots.names[global_slots.count] = name;
+    write_barrier(OBJ_VAL(name));
+    return global_slots.count++;
 }
 
-void global_set(ObjString* key, Value value) {
+int global_slot(ObjString* name) {
     if (global_count + 1 > global_capacity * 0.75) {
         int capacity = global_capacity < 8 ? 8 : global_capacity * 2;
         adjust_capacity(capacity);
     }
     
-    GlobalEntry* entry = find_entry(global_table, global_capacity, key);
-    bool is_new = !entry->exists;
+    GlobalEntry* entry = find_entry(global_table, global_capacity, name);
+    if (entry->exists) return entry->slot;
     
-    if (is_new && entry->key == NULL) global_count++;
+    if (entry->key == NULL) global_count++;
     
-    entry->key = key;
-    entry->value = value;
+    entry->key = name;
+    entry->slot = add_slot(name);
     entry->exists = true;
+    return entry->slot;
+}
+
+bool global_get(ObjString* key, Value* value) {
+    if (global_count == 0) return false;
+    
+    GlobalEntry* entry = find_entry(global_table, global_capacity, key);
+    if (!entry->exists) return false;
+    
+    Value slot_value = global_slots.values[entry->slot];
+    if (IS_UNDEFINED(slot_value)) return false;
+    
+    *value = slot_value;
+    return true;
+}
+
+void global_set(ObjString* key, Value value) {
+    int slot = global_slot(key);
+    global_slots.values[slot] = value;
+    write_barrier(value);
 }
 
 bool global_delete(ObjString* key) {
@@ -95,13 +126,52 @@ bool global_delete(ObjString* key) {
     GlobalEntry* entry = find_entry(global_table, global_capacity, key);
     if (!entry->exists) return false;
     
-    entry->exists = false;
+    global_slots.values[entry->slot] = UNDEFINED_VAL;
     return true;
 }
 
+/*
+ * Table keys are the slot names, so marking the slots covers the table too.
+ * Marks up to `limit` slots from `*cursor` on and returns true once past the last.
+ */
+bool mark_globals(int* cursor, int limit) {
+    for (int done = 0; done < limit && *cursor < global_slots.count; done++, (*cursor)++) {
+        mark_value(global_slots.values[*cursor]);
+        mark_object((Obj*)global_slots.names[*cursor]);
+    }
+    return *cursor >= global_slots.count;
+}
+
+/*
+ * Names never change once a slot exists, so only those added since the last
+ * minor collection can be young. Table keys are the slot names and follow
+ * them when they move.
+ */
+void forward_globals() {
+    for (int i = 0; i < global_slots.count; i++) {
+        forward_value(&global_slots.values[i]);
+    }
+    for (int i = forwarded_names; i < global_slots.count; i++) {
+        ObjString* name = global_slots.names[i];
+        forward_object((Obj**)&global_slots.names[i]);
+        if (global_slots.names[i] != name) {
+            find_entry(global_table, global_capacity, name)->key = global_slots.names[i];
+        }
+    }
+    forwarded_names = global_slots.count;
+}
+
 void free_globals() {
     free(global_table);
     global_table = NULL;
     global_capacity = 0;
     global_count = 0;
+    forwarded_names = 0;
+    
+    free(global_slots.values);
+    free(global_slots.names);
+    global_slots.values = NULL;
+    global_slots.names = NULL;
+    global_slots.count = 0;
+    global_slots.capacity = 0;
 }
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../../include/algo_jit.h"
+
+#ifdef ALGO_JIT
+
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_x64.h"
+
+/*
+ * Baseline JIT: each bytecode instruction is expanded into a fixed
+ * x86-64 template that works on the interpreter's own value stack and
+ * CallFrame, so a native frame looks exactly like an interpreted one.
+ * Whenever a template meets something it does not handle (an operand
+ * of the wrong type, an undefined global, an opcode with no template)
+ * it stores the frame's ip and stack top and returns JIT_BAILED; the
+ * interpreter then re-executes that instruction and carries on, which
+ * also keeps every runtime error message and trace unchanged.
+ */
+
+/* Jumps to `target` when the top of the stack is nil or false, like is_falsey(). */
+static void emit_jump_if_falsey(Assembler* as, size_t target) {
+    emit_op_mem(as, 0, false, 0x8b, RAX, REG_TOP, TOP(0) + TYPE_OFFSET);
+    emit_op_reg(as, 0, false, 0x83, 7, RAX);
+    emit8(as, VAL_NIL);
+    emit_jcc(as, CC_E, TO_INSTRUCTION, target);
+    emit_op_reg(as, 0, false, 0x83, 7, RAX);
+    emit8(as, VAL_BOOL);
+    size_t not_bool = emit_jcc8(as, CC_NE);
+    emit_op_mem(as, 0, false, 0x80, 7, REG_TOP, TOP(0) + AS_OFFSET);
+    emit8(as, 0);
+    emit_jcc(as, CC_E, TO_INSTRUCTION, target);
+    patch_jcc8(as, not_bool);
+}
+
+/*
+ * A backedge counts down its loop's trace countdown and hands the frame
+ * to the interpreter, at the OP_LOOP itself, once the loop is due to be
+ * recorded or already has a trace; the interpreter's backedge then
+ * records or enters the trace.
+ */
+static void emit_backedge(Assembler* as, ObjFunction* function, size_t offset, size_t target) {
+    LoopTrace* loop = find_loop(function, &function->code[target]);
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)loop);
+    emit_op_mem(as, 0, true, 0x83, 7, RAX, (int32_t)offsetof(LoopTrace, trace));
+    emit8(as, 0);
+    emit_jcc(as, CC_NE, TO_BAIL, offset);
+    emit_op_mem(as, 0, false, 0xff, 1, RAX, (int32_t)offsetof(LoopTrace, countdown));
+    emit_jcc(as, CC_E, TO_BAIL, offset);
+    emit_jump(as, TO_INSTRUCTION, target);
+}
+
+static void emit_instruction(Assembler* as, ObjFunction* function, size_t offset) {
+    Chunk* chunk = &function->chunk;
+    uint8_t* ip = &chunk->code[offset];
+    uint32_t operand = read_operand(ip);
+    size_t next = offset + op_info[ip[0]].length;
+    size_t target = next;
+    instruction_jump_target(ip, offset, &target);
+    
+    switch (ip[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            emit_push_value(as, REG_CONSTANTS, (int32_t)operand * VALUE_SIZE);
+            break;
+        case OP_NIL:
+            emit_push_literal(as, VAL_NIL, 0);
+            break;
+        case OP_TRUE:
+        case OP_FALSE:
+            emit_push_literal(as, VAL_BOOL, ip[0] == OP_TRUE);
+            break;
+        case OP_POP:
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            break;
+        case OP_GET_LOCAL:
+            emit_push_value(as, REG_SLOTS, (int32_t)operand * VALUE_SIZE);
+            break;
+        case OP_SET_LOCAL:
+            emit_copy_value(as, REG_SLOTS, (int32_t)operand * VALUE_SIZE, REG_TOP, TOP(0));
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&global_slots.values);
+            emit_load(as, RAX, RAX, 0);
+            emit_bail_if_type(as, RAX, (int32_t)operand * VALUE_SIZE, CC_E, VAL_UNDEFINED,
+                              TO_BAIL, offset);
+            emit_push_value(as, RAX, (int32_t)operand * VALUE_SIZE);
+            break;
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG: {
+            bool define = ip[0] == OP_DEFINE_GLOBAL || ip[0] == OP_DEFINE_GLOBAL_LONG;
+            emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&global_slots.values);
+            emit_load(as, RAX, RAX, 0);
+            if (!define) {
+                emit_bail_if_type(as, RAX, (int32_t)operand * VALUE_SIZE, CC_E, VAL_UNDEFINED,
+                                  TO_BAIL, offset);
+            }
+            emit_copy_value(as, RAX, (int32_t)operand * VALUE_SIZE, REG_TOP, TOP(0));
+            emit_write_barrier(as, REG_TOP, TOP(0));
+            if (define) emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            break;
+        }
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            emit_values_equal(as);
+            if (ip[0] == OP_NOT_EQUAL) {
+                emit_op_reg(as, 0, false, 0x83, 6, RAX);
+                emit8(as, 1);
+            }
+            emit_store_bool_from_al(as, REG_TOP, TOP(1));
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            break;
+        case OP_GREATER:       emit_compare(as, false, CC_A, true, offset); break;
+        case OP_LESS:          emit_compare(as, true, CC_A, true, offset); break;
+        case OP_GREATER_EQUAL: emit_compare(as, true, CC_BE, true, offset); break;
+        case OP_LESS_EQUAL:    emit_compare(as, false, CC_BE, true, offset); break;
+        case OP_ADD:           emit_arithmetic(as, 0x0f58, true, offset); break;
+        case OP_SUBTRACT:      emit_arithmetic(as, 0x0f5c, true, offset); break;
+        case OP_MULTIPLY:      emit_arithmetic(as, 0x0f59, true, offset); break;
+        case OP_DIVIDE:        emit_arithmetic(as, 0x0f5e, true, offset); break;
+        case OP_MODULO:        emit_modulo(as, true, offset); break;
+        case OP_NOT:
+            emit_falsey_to_ecx(as);
+            emit_store_imm32(as, REG_TOP, TOP(0) + TYPE_OFFSET, VAL_BOOL, false);
+            emit_store(as, REG_TOP, TOP(0) + AS_OFFSET, RCX);
+            break;
+        case OP_NEGATE:
+            emit_bail_if_type(as, REG_TOP, TOP(0), CC_NE, VAL_NUMBER, TO_BAIL, offset);
+            emit_op_mem(as, 0, true, 0x0fba, 7, REG_TOP, TOP(0) + AS_OFFSET);
+            emit8(as, 63);
+            break;
+        case OP_PRINT:
+            emit_load(as, RDI, REG_TOP, TOP(0));
+            emit_load(as, RSI, REG_TOP, TOP(0) + 8);
+            emit_call(as, (void*)print_value);
+            emit_mov_imm32(as, RDI, '\n');
+            emit_call(as, (void*)putchar);
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            break;
+        case OP_JUMP:
+        case OP_JUMP_LONG:
+            emit_jump(as, TO_INSTRUCTION, target);
+            break;
+        case OP_LOOP:
+        case OP_LOOP_LONG:
+            emit_backedge(as, function, offset, target);
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_LONG:
+            emit_jump_if_falsey(as, target);
+            break;
+        case OP_JUMP_IF_LESS:
+            emit_compare_pop(as, true, true, offset);
+            emit_jcc(as, CC_A, TO_INSTRUCTION, target);
+            break;
+        case OP_JUMP_IF_NOT_LESS:
+            emit_compare_pop(as, true, true, offset);
+            emit_jcc(as, CC_BE, TO_INSTRUCTION, target);
+            break;
+        case OP_JUMP_IF_GREATER:
+            emit_compare_pop(as, false, true, offset);
+            emit_jcc(as, CC_A, TO_INSTRUCTION, target);
+            break;
+        case OP_JUMP_IF_NOT_GREATER:
+            emit_compare_pop(as, false, true, offset);
+            emit_jcc(as, CC_BE, TO_INSTRUCTION, target);
+            break;
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL:
+            emit_values_equal(as);
+            emit_op_mem(as, 0, true, 0x8d, REG_TOP, REG_TOP, -2 * VALUE_SIZE);
+            emit_op_reg(as, 0, false, 0x84, RAX, RAX);
+            emit_jcc(as, ip[0] == OP_JUMP_IF_EQUAL ? CC_NE : CC_E, TO_INSTRUCTION, target);
+            break;
+        case OP_ADD_LOCALS: {
+            int32_t a = (int32_t)(operand >> 8) * VALUE_SIZE;
+            int32_t b = (int32_t)(operand & 0xff) * VALUE_SIZE;
+            emit_bail_if_type(as, REG_SLOTS, a, CC_NE, VAL_NUMBER, TO_BAIL, offset);
+            emit_bail_if_type(as, REG_SLOTS, b, CC_NE, VAL_NUMBER, TO_BAIL, offset);
+            emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_SLOTS, a + AS_OFFSET);
+            emit_op_mem(as, 0xf2, false, 0x0f58, XMM0, REG_SLOTS, b + AS_OFFSET);
+            emit_store_imm32(as, REG_TOP, TYPE_OFFSET, VAL_NUMBER, false);
+            emit_op_mem(as, 0xf2, false, 0x0f11, XMM0, REG_TOP, AS_OFFSET);
+            emit_add_imm(as, REG_TOP, VALUE_SIZE);
+            break;
+        }
+        case OP_LESS_LOCAL_CONSTANT: {
+            int32_t a = (int32_t)(operand >> 8) * VALUE_SIZE;
+            uint32_t index = operand & 0xff;
+            if (!IS_NUMBER(chunk->constants[index])) {
+                emit_jump(as, TO_BAIL, offset);
+                break;
+            }
+            emit_bail_if_type(as, REG_SLOTS, a, CC_NE, VAL_NUMBER, TO_BAIL, offset);
+            emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_CONSTANTS,
+                        (int32_t)index * VALUE_SIZE + AS_OFFSET);
+            emit_op_mem(as, 0x66, false, 0x0f2e, XMM0, REG_SLOTS, a + AS_OFFSET);
+            emit_op_reg(as, 0, false, 0x0f90 + CC_A, 0, RAX);
+            emit_store_bool_from_al(as, REG_TOP, 0);
+            emit_add_imm(as, REG_TOP, VALUE_SIZE);
+            break;
+        }
+        case OP_CALL:
+            emit_sync(as, &function->code[next]);
+            emit_mov_imm32(as, RDI, operand);
+            emit_call(as, (void*)jit_call);
+            emit_op_reg(as, 0, false, 0x85, RAX, RAX);
+            emit_jcc(as, CC_NE, TO_ERROR, 0);
+            emit_reload(as);
+            break;
+        case OP_RETURN:
+            /* Mirrors the interpreter: the result replaces the callee slot. */
+            emit_copy_value(as, REG_SLOTS, 0, REG_TOP, TOP(0));
+            emit_op_mem(as, 0, true, 0x8d, RAX, REG_SLOTS, VALUE_SIZE);
+            emit_store(as, REG_VM, (int32_t)offsetof(VM, stack_top), RAX);
+            emit_op_mem(as, 0, false, 0xff, 1, REG_VM, (int32_t)offsetof(VM, frame_count));
+            emit_mov_imm32(as, RAX, JIT_RETURNED);
+            emit_jump(as, TO_EPILOGUE, 0);
+            break;
+        default:
+            /* OP_TAIL_CALL and anything new: let the interpreter run it. */
+            emit_jump(as, TO_BAIL, offset);
+            break;
+    }
+}
+
+bool jit_compile(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    if (chunk->count == 0) return false;
+    
+    Assembler as;
+    init_assembler(&as);
+    size_t* native_at = malloc(chunk->count * sizeof(size_t));
+    size_t* bail_at = malloc(chunk->count * sizeof(size_t));
+    for (size_t i = 0; i < chunk->count; i++) bail_at[i] = SIZE_MAX;
+    
+    emit_prologue(&as, chunk->constants);
+    
+    for (size_t offset = 0; offset < chunk->count; offset += op_info[chunk->code[offset]].length) {
+        native_at[offset] = as.count;
+        emit_instruction(&as, function, offset);
+    }
+    
+    /* Out-of-line exits: one bail stub per instruction that can bail. */
+    int fixup_count = as.fixup_count;
+    for (int i = 0; i < fixup_count; i++) {
+        size_t offset = as.fixups[i].offset;
+        if (as.fixups[i].kind != TO_BAIL || bail_at[offset] != SIZE_MAX) continue;
+        
+        bail_at[offset] = as.count;
+        emit_sync(&as, &function->code[offset]);
+        emit_mov_imm32(&as, RAX, JIT_BAILED);
+        emit_jump(&as, TO_EPILOGUE, 0);
+    }
+    
+    size_t error = as.count;
+    emit_mov_imm32(&as, RAX, JIT_ERROR);
+    size_t epilogue = emit_epilogue(&as);
+    
+    for (int i = 0; i < as.fixup_count; i++) {
+        Fixup* fixup = &as.fixups[i];
+        size_t target = 0;
+        switch (fixup->kind) {
+            case TO_INSTRUCTION: target = native_at[fixup->offset]; break;
+            case TO_BAIL:
+            case TO_EXIT:        target = bail_at[fixup->offset]; break;
+            case TO_EPILOGUE:    target = epilogue; break;
+            case TO_ERROR:       target = error; break;
+        }
+        patch32(&as, fixup->at, (uint32_t)(target - (fixup->at + 4)));
+    }
+    
+    function->native = install_code(&as);
+    
+    free(native_at);
+    free(bail_at);
+    free_assembler(&as);
+    return function->native != NULL;
+}
+
+void free_jit() {
+    free_traces();
+    free_code();
+}
+
+#endif
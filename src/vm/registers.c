@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "../../include/algo_register.h"
+#include "../../include/algo_memory.h"
+
+/*
+ * Interpreter for register bytecode. Registers are the VM's value stack:
+ * each frame's registers start at its callee, the way a stack frame's
+ * slots do, and vm->stack_top sits just above the current frame. Frames
+ * are kept here rather than in vm->frames because their ip points at
+ * 32-bit words.
+ */
+
+typedef struct {
+    ObjFunction* function;
+    uint32_t* ip;
+    Value* base;
+} RegisterFrame;
+
+static RegisterFrame* frames = NULL;
+static int frame_capacity = 0;
+static int frame_count = 0;
+
+#ifdef ALGO_DISPATCH_STATS
+static uint64_t dispatch_counts[R_OP_COUNT];
+
+static void print_dispatch_stats() {
+    uint64_t total = 0;
+    for (int i = 0; i < R_OP_COUNT; i++) total += dispatch_counts[i];
+    if (total == 0) return;
+    
+    fprintf(stderr, "== dispatch stats (registers) ==\n");
+    for (int i = 0; i < R_OP_COUNT; i++) {
+        if (dispatch_counts[i] == 0) continue;
+        fprintf(stderr, "%-24s %12llu  %5.1f%%\n", register_op_names[i],
+                (unsigned long long)dispatch_counts[i],
+                100.0 * dispatch_counts[i] / total);
+    }
+    fprintf(stderr, "%-24s %12llu\n", "total", (unsigned long long)total);
+}
+
+#define COUNT_DISPATCH(op) (dispatch_counts[(op)]++)
+#else
+#define COUNT_DISPATCH(op) ((void)0)
+#endif
+
+void free_register_vm() {
+#ifdef ALGO_DISPATCH_STATS
+    print_dispatch_stats();
+#endif
+    free(frames);
+    frames = NULL;
+    frame_capacity = 0;
+}
+
+static void runtime_error(VM* vm, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+    
+    for (int i = frame_count - 1; i >= 0; i--) {
+        if (frame_count > 2 * TRACE_EDGE && i == frame_count - 1 - TRACE_EDGE) {
+            fprintf(stderr, "... %d more frames ...\n", frame_count - 2 * TRACE_EDGE);
+            i = TRACE_EDGE;
+            continue;
+        }
+        
+        RegisterFrame* frame = &frames[i];
+        ObjFunction* function = frame->function;
+        size_t instruction = frame->ip - function->registers.code - 1;
+        LineCursor position = {0, 0, 0, 0};
+        find_position(&function->registers.lines, instruction, &position);
+        fprintf(stderr, "[line %d:%d] in ", position.line, position.column);
+        if (function->name == NULL) {
+            fprintf(stderr, "script\n");
+        } else {
+            fprintf(stderr, "%s()\n", function->name->chars);
+        }
+    }
+    
+    vm->stack_top = vm->stack;
+    frame_count = 0;
+}
+
+static bool is_falsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/* Makes room for `function`'s registers at `base`; moving the stack rebases every frame. */
+static bool reserve_registers(VM* vm, Value** base, ObjFunction* function) {
+    size_t needed = (*base - vm->stack) + function->registers.frame_size;
+    if (needed > vm->stack_capacity) {
+        if (needed > vm->stack_limit) return false;
+        
+        size_t capacity = vm->stack_capacity;
+        while (capacity < needed) capacity *= 2;
+        if (capacity > vm->stack_limit) capacity = vm->stack_limit;
+        
+        Value* stack = realloc(vm->stack, capacity * sizeof(Value));
+        for (int i = 0; i < frame_count; i++) {
+            frames[i].base = stack + (frames[i].base - vm->stack);
+        }
+        *base = stack + (*base - vm->stack);
+        vm->stack = stack;
+        vm->stack_capacity = capacity;
+    }
+    vm->stack_top = *base + function->registers.frame_size;
+    
+    /* The collector scans up to the stack top, so no register may keep a stale value. */
+    for (Value* slot = *base + 1 + function->arity; slot < vm->stack_top; slot++) {
+        *slot = NIL_VAL;
+    }
+    return true;
+}
+
+/* Makes room for one more frame without pushing it. */
+static bool ensure_frame(VM* vm) {
+    if (frame_count == frame_capacity) {
+        if (frame_capacity == vm->frame_limit) return false;
+        int capacity = frame_capacity < FRAMES_INITIAL ? FRAMES_INITIAL : frame_capacity * 2;
+        if (capacity > vm->frame_limit) capacity = vm->frame_limit;
+        frames = realloc(frames, capacity * sizeof(RegisterFrame));
+        frame_capacity = capacity;
+    }
+    return true;
+}
+
+InterpretResult run_registers(VM* vm, ObjFunction* script) {
+    Value* base = vm->stack;
+    base[0] = OBJ_VAL(script);
+    if (!ensure_frame(vm) || !reserve_registers(vm, &base, script)) {
+        fprintf(stderr, "Stack overflow\n");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    
+    RegisterFrame* frame = &frames[frame_count++];
+    frame->function = script;
+    frame->base = base;
+    
+    uint32_t* ip = script->registers.code;
+    Value* constants = script->chunk.constants;
+    uint32_t i;
+    
+#define RK(x) ((x) & RK_CONSTANT ? constants[(x) & 0xff] : base[x])
+#define NEXT_OPCODE() (i = *ip++, COUNT_DISPATCH(GET_OP(i)), GET_OP(i))
+#define ERROR(...) \
+    do { \
+        frame->ip = ip; \
+        runtime_error(vm, __VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (0)
+#define ARITHMETIC(op) \
+    { \
+        Value b = RK(GET_B(i)); \
+        Value c = RK(GET_C(i)); \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) ERROR("Operands must be numbers"); \
+        base[GET_A(i)] = NUMBER_VAL(AS_NUMBER(b) op AS_NUMBER(c)); \
+    }
+#define COMPARE(test) \
+    { \
+        Value b = RK(GET_B(i)); \
+        Value c = RK(GET_C(i)); \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) ERROR("Operands must be numbers"); \
+        base[GET_A(i)] = BOOL_VAL(test); \
+    }
+/* The R_JMP after a conditional is taken in place, without a second dispatch. */
+#define BRANCH(cond) \
+    { \
+        if ((cond) == (bool)GET_A(i)) ip += 1 + GET_SBX(*ip); \
+        else ip++; \
+    }
+#define COMPARE_BRANCH(op) \
+    { \
+        Value b = RK(GET_B(i)); \
+        Value c = RK(GET_C(i)); \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) ERROR("Operands must be numbers"); \
+        BRANCH(AS_NUMBER(b) op AS_NUMBER(c)); \
+    }
+
+#ifdef ALGO_COMPUTED_GOTO
+    static void* dispatch_table[] = {
+        [R_MOVE]      = &&op_R_MOVE,
+        [R_LOADK]     = &&op_R_LOADK,
+        [R_LOADNIL]   = &&op_R_LOADNIL,
+        [R_LOADBOOL]  = &&op_R_LOADBOOL,
+        [R_GETGLOBAL] = &&op_R_GETGLOBAL,
+        [R_SETGLOBAL] = &&op_R_SETGLOBAL,
+        [R_DEFGLOBAL] = &&op_R_DEFGLOBAL,
+        [R_ADD]       = &&op_R_ADD,
+        [R_SUB]       = &&op_R_SUB,
+        [R_MUL]       = &&op_R_MUL,
+        [R_DIV]       = &&op_R_DIV,
+        [R_MOD]       = &&op_R_MOD,
+        [R_NEG]       = &&op_R_NEG,
+        [R_NOT]       = &&op_R_NOT,
+        [R_EQ]        = &&op_R_EQ,
+        [R_NE]        = &&op_R_NE,
+        [R_LT]        = &&op_R_LT,
+        [R_GT]        = &&op_R_GT,
+        [R_GE]        = &&op_R_GE,
+        [R_LE]        = &&op_R_LE,
+        [R_JMP]       = &&op_R_JMP,
+        [R_IFEQ]      = &&op_R_IFEQ,
+        [R_IFLT]      = &&op_R_IFLT,
+        [R_IFGT]      = &&op_R_IFGT,
+        [R_TEST]      = &&op_R_TEST,
+        [R_CALL]      = &&op_R_CALL,
+        [R_TAILCALL]  = &&op_R_TAILCALL,
+        [R_RETURN]    = &&op_R_RETURN,
+        [R_PRINT]     = &&op_R_PRINT
+    };
+    
+#define DISPATCH_LOOP() DISPATCH();
+#define CASE(op) op_##op
+#define DISPATCH() goto *dispatch_table[NEXT_OPCODE()]
+#else
+#define DISPATCH_LOOP() for (;;) switch (NEXT_OPCODE())
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+    
+    DISPATCH_LOOP() {
+        CASE(R_MOVE):
+            base[GET_A(i)] = base[GET_B(i)];
+            DISPATCH();
+        CASE(R_LOADK):
+            base[GET_A(i)] = constants[GET_BX(i)];
+            DISPATCH();
+        CASE(R_LOADNIL):
+            base[GET_A(i)] = NIL_VAL;
+            DISPATCH();
+        CASE(R_LOADBOOL):
+            base[GET_A(i)] = BOOL_VAL(GET_B(i) != 0);
+            DISPATCH();
+        CASE(R_GETGLOBAL): {
+            Value value = global_slots.values[GET_BX(i)];
+            if (IS_UNDEFINED(value)) {
+                ERROR("Undefined variable '%s'", global_slots.names[GET_BX(i)]->chars);
+            }
+            base[GET_A(i)] = value;
+            DISPATCH();
+        }
+        CASE(R_SETGLOBAL): {
+            Value* slot = &global_slots.values[GET_BX(i)];
+            if (IS_UNDEFINED(*slot)) {
+                ERROR("Undefined variable '%s'", global_slots.names[GET_BX(i)]->chars);
+            }
+            *slot = base[GET_A(i)];
+            write_barrier(*slot);
+            DISPATCH();
+        }
+        CASE(R_DEFGLOBAL):
+            global_slots.values[GET_BX(i)] = base[GET_A(i)];
+            write_barrier(base[GET_A(i)]);
+            DISPATCH();
+        CASE(R_ADD): ARITHMETIC(+) DISPATCH();
+        CASE(R_SUB): ARITHMETIC(-) DISPATCH();
+        CASE(R_MUL): ARITHMETIC(*) DISPATCH();
+        CASE(R_DIV): ARITHMETIC(/) DISPATCH();
+        CASE(R_MOD): {
+            Value b = RK(GET_B(i));
+            Value c = RK(GET_C(i));
+            if (!IS_NUMBER(b) || !IS_NUMBER(c)) ERROR("Operands must be numbers");
+            base[GET_A(i)] = NUMBER_VAL(fmod(AS_NUMBER(b), AS_NUMBER(c)));
+            DISPATCH();
+        }
+        CASE(R_NEG): {
+            Value b = base[GET_B(i)];
+            if (!IS_NUMBER(b)) ERROR("Operand must be a number");
+            base[GET_A(i)] = NUMBER_VAL(-AS_NUMBER(b));
+            DISPATCH();
+        }
+        CASE(R_NOT):
+            base[GET_A(i)] = BOOL_VAL(is_falsey(base[GET_B(i)]));
+            DISPATCH();
+        CASE(R_EQ):
+            base[GET_A(i)] = BOOL_VAL(values_equal(RK(GET_B(i)), RK(GET_C(i))));
+            DISPATCH();
+        CASE(R_NE):
+            base[GET_A(i)] = BOOL_VAL(!values_equal(RK(GET_B(i)), RK(GET_C(i))));
+            DISPATCH();
+        CASE(R_LT): COMPARE(AS_NUMBER(b) < AS_NUMBER(c)) DISPATCH();
+        CASE(R_GT): COMPARE(AS_NUMBER(b) > AS_NUMBER(c)) DISPATCH();
+        CASE(R_GE): COMPARE(!(AS_NUMBER(b) < AS_NUMBER(c))) DISPATCH();
+        CASE(R_LE): COMPARE(!(AS_NUMBER(b) > AS_NUMBER(c))) DISPATCH();
+        CASE(R_JMP):
+            ip += GET_SBX(i);
+            DISPATCH();
+        CASE(R_IFEQ):
+            BRANCH(values_equal(RK(GET_B(i)), RK(GET_C(i))));
+            DISPATCH();
+        CASE(R_IFLT): COMPARE_BRANCH(<) DISPATCH();
+        CASE(R_IFGT): COMPARE_BRANCH(>) DISPATCH();
+        CASE(R_TEST):
+            BRANCH(!is_falsey(base[GET_B(i)]));
+            DISPATCH();
+        CASE(R_CALL):
+        CASE(R_TAILCALL): {
+            int a = GET_A(i);
+            int arg_count = GET_B(i);
+            Value callee = base[a];
+            
+            if (IS_NATIVE(callee)) {
+                base[a] = AS_NATIVE(callee)(arg_count, &base[a + 1]);
+                DISPATCH();
+            }
+            if (!IS_FUNCTION(callee)) ERROR("Can only call functions");
+            
+            ObjFunction* function = AS_FUNCTION(callee);
+            if (arg_count != function->arity) {
+                ERROR("Expected %d arguments but got %d", function->arity, arg_count);
+            }
+            
+            /* A tail call reuses the caller's frame: the callee and its arguments slide down to base. */
+            Value* callee_base = base + a;
+            bool tail = GET_OP(i) == R_TAILCALL && vm->tail_calls;
+            if (tail) {
+                memmove(base, callee_base, (arg_count + 1) * sizeof(Value));
+                callee_base = base;
+            } else if (!ensure_frame(vm)) {
+                ERROR("Stack overflow");
+            }
+            frame = &frames[frame_count - 1];
+            if (!reserve_registers(vm, &callee_base, function)) ERROR("Stack overflow");
+            
+            frame->ip = ip;
+            if (!tail) frame = &frames[frame_count++];
+            frame->function = function;
+            frame->base = base = callee_base;
+            ip = function->registers.code;
+            constants = function->chunk.constants;
+            DISPATCH();
+        }
+        CASE(R_RETURN): {
+            Value result = GET_B(i) ? base[GET_A(i)] : NIL_VAL;
+            frame_count--;
+            if (frame_count == 0) {
+                vm->stack_top = vm->stack;
+                return INTERPRET_OK;
+            }
+            
+            base[0] = result;
+            frame = &frames[frame_count - 1];
+            base = frame->base;
+            ip = frame->ip;
+            constants = frame->function->chunk.constants;
+            vm->stack_top = base + frame->function->registers.frame_size;
+            DISPATCH();
+        }
+        CASE(R_PRINT):
+            print_value(base[GET_A(i)]);
+            printf("\n");
+            DISPATCH();
+    }
+    
+    return INTERPRET_RUNTIME_ERROR;
+    
+#undef RK
+#undef NEXT_OPCODE
+#undef ERROR
+#undef ARITHMETIC
+#undef COMPARE
+#undef BRANCH
+#undef COMPARE_BRANCH
+#undef DISPATCH_LOOP
+#undef CASE
+#undef DISPATCH
+}
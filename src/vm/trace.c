@@ -0,0 +1,742 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "../../include/algo_jit.h"
+
+#ifdef ALGO_JIT
+
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_x64.h"
+#include "../../include/algo_memory.h"
+
+/*
+ * Tracing JIT for hot loops. The interpreter counts backedges per loop
+ * header; once a loop is hot, the next iteration is recorded instruction
+ * by instruction together with the types it saw. That single path is
+ * compiled into a native loop: every branch becomes a guard that leaves
+ * the trace when control would go the other way, and every value of
+ * unknown type is checked once against the recorded type, after which
+ * the instructions that use it skip their own checks. Leaving a trace
+ * stores the frame's ip and stack top exactly like a baseline bail, so
+ * the interpreter just carries on from there.
+ */
+
+/* Type of a stack slot the trace cannot vouch for. */
+#define UNKNOWN VAL_UNDEFINED
+
+/* One recorded instruction and the operand types observed before it ran. */
+typedef struct {
+    uint32_t offset;
+    ValueType types[2];
+} TraceStep;
+
+typedef struct {
+    LoopTrace* loop;
+    uint8_t* backedge;
+    int frame_count;
+    int entry_depth;
+    ValueType* entry_types;
+    
+    TraceStep* steps;
+    int count;
+    int capacity;
+} Recorder;
+
+/* What the trace knows about each frame slot while it is being compiled. */
+typedef struct {
+    Assembler as;
+    LoopTrace* loop;
+    Chunk* chunk;
+    ValueType* types;
+    int depth;
+} TraceCompiler;
+
+bool trace_recording = false;
+
+static Recorder recorder = {NULL, NULL, 0, 0, NULL, NULL, 0, 0};
+
+static LoopTrace** cache = NULL;
+static int cache_count = 0;
+static int cache_capacity = 0;
+
+/* The loop found last; a hot loop keeps hitting the same backedge. */
+static LoopTrace* last_loop = NULL;
+
+static int recorded_count = 0;
+static int aborted_count = 0;
+static int blacklisted_count = 0;
+
+static uint32_t hash_loop(ObjFunction* function, uint8_t* header) {
+    uint64_t key = (uint64_t)(uintptr_t)header ^ ((uint64_t)(uintptr_t)function << 16);
+    key *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(key >> 32);
+}
+
+static LoopTrace** find_entry(LoopTrace** entries, int capacity, ObjFunction* function,
+                              uint8_t* header) {
+    uint32_t index = hash_loop(function, header) & (capacity - 1);
+    
+    while (true) {
+        LoopTrace** entry = &entries[index];
+        if (*entry == NULL) return entry;
+        if ((*entry)->function == function && (*entry)->header == header) return entry;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjust_capacity(int capacity) {
+    LoopTrace** entries = calloc(capacity, sizeof(LoopTrace*));
+    
+    for (int i = 0; i < cache_capacity; i++) {
+        LoopTrace* loop = cache[i];
+        if (loop == NULL) continue;
+        *find_entry(entries, capacity, loop->function, loop->header) = loop;
+    }
+    
+    free(cache);
+    cache = entries;
+    cache_capacity = capacity;
+}
+
+LoopTrace* find_loop(ObjFunction* function, uint8_t* header) {
+    if (last_loop != NULL && last_loop->header == header && last_loop->function == function) {
+        return last_loop;
+    }
+    
+    if (cache_count + 1 > cache_capacity * 3 / 4) {
+        adjust_capacity(cache_capacity < 8 ? 8 : cache_capacity * 2);
+    }
+    
+    LoopTrace** entry = find_entry(cache, cache_capacity, function, header);
+    if (*entry != NULL) {
+        last_loop = *entry;
+        return last_loop;
+    }
+    
+    LoopTrace* loop = calloc(1, sizeof(LoopTrace));
+    loop->function = function;
+    loop->header = header;
+    loop->countdown = TRACE_THRESHOLD;
+    *entry = loop;
+    cache_count++;
+    last_loop = loop;
+    return loop;
+}
+
+static void blacklist(LoopTrace* loop) {
+    loop->blacklisted = true;
+    loop->trace = NULL;
+    loop->countdown = INT_MAX;
+    blacklisted_count++;
+}
+
+static void stop_recording() {
+    trace_recording = false;
+    recorder.loop = NULL;
+    recorder.count = 0;
+}
+
+void abort_recording() {
+    if (!trace_recording) return;
+    
+    LoopTrace* loop = recorder.loop;
+    aborted_count++;
+    if (++loop->aborts >= TRACE_MAX_ABORTS) blacklist(loop);
+    stop_recording();
+}
+
+/* The OP_LOOP that closes the loop at `header`; loops have no other way back. */
+static uint8_t* find_backedge(ObjFunction* function, uint8_t* header) {
+    Chunk* chunk = &function->chunk;
+    size_t offset = header - function->code;
+    size_t start = offset;
+    
+    while (offset < chunk->count) {
+        size_t target;
+        uint8_t op = chunk->code[offset];
+        if ((op == OP_LOOP || op == OP_LOOP_LONG) &&
+            instruction_jump_target(&chunk->code[offset], offset, &target) && target == start) {
+            return &function->code[offset];
+        }
+        offset += op_info[op].length;
+    }
+    return header;
+}
+
+static void start_recording(VM* vm, CallFrame* frame, LoopTrace* loop) {
+    int depth = (int)(vm->stack_top - frame->slots);
+    recorder.entry_types = realloc(recorder.entry_types, (depth + 1) * sizeof(ValueType));
+    for (int i = 0; i < depth; i++) recorder.entry_types[i] = frame->slots[i].type;
+    
+    recorder.loop = loop;
+    recorder.backedge = find_backedge(loop->function, loop->header);
+    recorder.frame_count = vm->frame_count;
+    recorder.entry_depth = depth;
+    recorder.count = 0;
+    trace_recording = true;
+}
+
+/* ---- Compilation ---- */
+
+static void push_type(TraceCompiler* tc, ValueType type) {
+    tc->types[tc->depth++] = type;
+}
+
+static ValueType top_type(TraceCompiler* tc, int distance) {
+    return tc->types[tc->depth - 1 - distance];
+}
+
+static bool numbers_on_top(TraceCompiler* tc) {
+    return top_type(tc, 0) == VAL_NUMBER && top_type(tc, 1) == VAL_NUMBER;
+}
+
+/* Checks slot `slot` against the type recorded for it, unless the trace already knows it. */
+static void guard_slot(TraceCompiler* tc, int slot, ValueType observed, size_t offset) {
+    if (tc->types[slot] != UNKNOWN) return;
+    if (observed != VAL_NUMBER && observed != VAL_BOOL) return;
+    
+    emit_bail_if_type(&tc->as, REG_SLOTS, slot * VALUE_SIZE, CC_NE, observed, TO_BAIL, offset);
+    tc->types[slot] = observed;
+}
+
+/* Leaves the trace at `offset` when condition `cc` holds. */
+static void exit_if(TraceCompiler* tc, int cc, size_t offset) {
+    emit_jcc(&tc->as, cc, TO_EXIT, offset);
+}
+
+/* Equality of the top two numbers into al, NaN included. */
+static void emit_number_equal(Assembler* as, bool negate) {
+    emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_op_mem(as, 0x66, false, 0x0f2e, XMM0, REG_TOP, TOP(0) + AS_OFFSET);
+    emit_op_reg(as, 0, false, 0x0f90 + (negate ? CC_NE : CC_E), 0, RAX);
+    emit_op_reg(as, 0, false, 0x0f90 + (negate ? CC_P : CC_P + 1), 0, RCX);
+    emit_op_reg(as, 0, false, negate ? 0x08 : 0x20, RCX, RAX);
+}
+
+static void emit_equal(TraceCompiler* tc, bool negate) {
+    if (numbers_on_top(tc)) {
+        emit_number_equal(&tc->as, negate);
+    } else {
+        emit_values_equal(&tc->as);
+        if (negate) {
+            emit_op_reg(&tc->as, 0, false, 0x83, 6, RAX);
+            emit8(&tc->as, 1);
+        }
+    }
+}
+
+/* Leaves the trace when a two-way branch would not go where it went while recording. */
+static void emit_branch(TraceCompiler* tc, int cc, bool taken, size_t next, size_t target) {
+    if (taken) {
+        exit_if(tc, cc ^ 1, next);
+    } else {
+        exit_if(tc, cc, target);
+    }
+}
+
+static bool emit_step(TraceCompiler* tc, const TraceStep* step, size_t following) {
+    Assembler* as = &tc->as;
+    size_t offset = step->offset;
+    uint8_t* ip = &tc->chunk->code[offset];
+    uint32_t operand = read_operand(ip);
+    size_t next = offset + op_info[ip[0]].length;
+    size_t target = next;
+    instruction_jump_target(ip, offset, &target);
+    bool taken = following == target && target != next;
+    
+    switch (ip[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            emit_push_value(as, REG_CONSTANTS, (int32_t)operand * VALUE_SIZE);
+            push_type(tc, tc->chunk->constants[operand].type);
+            break;
+        case OP_NIL:
+            emit_push_literal(as, VAL_NIL, 0);
+            push_type(tc, VAL_NIL);
+            break;
+        case OP_TRUE:
+        case OP_FALSE:
+            emit_push_literal(as, VAL_BOOL, ip[0] == OP_TRUE);
+            push_type(tc, VAL_BOOL);
+            break;
+        case OP_POP:
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            tc->depth--;
+            break;
+        case OP_GET_LOCAL:
+            guard_slot(tc, (int)operand, step->types[0], offset);
+            emit_push_value(as, REG_SLOTS, (int32_t)operand * VALUE_SIZE);
+            push_type(tc, tc->types[operand]);
+            break;
+        case OP_SET_LOCAL:
+            emit_copy_value(as, REG_SLOTS, (int32_t)operand * VALUE_SIZE, REG_TOP, TOP(0));
+            tc->types[operand] = top_type(tc, 0);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG: {
+            /* Checking for the recorded type also rules out an undefined global. */
+            ValueType observed = step->types[0];
+            bool specialize = observed == VAL_NUMBER || observed == VAL_BOOL;
+            emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&global_slots.values);
+            emit_load(as, RAX, RAX, 0);
+            emit_bail_if_type(as, RAX, (int32_t)operand * VALUE_SIZE, specialize ? CC_NE : CC_E,
+                              specialize ? observed : VAL_UNDEFINED, TO_BAIL, offset);
+            emit_push_value(as, RAX, (int32_t)operand * VALUE_SIZE);
+            push_type(tc, specialize ? observed : UNKNOWN);
+            break;
+        }
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG: {
+            bool define = ip[0] == OP_DEFINE_GLOBAL || ip[0] == OP_DEFINE_GLOBAL_LONG;
+            emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&global_slots.values);
+            emit_load(as, RAX, RAX, 0);
+            if (!define) {
+                emit_bail_if_type(as, RAX, (int32_t)operand * VALUE_SIZE, CC_E, VAL_UNDEFINED,
+                                  TO_BAIL, offset);
+            }
+            emit_copy_value(as, RAX, (int32_t)operand * VALUE_SIZE, REG_TOP, TOP(0));
+            if (top_type(tc, 0) != VAL_NUMBER) emit_write_barrier(as, REG_TOP, TOP(0));
+            if (define) {
+                emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+                tc->depth--;
+            }
+            break;
+        }
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            emit_equal(tc, ip[0] == OP_NOT_EQUAL);
+            emit_store_bool_from_al(as, REG_TOP, TOP(1));
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            tc->depth -= 2;
+            push_type(tc, VAL_BOOL);
+            break;
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL: {
+            bool swap = ip[0] == OP_LESS || ip[0] == OP_GREATER_EQUAL;
+            int cc = ip[0] == OP_GREATER || ip[0] == OP_LESS ? CC_A : CC_BE;
+            emit_compare(as, swap, cc, !numbers_on_top(tc), offset);
+            tc->depth -= 2;
+            push_type(tc, VAL_BOOL);
+            break;
+        }
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO: {
+            bool checked = !numbers_on_top(tc);
+            switch (ip[0]) {
+                case OP_ADD:      emit_arithmetic(as, 0x0f58, checked, offset); break;
+                case OP_SUBTRACT: emit_arithmetic(as, 0x0f5c, checked, offset); break;
+                case OP_MULTIPLY: emit_arithmetic(as, 0x0f59, checked, offset); break;
+                case OP_DIVIDE:   emit_arithmetic(as, 0x0f5e, checked, offset); break;
+                default:          emit_modulo(as, checked, offset); break;
+            }
+            tc->depth -= 2;
+            push_type(tc, VAL_NUMBER);
+            break;
+        }
+        case OP_NOT:
+            if (top_type(tc, 0) == VAL_BOOL) {
+                emit_op_mem(as, 0, false, 0x80, 7, REG_TOP, TOP(0) + AS_OFFSET);
+                emit8(as, 0);
+                emit_op_reg(as, 0, false, 0x0f90 + CC_E, 0, RAX);
+                emit_store_bool_from_al(as, REG_TOP, TOP(0));
+            } else {
+                emit_falsey_to_ecx(as);
+                emit_store_imm32(as, REG_TOP, TOP(0) + TYPE_OFFSET, VAL_BOOL, false);
+                emit_store(as, REG_TOP, TOP(0) + AS_OFFSET, RCX);
+            }
+            tc->depth--;
+            push_type(tc, VAL_BOOL);
+            break;
+        case OP_NEGATE:
+            if (top_type(tc, 0) != VAL_NUMBER) {
+                emit_bail_if_type(as, REG_TOP, TOP(0), CC_NE, VAL_NUMBER, TO_BAIL, offset);
+            }
+            emit_op_mem(as, 0, true, 0x0fba, 7, REG_TOP, TOP(0) + AS_OFFSET);
+            emit8(as, 63);
+            tc->depth--;
+            push_type(tc, VAL_NUMBER);
+            break;
+        case OP_PRINT:
+            emit_load(as, RDI, REG_TOP, TOP(0));
+            emit_load(as, RSI, REG_TOP, TOP(0) + 8);
+            emit_call(as, (void*)print_value);
+            emit_mov_imm32(as, RDI, '\n');
+            emit_call(as, (void*)putchar);
+            emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+            tc->depth--;
+            break;
+        case OP_JUMP:
+        case OP_JUMP_LONG:
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_LONG: {
+            if (target == next) break;
+            ValueType type = top_type(tc, 0);
+            if (type == VAL_NUMBER && !taken) break;
+            if (type == VAL_BOOL) {
+                emit_op_mem(as, 0, false, 0x80, 7, REG_TOP, TOP(0) + AS_OFFSET);
+                emit8(as, 0);
+            } else {
+                emit_falsey_to_ecx(as);
+                emit_op_reg(as, 0, false, 0x85, RCX, RCX);
+            }
+            /* The jump is taken when the bool is false (ZF set) or ecx is nonzero. */
+            emit_branch(tc, type == VAL_BOOL ? CC_E : CC_NE, taken, next, target);
+            break;
+        }
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_GREATER: {
+            bool swap = ip[0] == OP_JUMP_IF_LESS || ip[0] == OP_JUMP_IF_NOT_LESS;
+            int cc = ip[0] == OP_JUMP_IF_LESS || ip[0] == OP_JUMP_IF_GREATER ? CC_A : CC_BE;
+            emit_compare_pop(as, swap, !numbers_on_top(tc), offset);
+            tc->depth -= 2;
+            emit_branch(tc, cc, taken, next, target);
+            break;
+        }
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL:
+            emit_equal(tc, false);
+            emit_op_mem(as, 0, true, 0x8d, REG_TOP, REG_TOP, -2 * VALUE_SIZE);
+            emit_op_reg(as, 0, false, 0x84, RAX, RAX);
+            tc->depth -= 2;
+            emit_branch(tc, ip[0] == OP_JUMP_IF_EQUAL ? CC_NE : CC_E, taken, next, target);
+            break;
+        case OP_ADD_LOCALS: {
+            int a = (int)(operand >> 8);
+            int b = (int)(operand & 0xff);
+            guard_slot(tc, a, step->types[0], offset);
+            guard_slot(tc, b, step->types[1], offset);
+            if (tc->types[a] != VAL_NUMBER || tc->types[b] != VAL_NUMBER) return false;
+            emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_SLOTS, a * VALUE_SIZE + AS_OFFSET);
+            emit_op_mem(as, 0xf2, false, 0x0f58, XMM0, REG_SLOTS, b * VALUE_SIZE + AS_OFFSET);
+            emit_store_imm32(as, REG_TOP, TYPE_OFFSET, VAL_NUMBER, false);
+            emit_op_mem(as, 0xf2, false, 0x0f11, XMM0, REG_TOP, AS_OFFSET);
+            emit_add_imm(as, REG_TOP, VALUE_SIZE);
+            push_type(tc, VAL_NUMBER);
+            break;
+        }
+        case OP_LESS_LOCAL_CONSTANT: {
+            int a = (int)(operand >> 8);
+            uint32_t index = operand & 0xff;
+            guard_slot(tc, a, step->types[0], offset);
+            if (tc->types[a] != VAL_NUMBER || !IS_NUMBER(tc->chunk->constants[index])) return false;
+            emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_CONSTANTS,
+                        (int32_t)index * VALUE_SIZE + AS_OFFSET);
+            emit_op_mem(as, 0x66, false, 0x0f2e, XMM0, REG_SLOTS, a * VALUE_SIZE + AS_OFFSET);
+            emit_op_reg(as, 0, false, 0x0f90 + CC_A, 0, RAX);
+            emit_store_bool_from_al(as, REG_TOP, 0);
+            emit_add_imm(as, REG_TOP, VALUE_SIZE);
+            push_type(tc, VAL_BOOL);
+            break;
+        }
+        case OP_LOOP:
+        case OP_LOOP_LONG:
+            emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&tc->loop->iterations);
+            emit_op_mem(as, 0, true, 0xff, 0, RAX, 0);
+            emit_jump(as, TO_INSTRUCTION, 0);
+            break;
+        default:
+            /* Calls and returns end a recording before they get here. */
+            return false;
+    }
+    return true;
+}
+
+/* Counts an exit and leaves the trace with the frame resuming at `offset`. */
+static void emit_exit_stub(TraceCompiler* tc, uint64_t* counter, size_t offset) {
+    Assembler* as = &tc->as;
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)counter);
+    emit_op_mem(as, 0, true, 0xff, 0, RAX, 0);
+    emit_sync(as, &tc->loop->function->code[offset]);
+    emit_mov_imm32(as, RAX, JIT_BAILED);
+    emit_jump(as, TO_EPILOGUE, 0);
+}
+
+/*
+ * Compiles the recorded iteration once, assuming the slots in `stable`
+ * hold numbers at every loop entry. Those are checked once before the
+ * loop instead of on every use. Returns false if a step cannot be compiled.
+ */
+static bool compile_pass(TraceCompiler* tc, const bool* stable) {
+    Assembler* as = &tc->as;
+    free_assembler(as);
+    
+    int entry_depth = recorder.entry_depth;
+    tc->depth = entry_depth;
+    for (int i = 0; i < entry_depth; i++) tc->types[i] = stable[i] ? VAL_NUMBER : UNKNOWN;
+    
+    size_t header = recorder.steps[0].offset;
+    emit_prologue(as, tc->chunk->constants);
+    for (int i = 0; i < entry_depth; i++) {
+        if (!stable[i]) continue;
+        emit_bail_if_type(as, REG_SLOTS, i * VALUE_SIZE, CC_NE, VAL_NUMBER, TO_BAIL, header);
+    }
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&tc->loop->entries);
+    emit_op_mem(as, 0, true, 0xff, 0, RAX, 0);
+    
+    size_t loop_start = as->count;
+    for (int i = 0; i < recorder.count; i++) {
+        size_t following = i + 1 < recorder.count ? recorder.steps[i + 1].offset : header;
+        if (!emit_step(tc, &recorder.steps[i], following)) return false;
+    }
+    
+    size_t* guard_at = malloc(tc->chunk->count * sizeof(size_t));
+    size_t* exit_at = malloc(tc->chunk->count * sizeof(size_t));
+    for (size_t i = 0; i < tc->chunk->count; i++) {
+        guard_at[i] = SIZE_MAX;
+        exit_at[i] = SIZE_MAX;
+    }
+    
+    int fixup_count = as->fixup_count;
+    for (int i = 0; i < fixup_count; i++) {
+        size_t offset = as->fixups[i].offset;
+        if (as->fixups[i].kind == TO_BAIL && guard_at[offset] == SIZE_MAX) {
+            guard_at[offset] = as->count;
+            emit_exit_stub(tc, &tc->loop->guard_exits, offset);
+        } else if (as->fixups[i].kind == TO_EXIT && exit_at[offset] == SIZE_MAX) {
+            exit_at[offset] = as->count;
+            emit_exit_stub(tc, &tc->loop->branch_exits, offset);
+        }
+    }
+    size_t epilogue = emit_epilogue(as);
+    
+    for (int i = 0; i < as->fixup_count; i++) {
+        Fixup* fixup = &as->fixups[i];
+        size_t target = 0;
+        switch (fixup->kind) {
+            case TO_INSTRUCTION: target = loop_start; break;
+            case TO_BAIL:        target = guard_at[fixup->offset]; break;
+            case TO_EXIT:        target = exit_at[fixup->offset]; break;
+            case TO_EPILOGUE:
+            case TO_ERROR:       target = epilogue; break;
+        }
+        patch32(as, fixup->at, (uint32_t)(target - (fixup->at + 4)));
+    }
+    
+    free(guard_at);
+    free(exit_at);
+    return true;
+}
+
+static bool compile_trace(LoopTrace* loop) {
+    ObjFunction* function = loop->function;
+    int entry_depth = recorder.entry_depth;
+    
+    TraceCompiler tc;
+    init_assembler(&tc.as);
+    tc.loop = loop;
+    tc.chunk = &function->chunk;
+    tc.types = malloc((function->max_slots + 1) * sizeof(ValueType));
+    
+    /*
+     * A slot that held a number on entry stays checked only once if every
+     * path through the trace also leaves a number in it. Dropping one slot
+     * can make a later store unknown, so repeat until nothing changes.
+     */
+    bool* stable = malloc((entry_depth + 1) * sizeof(bool));
+    for (int i = 0; i < entry_depth; i++) stable[i] = recorder.entry_types[i] == VAL_NUMBER;
+    
+    bool compiled;
+    bool changed = true;
+    while ((compiled = compile_pass(&tc, stable)) && changed) {
+        changed = false;
+        for (int i = 0; i < entry_depth; i++) {
+            if (stable[i] && tc.types[i] != VAL_NUMBER) {
+                stable[i] = false;
+                changed = true;
+            }
+        }
+    }
+    
+    if (compiled) loop->trace = (JitFunction)install_code(&tc.as);
+    
+    free(stable);
+    free(tc.types);
+    free_assembler(&tc.as);
+    return loop->trace != NULL;
+}
+
+/* ---- Recording ---- */
+
+static void finish_recording(VM* vm, CallFrame* frame) {
+    LoopTrace* loop = recorder.loop;
+    if (vm->stack_top - frame->slots != recorder.entry_depth || !compile_trace(loop)) {
+        abort_recording();
+        return;
+    }
+    
+    recorded_count++;
+    stop_recording();
+}
+
+void record_instruction(VM* vm, CallFrame* frame) {
+    LoopTrace* loop = recorder.loop;
+    if (vm->frame_count != recorder.frame_count || frame->function != loop->function) {
+        abort_recording();
+        return;
+    }
+    
+    uint8_t* ip = frame->ip;
+    if (ip == loop->header && recorder.count > 0) {
+        finish_recording(vm, frame);
+        return;
+    }
+    
+    /*
+     * Leaving the loop only means this iteration was its last, so the
+     * recording is dropped without counting against the loop. A call or
+     * an inner loop makes the loop untraceable: only innermost loops
+     * without calls are compiled.
+     */
+    if (*ip == OP_RETURN || ip < loop->header || ip > recorder.backedge) {
+        stop_recording();
+        return;
+    }
+    
+    size_t target;
+    switch (*ip) {
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            abort_recording();
+            return;
+        case OP_LOOP:
+        case OP_LOOP_LONG:
+            instruction_jump_target(ip, ip - loop->function->code, &target);
+            if (&loop->function->code[target] != loop->header) {
+                abort_recording();
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    if (recorder.count == TRACE_MAX_LENGTH) {
+        abort_recording();
+        return;
+    }
+    
+    if (recorder.capacity < recorder.count + 1) {
+        int old_capacity = recorder.capacity;
+        recorder.capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        recorder.steps = realloc(recorder.steps, recorder.capacity * sizeof(TraceStep));
+    }
+    
+    TraceStep* step = &recorder.steps[recorder.count++];
+    step->offset = (uint32_t)(ip - loop->function->code);
+    step->types[0] = UNKNOWN;
+    step->types[1] = UNKNOWN;
+    
+    uint32_t operand = read_operand(ip);
+    switch (*ip) {
+        case OP_GET_LOCAL:
+            step->types[0] = frame->slots[operand].type;
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            step->types[0] = global_slots.values[operand].type;
+            break;
+        case OP_ADD_LOCALS:
+            step->types[0] = frame->slots[operand >> 8].type;
+            step->types[1] = frame->slots[operand & 0xff].type;
+            break;
+        case OP_LESS_LOCAL_CONSTANT:
+            step->types[0] = frame->slots[operand >> 8].type;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Called on every backedge the interpreter takes, with frame->ip at the
+ * loop header. Returns the loop's trace to run, if it has one.
+ */
+JitFunction loop_backedge(VM* vm, CallFrame* frame) {
+    LoopTrace* loop = find_loop(frame->function, frame->ip);
+    
+    if (loop->trace != NULL) {
+        if (loop->entries >= TRACE_PROBATION && loop->iterations < loop->entries) {
+            blacklist(loop);
+            return NULL;
+        }
+        return loop->trace;
+    }
+    
+    if (loop->blacklisted || --loop->countdown > 0) return NULL;
+    loop->countdown = TRACE_THRESHOLD;
+    if (!trace_recording) start_recording(vm, frame, loop);
+    return NULL;
+}
+
+/* ---- Statistics ---- */
+
+void print_trace_stats() {
+    fprintf(stderr, "== trace stats ==\n");
+    fprintf(stderr, "%-32s %12s %12s %12s %12s\n", "loop", "entries", "iterations",
+            "guard exits", "branch exits");
+    
+    for (int i = 0; i < cache_capacity; i++) {
+        LoopTrace* loop = cache[i];
+        if (loop == NULL || (loop->entries == 0 && !loop->blacklisted)) continue;
+        
+        ObjFunction* function = loop->function;
+        char name[64];
+        snprintf(name, sizeof(name), "%s@%d%s",
+                 function->name == NULL ? "script" : function->name->chars,
+                 (int)(loop->header - function->code),
+                 loop->blacklisted ? " (blacklisted)" : "");
+        fprintf(stderr, "%-32s %12llu %12llu %12llu %12llu\n", name,
+                (unsigned long long)loop->entries, (unsigned long long)loop->iterations,
+                (unsigned long long)loop->guard_exits, (unsigned long long)loop->branch_exits);
+    }
+    fprintf(stderr, "%d recorded, %d aborted, %d blacklisted\n",
+            recorded_count, aborted_count, blacklisted_count);
+}
+
+void sweep_traces() {
+    bool dropped = false;
+    for (int i = 0; i < cache_capacity; i++) {
+        LoopTrace* loop = cache[i];
+        if (loop == NULL || loop->function->obj.marked) continue;
+        
+        if (loop->trace != NULL) release_code((void*)loop->trace);
+        if (recorder.loop == loop) stop_recording();
+        free(loop);
+        cache[i] = NULL;
+        cache_count--;
+        dropped = true;
+    }
+    
+    /* Probing stops at an empty entry, so the survivors are placed again. */
+    if (dropped) {
+        last_loop = NULL;
+        adjust_capacity(cache_capacity);
+    }
+}
+
+void free_traces() {
+    for (int i = 0; i < cache_capacity; i++) free(cache[i]);
+    free(cache);
+    cache = NULL;
+    last_loop = NULL;
+    cache_count = 0;
+    cache_capacity = 0;
+    
+    free(recorder.steps);
+    free(recorder.entry_types);
+    recorder.steps = NULL;
+    recorder.entry_types = NULL;
+    recorder.capacity = 0;
+    stop_recording();
+}
+
+#endif
@@ -6,14 +6,48 @@
 #include "../../include/algo_vm.h"
 #include "../../include/algo_compiler.h"
 #include "../../include/algo_bytecode.h"
+#include "../../include/algo_jit.h"
+#include "../../include/algo_register.h"
+#include "../../include/algo_memory.h"
 
 static VM vm;
 
+#ifdef ALGO_JIT
+/* Native frames currently on the C stack. */
+static int jit_depth = 0;
+#endif
+
 static void reset_stack() {
     vm.stack_top = vm.stack;
     vm.frame_count = 0;
 }
 
+static void grow_stack(size_t needed) {
+    size_t capacity = vm.stack_capacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > vm.stack_limit) capacity = vm.stack_limit;
+    
+    Value* stack = malloc(capacity * sizeof(Value));
+    memcpy(stack, vm.stack, (vm.stack_top - vm.stack) * sizeof(Value));
+    
+    for (int i = 0; i < vm.frame_count; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    }
+    vm.stack_top = stack + (vm.stack_top - vm.stack);
+    
+    free(vm.stack);
+    vm.stack = stack;
+    vm.stack_capacity = capacity;
+}
+
+static void grow_frames() {
+    int capacity = vm.frame_capacity * 2;
+    if (capacity > vm.frame_limit) capacity = vm.frame_limit;
+    
+    vm.frames = realloc(vm.frames, capacity * sizeof(CallFrame));
+    vm.frame_capacity = capacity;
+}
+
 static void runtime_error(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -21,11 +55,23 @@ static void runtime_error(const char* format, ...) {
     va_end(args);
     fputs("\n", stderr);
     
+#ifdef ALGO_JIT
+    abort_recording();
+#endif
     for (int i = vm.frame_count - 1; i >= 0; i--) {
+        /* Deep recursion would bury the message; show only both ends of the trace. */
+        if (vm.frame_count > 2 * TRACE_EDGE && i == vm.frame_count - 1 - TRACE_EDGE) {
+            fprintf(stderr, "... %d more frames ...\n", vm.frame_count - 2 * TRACE_EDGE);
+            i = TRACE_EDGE;
+            continue;
+        }
+        
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        size_t instruction = frame->ip - function->code - 1;
+        LineCursor position = {0, 0, 0, 0};
+        find_position(&function->chunk.lines, instruction, &position);
+        fprintf(stderr, "[line %d:%d] in ", position.line, position.column);
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -36,13 +82,161 @@ static void runtime_error(const char* format, ...) {
     reset_stack();
 }
 
+#ifdef ALGO_DISPATCH_STATS
+static uint64_t dispatch_counts[256];
+
+static void print_dispatch_stats() {
+    uint64_t total = 0;
+    for (int i = 0; i < 256; i++) total += dispatch_counts[i];
+    if (total == 0) return;
+    
+#ifdef ALGO_COMPUTED_GOTO
+    fprintf(stderr, "== dispatch stats (threaded) ==\n");
+#else
+    fprintf(stderr, "== dispatch stats (switch) ==\n");
+#endif
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (dispatch_counts[i] == 0) continue;
+        fprintf(stderr, "%-24s %12llu  %5.1f%%\n", op_info[i].name,
+                (unsigned long long)dispatch_counts[i],
+                100.0 * dispatch_counts[i] / total);
+    }
+    fprintf(stderr, "%-24s %12llu\n", "total", (unsigned long long)total);
+}
+
+#define COUNT_DISPATCH(op) (dispatch_counts[(op)]++)
+#else
+#define COUNT_DISPATCH(op) ((void)0)
+#endif
+
+#ifdef ALGO_CHECK_STACK
+static const uint8_t* checked_ip = NULL;
+static Value* checked_sp;
+static int checked_frame_count;
+
+/*
+ * Aborts if the instruction dispatched before this one did not move the
+ * stack top by its stack effect in op_info. Calls, returns and backedges
+ * (which may run a trace) change frames or state outside the instruction,
+ * and a deoptimized instruction has not run yet, so those are skipped.
+ */
+static void check_stack(const uint8_t* ip, Value* sp) {
+    if (checked_ip != NULL && ip != checked_ip && vm.frame_count == checked_frame_count) {
+        uint8_t op = *checked_ip;
+        if (op != OP_CALL && op != OP_TAIL_CALL && op != OP_RETURN &&
+            op != OP_LOOP && op != OP_LOOP_LONG && sp - checked_sp != op_info[op].stack_effect) {
+            fprintf(stderr, "%s moved the stack by %d, expected %d\n", op_info[op].name,
+                    (int)(sp - checked_sp), op_info[op].stack_effect);
+            abort();
+        }
+    }
+    checked_ip = ip;
+    checked_sp = sp;
+    checked_frame_count = vm.frame_count;
+}
+
+#define CHECK_STACK() check_stack(ip, sp)
+#else
+#define CHECK_STACK() ((void)0)
+#endif
+
 void init_vm() {
+    vm.stack_capacity = STACK_INITIAL;
+    vm.stack_limit = STACK_MAX_DEFAULT;
+    vm.stack = malloc(vm.stack_capacity * sizeof(Value));
+    
+    vm.frame_capacity = FRAMES_INITIAL;
+    vm.frame_limit = FRAMES_MAX_DEFAULT;
+    vm.frames = malloc(vm.frame_capacity * sizeof(CallFrame));
+    
+    vm.tail_calls = true;
+    vm.quicken = true;
+    
+    /* Dispatch statistics count interpreted instructions, so they run without the JIT. */
+#if defined(ALGO_JIT) && !defined(ALGO_DISPATCH_STATS)
+    vm.jit = true;
+#else
+    vm.jit = false;
+#endif
+    vm.traces = vm.jit;
+    vm.trace_stats = false;
+    vm.registers = false;
+    
     reset_stack();
     vm.objects = NULL;
 }
 
+void set_stack_limits(size_t max_values, int max_frames) {
+    if (max_values > 0) vm.stack_limit = max_values < STACK_INITIAL ? STACK_INITIAL : max_values;
+    if (max_frames > 0) vm.frame_limit = max_frames < FRAMES_INITIAL ? FRAMES_INITIAL : max_frames;
+}
+
+void set_tail_calls(bool enabled) {
+    vm.tail_calls = enabled;
+}
+
+void set_quicken(bool enabled) {
+    vm.quicken = enabled;
+}
+
+void set_jit(bool enabled) {
+#ifdef ALGO_JIT
+    vm.jit = enabled;
+    vm.traces = enabled;
+#else
+    if (enabled) fprintf(stderr, "This build has no JIT; running interpreted\n");
+#endif
+}
+
+/* Call after set_jit(): traces need the JIT, and --no-jit turns them off too. */
+void set_traces(bool enabled, bool stats) {
+#ifdef ALGO_JIT
+    vm.traces = vm.jit && enabled;
+    vm.trace_stats = stats;
+#else
+    (void)enabled;
+    (void)stats;
+#endif
+}
+
+void set_registers(bool enabled) {
+    vm.registers = enabled;
+}
+
 void free_vm() {
+#ifdef ALGO_DISPATCH_STATS
+    print_dispatch_stats();
+#endif
+    free_register_vm();
     free_globals();
+    free(vm.stack);
+    free(vm.frames);
+#ifdef ALGO_JIT
+    if (vm.trace_stats) print_trace_stats();
+    free_jit();
+#endif
+}
+
+/*
+ * run() may hold a newer stack top in a local, so it stores it back
+ * before it allocates, and vm.stack_top is current whenever this is called.
+ * The register VM keeps its stack top here too, and both keep each
+ * frame's function in its slot 0.
+ */
+void mark_vm_roots() {
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+        mark_value(*slot);
+    }
+    for (int i = 0; i < vm.frame_count; i++) {
+        mark_object((Obj*)vm.frames[i].function);
+    }
+}
+
+/* Frames' functions are never young, so only the stack can point into the nursery. */
+void forward_vm_roots() {
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
+        forward_value(slot);
+    }
 }
 
 void push(Value value) {
@@ -55,29 +249,58 @@ Value pop() {
     return *vm.stack_top;
 }
 
-static Value peek(int distance) {
-    return vm.stack_top[-1 - distance];
-}
-
 static bool is_falsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+static bool reserve_slots(Value* slots, ObjFunction* function) {
+    size_t needed = (slots - vm.stack) + function->max_slots;
+    if (needed > vm.stack_capacity) {
+        if (needed > vm.stack_limit) {
+            runtime_error("Stack overflow");
+            return false;
+        }
+        grow_stack(needed);
+    }
+    return true;
+}
+
+/* Counts calls into a function and compiles it once it turns out to be hot. */
+static void count_call(ObjFunction* function) {
+#ifdef ALGO_JIT
+    if (vm.jit && function->native == NULL && ++function->call_count == JIT_THRESHOLD) {
+        jit_compile(function);
+    }
+#else
+    (void)function;
+#endif
+}
+
 static bool call(ObjFunction* function, int arg_count) {
     if (arg_count != function->arity) {
         runtime_error("Expected %d arguments but got %d", function->arity, arg_count);
         return false;
     }
     
-    if (vm.frame_count == FRAMES_MAX) {
-        runtime_error("Stack overflow");
+    if (vm.frame_count == vm.frame_capacity) {
+        if (vm.frame_capacity == vm.frame_limit) {
+            runtime_error("Stack overflow");
+            return false;
+        }
+        grow_frames();
+    }
+    
+    if (function->pending != NULL && !compile_pending(function)) {
+        runtime_error("Could not compile %s()", function->name->chars);
         return false;
     }
+    if (!reserve_slots(vm.stack_top - arg_count - 1, function)) return false;
     
     CallFrame* frame = &vm.frames[vm.frame_count++];
     frame->function = function;
-    frame->ip = function->chunk.code;
+    frame->ip = function->code;
     frame->slots = vm.stack_top - arg_count - 1;
+    count_call(function);
     return true;
 }
 
@@ -101,188 +324,630 @@ static bool call_value(Value callee, int arg_count) {
     return false;
 }
 
-extern bool global_get(ObjString* key, Value* value);
-extern void global_set(ObjString* key, Value value);
-extern bool global_delete(ObjString* key);
-extern void free_globals();
+#ifdef ALGO_JIT
+static JitStatus enter_native(ObjFunction* function) {
+    jit_depth++;
+    JitStatus status = ((JitFunction)function->native)(&vm);
+    jit_depth--;
+    return status;
+}
+#endif
 
-static InterpretResult run() {
-    CallFrame* frame = &vm.frames[vm.frame_count - 1];
+/*
+ * Runs frames until the frame count drops back to `base_frame`. The
+ * script runs with a base of 0; native code that calls a function it
+ * could not enter natively runs that callee with its own frame as base.
+ */
+static InterpretResult run(int base_frame) {
+    /*
+     * The current frame's ip and slots and the stack top live in locals,
+     * so handlers work on registers instead of `vm`. STORE_FRAME() writes
+     * them back before anything else looks at the VM (calls, natives,
+     * traces and runtime errors); LOAD_FRAME() picks them up afterwards,
+     * possibly for a different frame.
+     */
+    CallFrame* frame;
+    uint8_t* ip;
+    Value* slots;
+    Value* sp;
     
-#define READ_BYTE() (*frame->ip++)
+#define STORE_FRAME() (frame->ip = ip, vm.stack_top = sp)
+#define LOAD_FRAME() \
+    (frame = &vm.frames[vm.frame_count - 1], ip = frame->ip, slots = frame->slots, sp = vm.stack_top)
+    LOAD_FRAME();
+#ifdef ALGO_CHECK_STACK
+    /* A run that ended in a runtime error left its last instruction unfinished. */
+    checked_ip = NULL;
+#endif
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define RUNTIME_ERROR(...) (STORE_FRAME(), runtime_error(__VA_ARGS__))
+#define READ_BYTE() (*ip++)
 #define READ_SHORT() \
-    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_INDEX() \
+    (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define READ_LONG() \
+    (ip += 4, ((uint32_t)ip[-4] << 24) | (uint32_t)((ip[-3] << 16) | \
+                     (ip[-2] << 8) | ip[-1]))
 #define READ_CONSTANT() (frame->function->chunk.constants[READ_BYTE()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(value_type, op) \
+#define NEXT_OPCODE() (CHECK_STACK(), COUNT_DISPATCH(*ip), RECORD(), READ_BYTE())
+/*
+ * Type feedback: a generic arithmetic or comparison instruction whose
+ * operands turn out to be numbers rewrites its opcode in the function's
+ * executable copy to the `quick` form, which skips the dispatch-time type
+ * tests and works on the stack in place. If the quick form later meets
+ * a non-number it writes the generic opcode back and re-executes it.
+ */
+#define QUICKEN(length, quick) \
     do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtime_error("Operands must be numbers"); \
+        if (vm.quicken) ip[-(length)] = (quick); \
+    } while (false)
+#define DEOPTIMIZE(generic) (ip[-1] = (generic), ip--)
+#define NUMBERS_ON_TOP() (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2]))
+#define BINARY_OP(value_type, op, quick) \
+    do { \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            RUNTIME_ERROR("Operands must be numbers"); \
             return INTERPRET_RUNTIME_ERROR; \
         } \
-        double b = AS_NUMBER(pop()); \
-        double a = AS_NUMBER(pop()); \
-        push(value_type(a op b)); \
+        QUICKEN(1, quick); \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        PUSH(value_type(a op b)); \
+    } while (false)
+/* Not wrapped in do/while: DISPATCH() is `continue` in the switch build. */
+#define QUICK_BINARY_OP(value_type, op, generic) \
+    if (!NUMBERS_ON_TOP()) { \
+        DEOPTIMIZE(generic); \
+    } else { \
+        double b = AS_NUMBER(sp[-1]); \
+        sp--; \
+        sp[-1] = value_type(AS_NUMBER(sp[-1]) op b); \
+    }
+/* `a >= b` is `!(a < b)`, as it was before the compare and NOT were fused. */
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+#define COMPARE_JUMP(condition, quick) \
+    do { \
+        uint16_t offset = READ_SHORT(); \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            RUNTIME_ERROR("Operands must be numbers"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        QUICKEN(3, quick); \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        if (condition) ip += offset; \
+    } while (false)
+#define QUICK_COMPARE_JUMP(condition, generic) \
+    if (!NUMBERS_ON_TOP()) { \
+        DEOPTIMIZE(generic); \
+    } else { \
+        uint16_t offset = READ_SHORT(); \
+        double b = AS_NUMBER(sp[-1]); \
+        double a = AS_NUMBER(sp[-2]); \
+        sp -= 2; \
+        if (condition) ip += offset; \
+    }
+/*
+ * A freshly entered frame whose function has native code runs natively.
+ * A tail call replaces the base frame itself, so when native code returns
+ * from it this run is done; the frame below belongs to whoever called run().
+ */
+#ifdef ALGO_JIT
+#define ENTER_NATIVE() \
+    do { \
+        if (frame->function->native != NULL && ip == frame->function->code && \
+            jit_depth < JIT_MAX_DEPTH) { \
+            STORE_FRAME(); \
+            if (enter_native(frame->function) == JIT_ERROR) return INTERPRET_RUNTIME_ERROR; \
+            if (vm.frame_count == base_frame) return INTERPRET_OK; \
+            LOAD_FRAME(); \
+        } \
+    } while (false)
+/* A backedge may start recording its loop or enter the loop's trace. */
+#define TRACE_BACKEDGE() \
+    do { \
+        if (vm.traces) { \
+            STORE_FRAME(); \
+            JitFunction trace = loop_backedge(&vm, frame); \
+            if (trace != NULL) { \
+                trace(&vm); \
+                LOAD_FRAME(); \
+            } \
+        } \
     } while (false)
+#define RECORD() (trace_recording ? (STORE_FRAME(), record_instruction(&vm, frame)) : (void)0)
+#else
+#define ENTER_NATIVE() ((void)0)
+#define TRACE_BACKEDGE() ((void)0)
+#define RECORD() ((void)0)
+#endif
+
+/*
+ * With computed goto every handler ends in its own indirect jump through
+ * dispatch_table, so the branch predictor sees one branch per opcode
+ * instead of a single shared one, and there is no switch bounds check.
+ * The switch form is kept for compilers without labels-as-values.
+ */
+#ifdef ALGO_COMPUTED_GOTO
+    static void* dispatch_table[] = {
+        [OP_CONSTANT]      = &&op_OP_CONSTANT,
+        [OP_NIL]           = &&op_OP_NIL,
+        [OP_TRUE]          = &&op_OP_TRUE,
+        [OP_FALSE]         = &&op_OP_FALSE,
+        [OP_POP]           = &&op_OP_POP,
+        [OP_GET_LOCAL]     = &&op_OP_GET_LOCAL,
+        [OP_SET_LOCAL]     = &&op_OP_SET_LOCAL,
+        [OP_GET_GLOBAL]    = &&op_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL]    = &&op_OP_SET_GLOBAL,
+        [OP_EQUAL]         = &&op_OP_EQUAL,
+        [OP_GREATER]       = &&op_OP_GREATER,
+        [OP_LESS]          = &&op_OP_LESS,
+        [OP_ADD]           = &&op_OP_ADD,
+        [OP_SUBTRACT]      = &&op_OP_SUBTRACT,
+        [OP_MULTIPLY]      = &&op_OP_MULTIPLY,
+        [OP_DIVIDE]        = &&op_OP_DIVIDE,
+        [OP_MODULO]        = &&op_OP_MODULO,
+        [OP_NOT]           = &&op_OP_NOT,
+        [OP_NEGATE]        = &&op_OP_NEGATE,
+        [OP_PRINT]         = &&op_OP_PRINT,
+        [OP_JUMP]          = &&op_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE,
+        [OP_LOOP]          = &&op_OP_LOOP,
+        [OP_CALL]          = &&op_OP_CALL,
+        [OP_RETURN]        = &&op_OP_RETURN,
+        [OP_TAIL_CALL]     = &&op_OP_TAIL_CALL,
+        [OP_CONSTANT_LONG]      = &&op_OP_CONSTANT_LONG,
+        [OP_GET_GLOBAL_LONG]    = &&op_OP_GET_GLOBAL_LONG,
+        [OP_DEFINE_GLOBAL_LONG] = &&op_OP_DEFINE_GLOBAL_LONG,
+        [OP_SET_GLOBAL_LONG]    = &&op_OP_SET_GLOBAL_LONG,
+        [OP_JUMP_LONG]          = &&op_OP_JUMP_LONG,
+        [OP_JUMP_IF_FALSE_LONG] = &&op_OP_JUMP_IF_FALSE_LONG,
+        [OP_LOOP_LONG]          = &&op_OP_LOOP_LONG,
+        [OP_GREATER_EQUAL]      = &&op_OP_GREATER_EQUAL,
+        [OP_LESS_EQUAL]         = &&op_OP_LESS_EQUAL,
+        [OP_NOT_EQUAL]          = &&op_OP_NOT_EQUAL,
+        [OP_JUMP_IF_LESS]       = &&op_OP_JUMP_IF_LESS,
+        [OP_JUMP_IF_NOT_LESS]   = &&op_OP_JUMP_IF_NOT_LESS,
+        [OP_JUMP_IF_GREATER]    = &&op_OP_JUMP_IF_GREATER,
+        [OP_JUMP_IF_NOT_GREATER] = &&op_OP_JUMP_IF_NOT_GREATER,
+        [OP_JUMP_IF_EQUAL]      = &&op_OP_JUMP_IF_EQUAL,
+        [OP_JUMP_IF_NOT_EQUAL]  = &&op_OP_JUMP_IF_NOT_EQUAL,
+        [OP_ADD_LOCALS]         = &&op_OP_ADD_LOCALS,
+        [OP_LESS_LOCAL_CONSTANT] = &&op_OP_LESS_LOCAL_CONSTANT,
+        [OP_ADD_NUMBER]           = &&op_OP_ADD_NUMBER,
+        [OP_SUBTRACT_NUMBER]      = &&op_OP_SUBTRACT_NUMBER,
+        [OP_MULTIPLY_NUMBER]      = &&op_OP_MULTIPLY_NUMBER,
+        [OP_DIVIDE_NUMBER]        = &&op_OP_DIVIDE_NUMBER,
+        [OP_MODULO_NUMBER]        = &&op_OP_MODULO_NUMBER,
+        [OP_GREATER_NUMBER]       = &&op_OP_GREATER_NUMBER,
+        [OP_LESS_NUMBER]          = &&op_OP_LESS_NUMBER,
+        [OP_GREATER_EQUAL_NUMBER] = &&op_OP_GREATER_EQUAL_NUMBER,
+        [OP_LESS_EQUAL_NUMBER]    = &&op_OP_LESS_EQUAL_NUMBER,
+        [OP_JUMP_IF_LESS_NUMBER]        = &&op_OP_JUMP_IF_LESS_NUMBER,
+        [OP_JUMP_IF_NOT_LESS_NUMBER]    = &&op_OP_JUMP_IF_NOT_LESS_NUMBER,
+        [OP_JUMP_IF_GREATER_NUMBER]     = &&op_OP_JUMP_IF_GREATER_NUMBER,
+        [OP_JUMP_IF_NOT_GREATER_NUMBER] = &&op_OP_JUMP_IF_NOT_GREATER_NUMBER
+    };
     
-    while (true) {
-        uint8_t instruction = READ_BYTE();
-        
-        switch (instruction) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
+#define DISPATCH_LOOP() DISPATCH();
+#define CASE(op) op_##op
+#define DISPATCH() goto *dispatch_table[NEXT_OPCODE()]
+#else
+#define DISPATCH_LOOP() for (;;) switch (NEXT_OPCODE())
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+    
+    DISPATCH_LOOP() {
+        CASE(OP_CONSTANT): {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE(OP_NIL):
+            PUSH(NIL_VAL);
+            DISPATCH();
+        CASE(OP_TRUE):
+            PUSH(BOOL_VAL(true));
+            DISPATCH();
+        CASE(OP_FALSE):
+            PUSH(BOOL_VAL(false));
+            DISPATCH();
+        CASE(OP_POP):
+            sp--;
+            DISPATCH();
+        CASE(OP_GET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            PUSH(slots[slot]);
+            DISPATCH();
+        }
+        CASE(OP_SET_LOCAL): {
+            uint8_t slot = READ_BYTE();
+            slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            Value value = global_slots.values[slot];
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'", global_slots.names[slot]->chars);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_NIL:
-                push(NIL_VAL);
-                break;
-            case OP_TRUE:
-                push(BOOL_VAL(true));
-                break;
-            case OP_FALSE:
-                push(BOOL_VAL(false));
-                break;
-            case OP_POP:
-                pop();
-                break;
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(OP_DEFINE_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            global_slots.values[slot] = PEEK(0);
+            write_barrier(PEEK(0));
+            sp--;
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            if (IS_UNDEFINED(global_slots.values[slot])) {
+                RUNTIME_ERROR("Undefined variable '%s'", global_slots.names[slot]->chars);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
+            global_slots.values[slot] = PEEK(0);
+            write_barrier(PEEK(0));
+            DISPATCH();
+        }
+        CASE(OP_EQUAL): {
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(values_equal(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_GREATER):
+            BINARY_OP(BOOL_VAL, >, OP_GREATER_NUMBER);
+            DISPATCH();
+        CASE(OP_LESS):
+            BINARY_OP(BOOL_VAL, <, OP_LESS_NUMBER);
+            DISPATCH();
+        CASE(OP_ADD):
+            BINARY_OP(NUMBER_VAL, +, OP_ADD_NUMBER);
+            DISPATCH();
+        CASE(OP_SUBTRACT):
+            BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUMBER);
+            DISPATCH();
+        CASE(OP_MULTIPLY):
+            BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUMBER);
+            DISPATCH();
+        CASE(OP_DIVIDE):
+            BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUMBER);
+            DISPATCH();
+        CASE(OP_MODULO): {
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+                RUNTIME_ERROR("Operands must be numbers");
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!global_get(name, &value)) {
-                    runtime_error("Undefined variable '%s'", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                push(value);
-                break;
+            QUICKEN(1, OP_MODULO_NUMBER);
+            double b = AS_NUMBER(POP());
+            double a = AS_NUMBER(POP());
+            PUSH(NUMBER_VAL(fmod(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_NOT):
+            sp[-1] = BOOL_VAL(is_falsey(sp[-1]));
+            DISPATCH();
+        CASE(OP_NEGATE):
+            if (!IS_NUMBER(PEEK(0))) {
+                RUNTIME_ERROR("Operand must be a number");
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                global_set(name, peek(0));
-                pop();
-                break;
+            sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+            DISPATCH();
+        CASE(OP_PRINT): {
+            print_value(POP());
+            printf("\n");
+            DISPATCH();
+        }
+        CASE(OP_JUMP): {
+            uint16_t offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_FALSE): {
+            uint16_t offset = READ_SHORT();
+            if (is_falsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_LOOP): {
+            uint16_t offset = READ_SHORT();
+            ip -= offset;
+            TRACE_BACKEDGE();
+            DISPATCH();
+        }
+        CASE(OP_CALL): {
+            int arg_count = READ_BYTE();
+            STORE_FRAME();
+            if (!call_value(PEEK(arg_count), arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!global_get(name, &value)) {
-                    runtime_error("Undefined variable '%s'", name->chars);
+            LOAD_FRAME();
+            ENTER_NATIVE();
+            DISPATCH();
+        }
+        CASE(OP_TAIL_CALL): {
+            int arg_count = READ_BYTE();
+            Value callee = PEEK(arg_count);
+            
+            /*
+             * A script function replaces the current frame: the callee and
+             * its arguments slide down over the caller's slots and execution
+             * restarts at the callee's first instruction. Anything else is
+             * an ordinary call, and the OP_RETURN that follows returns its result.
+             */
+            if (vm.tail_calls && IS_FUNCTION(callee)) {
+                ObjFunction* function = AS_FUNCTION(callee);
+                if (arg_count != function->arity) {
+                    RUNTIME_ERROR("Expected %d arguments but got %d", function->arity, arg_count);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                global_set(name, peek(0));
-                break;
-            }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(values_equal(a, b)));
-                break;
-            }
-            case OP_GREATER:
-                BINARY_OP(BOOL_VAL, >);
-                break;
-            case OP_LESS:
-                BINARY_OP(BOOL_VAL, <);
-                break;
-            case OP_ADD:
-                BINARY_OP(NUMBER_VAL, +);
-                break;
-            case OP_SUBTRACT:
-                BINARY_OP(NUMBER_VAL, -);
-                break;
-            case OP_MULTIPLY:
-                BINARY_OP(NUMBER_VAL, *);
-                break;
-            case OP_DIVIDE:
-                BINARY_OP(NUMBER_VAL, /);
-                break;
-            case OP_MODULO: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtime_error("Operands must be numbers");
+                
+                memmove(slots, sp - arg_count - 1, (arg_count + 1) * sizeof(Value));
+                sp = slots + arg_count + 1;
+                STORE_FRAME();
+                if (function->pending != NULL && !compile_pending(function)) {
+                    runtime_error("Could not compile %s()", function->name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(fmod(a, b)));
-                break;
-            }
-            case OP_NOT:
-                push(BOOL_VAL(is_falsey(pop())));
-                break;
-            case OP_NEGATE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtime_error("Operand must be a number");
+                if (!reserve_slots(slots, function)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            case OP_PRINT: {
-                print_value(pop());
-                printf("\n");
-                break;
+                
+                frame->function = function;
+                frame->ip = function->code;
+                count_call(function);
+                LOAD_FRAME();
+                ENTER_NATIVE();
+                DISPATCH();
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+            
+            STORE_FRAME();
+            if (!call_value(callee, arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (is_falsey(peek(0))) frame->ip += offset;
-                break;
+            LOAD_FRAME();
+            ENTER_NATIVE();
+            DISPATCH();
+        }
+        CASE(OP_RETURN): {
+            Value result = POP();
+            vm.frame_count--;
+            if (vm.frame_count == 0) {
+                vm.stack_top = sp - 1;
+                return INTERPRET_OK;
             }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+            
+            sp = slots;
+            PUSH(result);
+            vm.stack_top = sp;
+            if (vm.frame_count == base_frame) return INTERPRET_OK;
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        CASE(OP_CONSTANT_LONG): {
+            uint32_t index = READ_INDEX();
+            PUSH(frame->function->chunk.constants[index]);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_LONG): {
+            uint32_t slot = READ_INDEX();
+            Value value = global_slots.values[slot];
+            if (IS_UNDEFINED(value)) {
+                RUNTIME_ERROR("Undefined variable '%s'", global_slots.names[slot]->chars);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_CALL: {
-                int arg_count = READ_BYTE();
-                if (!call_value(peek(arg_count), arg_count)) {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                frame = &vm.frames[vm.frame_count - 1];
-                break;
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(OP_DEFINE_GLOBAL_LONG): {
+            uint32_t slot = READ_INDEX();
+            global_slots.values[slot] = PEEK(0);
+            write_barrier(PEEK(0));
+            sp--;
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL_LONG): {
+            uint32_t slot = READ_INDEX();
+            if (IS_UNDEFINED(global_slots.values[slot])) {
+                RUNTIME_ERROR("Undefined variable '%s'", global_slots.names[slot]->chars);
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_RETURN: {
-                Value result = pop();
-                vm.frame_count--;
-                if (vm.frame_count == 0) {
-                    pop();
-                    return INTERPRET_OK;
-                }
-                
-                vm.stack_top = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frame_count - 1];
-                break;
+            global_slots.values[slot] = PEEK(0);
+            write_barrier(PEEK(0));
+            DISPATCH();
+        }
+        CASE(OP_JUMP_LONG): {
+            uint32_t offset = READ_LONG();
+            ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_FALSE_LONG): {
+            uint32_t offset = READ_LONG();
+            if (is_falsey(PEEK(0))) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_LOOP_LONG): {
+            uint32_t offset = READ_LONG();
+            ip -= offset;
+            TRACE_BACKEDGE();
+            DISPATCH();
+        }
+        CASE(OP_GREATER_EQUAL):
+            BINARY_OP(NOT_BOOL_VAL, <, OP_GREATER_EQUAL_NUMBER);
+            DISPATCH();
+        CASE(OP_LESS_EQUAL):
+            BINARY_OP(NOT_BOOL_VAL, >, OP_LESS_EQUAL_NUMBER);
+            DISPATCH();
+        CASE(OP_NOT_EQUAL): {
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(!values_equal(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_LESS):
+            COMPARE_JUMP(a < b, OP_JUMP_IF_LESS_NUMBER);
+            DISPATCH();
+        CASE(OP_JUMP_IF_NOT_LESS):
+            COMPARE_JUMP(!(a < b), OP_JUMP_IF_NOT_LESS_NUMBER);
+            DISPATCH();
+        CASE(OP_JUMP_IF_GREATER):
+            COMPARE_JUMP(a > b, OP_JUMP_IF_GREATER_NUMBER);
+            DISPATCH();
+        CASE(OP_JUMP_IF_NOT_GREATER):
+            COMPARE_JUMP(!(a > b), OP_JUMP_IF_NOT_GREATER_NUMBER);
+            DISPATCH();
+        CASE(OP_JUMP_IF_EQUAL): {
+            uint16_t offset = READ_SHORT();
+            Value b = POP();
+            Value a = POP();
+            if (values_equal(a, b)) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_NOT_EQUAL): {
+            uint16_t offset = READ_SHORT();
+            Value b = POP();
+            Value a = POP();
+            if (!values_equal(a, b)) ip += offset;
+            DISPATCH();
+        }
+        CASE(OP_ADD_LOCALS): {
+            Value a = slots[READ_BYTE()];
+            Value b = slots[READ_BYTE()];
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                RUNTIME_ERROR("Operands must be numbers");
+                return INTERPRET_RUNTIME_ERROR;
             }
+            PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+            DISPATCH();
         }
+        CASE(OP_LESS_LOCAL_CONSTANT): {
+            Value a = slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                RUNTIME_ERROR("Operands must be numbers");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            PUSH(BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b)));
+            DISPATCH();
+        }
+        CASE(OP_ADD_NUMBER):
+            QUICK_BINARY_OP(NUMBER_VAL, +, OP_ADD);
+            DISPATCH();
+        CASE(OP_SUBTRACT_NUMBER):
+            QUICK_BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT);
+            DISPATCH();
+        CASE(OP_MULTIPLY_NUMBER):
+            QUICK_BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY);
+            DISPATCH();
+        CASE(OP_DIVIDE_NUMBER):
+            QUICK_BINARY_OP(NUMBER_VAL, /, OP_DIVIDE);
+            DISPATCH();
+        CASE(OP_MODULO_NUMBER):
+            if (!NUMBERS_ON_TOP()) {
+                DEOPTIMIZE(OP_MODULO);
+            } else {
+                double b = AS_NUMBER(sp[-1]);
+                sp--;
+                sp[-1] = NUMBER_VAL(fmod(AS_NUMBER(sp[-1]), b));
+            }
+            DISPATCH();
+        CASE(OP_GREATER_NUMBER):
+            QUICK_BINARY_OP(BOOL_VAL, >, OP_GREATER);
+            DISPATCH();
+        CASE(OP_LESS_NUMBER):
+            QUICK_BINARY_OP(BOOL_VAL, <, OP_LESS);
+            DISPATCH();
+        CASE(OP_GREATER_EQUAL_NUMBER):
+            QUICK_BINARY_OP(NOT_BOOL_VAL, <, OP_GREATER_EQUAL);
+            DISPATCH();
+        CASE(OP_LESS_EQUAL_NUMBER):
+            QUICK_BINARY_OP(NOT_BOOL_VAL, >, OP_LESS_EQUAL);
+            DISPATCH();
+        CASE(OP_JUMP_IF_LESS_NUMBER):
+            QUICK_COMPARE_JUMP(a < b, OP_JUMP_IF_LESS);
+            DISPATCH();
+        CASE(OP_JUMP_IF_NOT_LESS_NUMBER):
+            QUICK_COMPARE_JUMP(!(a < b), OP_JUMP_IF_NOT_LESS);
+            DISPATCH();
+        CASE(OP_JUMP_IF_GREATER_NUMBER):
+            QUICK_COMPARE_JUMP(a > b, OP_JUMP_IF_GREATER);
+            DISPATCH();
+        CASE(OP_JUMP_IF_NOT_GREATER_NUMBER):
+            QUICK_COMPARE_JUMP(!(a > b), OP_JUMP_IF_NOT_GREATER);
+            DISPATCH();
     }
     
+    return INTERPRET_RUNTIME_ERROR;
+    
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef RUNTIME_ERROR
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_INDEX
+#undef READ_LONG
 #undef READ_CONSTANT
-#undef READ_STRING
+#undef NEXT_OPCODE
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef NUMBERS_ON_TOP
 #undef BINARY_OP
+#undef QUICK_BINARY_OP
+#undef NOT_BOOL_VAL
+#undef COMPARE_JUMP
+#undef QUICK_COMPARE_JUMP
+#undef ENTER_NATIVE
+#undef TRACE_BACKEDGE
+#undef RECORD
+#undef DISPATCH_LOOP
+#undef CASE
+#undef DISPATCH
 }
 
 InterpretResult interpret(const char* source) {
-    ObjFunction* function = compile(source);
+    ObjFunction* function = vm.registers ? compile_registers(source) : compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
+    return run_script(function);
+}
+
+InterpretResult run_script(ObjFunction* script) {
+    if (script->registers.count > 0) return run_registers(&vm, script);
     
-    push(OBJ_VAL(function));
-    call(function, 0);
+    push(OBJ_VAL(script));
+    call(script, 0);
     
-    return run();
+    return run(0);
+}
+
+#ifdef ALGO_JIT
+/*
+ * OP_CALL from native code. The caller has already stored its ip and
+ * stack top; the callee runs natively when it can and in the
+ * interpreter otherwise. Returns nonzero after a runtime error.
+ */
+int jit_call(int arg_count) {
+    int base_frame = vm.frame_count;
+    if (!call_value(vm.stack_top[-1 - arg_count], arg_count)) return 1;
+    if (vm.frame_count == base_frame) return 0;
+    
+    ObjFunction* function = vm.frames[vm.frame_count - 1].function;
+    if (function->native != NULL && jit_depth < JIT_MAX_DEPTH) {
+        JitStatus status = enter_native(function);
+        if (status == JIT_RETURNED) return 0;
+        if (status == JIT_ERROR) return 1;
+    }
+    return run(base_frame) == INTERPRET_OK ? 0 : 1;
 }
+#endif
@@ -0,0 +1,436 @@
+/* mmap() flags such as MAP_ANONYMOUS are not part of strict C11. */
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../../include/algo_x64.h"
+#include "../../include/algo_bytecode.h"
+#include "../../include/algo_memory.h"
+
+#ifdef ALGO_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct {
+    void* memory;
+    size_t size;
+} CodeRegion;
+
+static CodeRegion* regions = NULL;
+static int region_count = 0;
+static int region_capacity = 0;
+
+void init_assembler(Assembler* as) {
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+    as->fixups = NULL;
+    as->fixup_count = 0;
+    as->fixup_capacity = 0;
+}
+
+void free_assembler(Assembler* as) {
+    free(as->code);
+    free(as->fixups);
+    init_assembler(as);
+}
+
+void emit8(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        size_t old_capacity = as->capacity;
+        as->capacity = old_capacity < 256 ? 256 : old_capacity * 2;
+        as->code = realloc(as->code, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emit8(as, (value >> (i * 8)) & 0xff);
+}
+
+void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emit8(as, (value >> (i * 8)) & 0xff);
+}
+
+void patch32(Assembler* as, size_t at, uint32_t value) {
+    for (int i = 0; i < 4; i++) as->code[at + i] = (value >> (i * 8)) & 0xff;
+}
+
+void add_fixup(Assembler* as, FixupKind kind, size_t offset) {
+    if (as->fixup_capacity < as->fixup_count + 1) {
+        int old_capacity = as->fixup_capacity;
+        as->fixup_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        as->fixups = realloc(as->fixups, as->fixup_capacity * sizeof(Fixup));
+    }
+    
+    Fixup* fixup = &as->fixups[as->fixup_count++];
+    fixup->at = as->count;
+    fixup->kind = kind;
+    fixup->offset = offset;
+    emit32(as, 0);
+}
+
+/*
+ * Emits [prefix] [REX] opcode ModRM for a register and a [base + disp]
+ * memory operand. Opcodes above 0xff are two-byte 0x0F xx opcodes.
+ */
+void emit_op_mem(Assembler* as, uint8_t prefix, bool wide, int opcode,
+                 int reg, int base, int32_t disp) {
+    if (prefix != 0) emit8(as, prefix);
+    
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40) emit8(as, rex);
+    
+    if (opcode > 0xff) emit8(as, (opcode >> 8) & 0xff);
+    emit8(as, opcode & 0xff);
+    
+    int r = reg & 7;
+    int m = base & 7;
+    if (disp == 0 && m != RBP) {
+        emit8(as, (uint8_t)((r << 3) | m));
+        if (m == RSP) emit8(as, 0x24);
+    } else if (disp >= -128 && disp <= 127) {
+        emit8(as, (uint8_t)(0x40 | (r << 3) | m));
+        if (m == RSP) emit8(as, 0x24);
+        emit8(as, (uint8_t)disp);
+    } else {
+        emit8(as, (uint8_t)(0x80 | (r << 3) | m));
+        if (m == RSP) emit8(as, 0x24);
+        emit32(as, (uint32_t)disp);
+    }
+}
+
+/* Same as emit_op_mem() with a register operand in ModRM.rm. */
+void emit_op_reg(Assembler* as, uint8_t prefix, bool wide, int opcode, int reg, int rm) {
+    if (prefix != 0) emit8(as, prefix);
+    
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if (rex != 0x40) emit8(as, rex);
+    
+    if (opcode > 0xff) emit8(as, (opcode >> 8) & 0xff);
+    emit8(as, opcode & 0xff);
+    emit8(as, (uint8_t)(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+void emit_mov_imm64(Assembler* as, int reg, uint64_t value) {
+    emit8(as, 0x48 | ((reg & 8) ? 0x01 : 0));
+    emit8(as, 0xb8 + (reg & 7));
+    emit64(as, value);
+}
+
+void emit_mov_imm32(Assembler* as, int reg, uint32_t value) {
+    if (reg & 8) emit8(as, 0x41);
+    emit8(as, 0xb8 + (reg & 7));
+    emit32(as, value);
+}
+
+void emit_add_imm(Assembler* as, int reg, int32_t value) {
+    if (value >= -128 && value <= 127) {
+        emit_op_reg(as, 0, true, 0x83, 0, reg);
+        emit8(as, (uint8_t)value);
+    } else {
+        emit_op_reg(as, 0, true, 0x81, 0, reg);
+        emit32(as, (uint32_t)value);
+    }
+}
+
+static void emit_push_reg(Assembler* as, int reg) {
+    if (reg & 8) emit8(as, 0x41);
+    emit8(as, 0x50 + (reg & 7));
+}
+
+static void emit_pop_reg(Assembler* as, int reg) {
+    if (reg & 8) emit8(as, 0x41);
+    emit8(as, 0x58 + (reg & 7));
+}
+
+void emit_call(Assembler* as, void* function) {
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)function);
+    emit_op_reg(as, 0, false, 0xff, 2, RAX);
+}
+
+void emit_jump(Assembler* as, FixupKind kind, size_t offset) {
+    emit8(as, 0xe9);
+    add_fixup(as, kind, offset);
+}
+
+void emit_jcc(Assembler* as, int cc, FixupKind kind, size_t offset) {
+    emit8(as, 0x0f);
+    emit8(as, 0x80 + cc);
+    add_fixup(as, kind, offset);
+}
+
+/* Short forward jump within a template; returns the byte to patch. */
+size_t emit_jcc8(Assembler* as, int cc) {
+    emit8(as, 0x70 + cc);
+    emit8(as, 0);
+    return as->count - 1;
+}
+
+void patch_jcc8(Assembler* as, size_t at) {
+    as->code[at] = (uint8_t)(as->count - at - 1);
+}
+
+/* mov rax/r64 and friends, spelled out once so the templates read like assembly. */
+void emit_load(Assembler* as, int reg, int base, int32_t disp) {
+    emit_op_mem(as, 0, true, 0x8b, reg, base, disp);
+}
+
+void emit_store(Assembler* as, int base, int32_t disp, int reg) {
+    emit_op_mem(as, 0, true, 0x89, reg, base, disp);
+}
+
+void emit_store_imm32(Assembler* as, int base, int32_t disp, uint32_t value, bool wide) {
+    emit_op_mem(as, 0, wide, 0xc7, 0, base, disp);
+    emit32(as, value);
+}
+
+/*
+ * Saves the callee-saved registers (which also leaves the stack 16-byte
+ * aligned for calls) and loads the interpreter state of the top frame.
+ */
+void emit_prologue(Assembler* as, Value* constants) {
+    emit_push_reg(as, RBX);
+    emit_push_reg(as, R12);
+    emit_push_reg(as, R13);
+    emit_push_reg(as, R14);
+    emit_push_reg(as, R15);
+    emit_op_reg(as, 0, true, 0x89, RDI, REG_VM);
+    emit_reload(as);
+    emit_mov_imm64(as, REG_CONSTANTS, (uint64_t)(uintptr_t)constants);
+}
+
+/* Emits the shared return path and returns its position; eax holds the status. */
+size_t emit_epilogue(Assembler* as) {
+    size_t epilogue = as->count;
+    emit_pop_reg(as, R15);
+    emit_pop_reg(as, R14);
+    emit_pop_reg(as, R13);
+    emit_pop_reg(as, R12);
+    emit_pop_reg(as, RBX);
+    emit8(as, 0xc3);
+    return epilogue;
+}
+
+/* Loads the current frame, its slots and the stack top from the VM. */
+void emit_reload(Assembler* as) {
+    emit_load(as, REG_FRAME, REG_VM, (int32_t)offsetof(VM, frames));
+    emit_op_mem(as, 0, true, 0x63, RAX, REG_VM, (int32_t)offsetof(VM, frame_count));
+    emit_op_reg(as, 0, true, 0x69, RAX, RAX);
+    emit32(as, (uint32_t)sizeof(CallFrame));
+    emit_op_reg(as, 0, true, 0x01, RAX, REG_FRAME);
+    emit_add_imm(as, REG_FRAME, -(int32_t)sizeof(CallFrame));
+    emit_load(as, REG_SLOTS, REG_FRAME, (int32_t)offsetof(CallFrame, slots));
+    emit_load(as, REG_TOP, REG_VM, (int32_t)offsetof(VM, stack_top));
+}
+
+/* Publishes ip and the stack top so the interpreter or a runtime error sees this frame. */
+void emit_sync(Assembler* as, uint8_t* ip) {
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)ip);
+    emit_store(as, REG_FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+    emit_store(as, REG_VM, (int32_t)offsetof(VM, stack_top), REG_TOP);
+}
+
+void emit_copy_value(Assembler* as, int dst_base, int32_t dst, int src_base, int32_t src) {
+    emit_op_mem(as, 0, false, 0x0f10, XMM0, src_base, src);
+    emit_op_mem(as, 0, false, 0x0f11, XMM0, dst_base, dst);
+}
+
+void emit_push_value(Assembler* as, int base, int32_t disp) {
+    emit_copy_value(as, REG_TOP, 0, base, disp);
+    emit_add_imm(as, REG_TOP, VALUE_SIZE);
+}
+
+void emit_push_literal(Assembler* as, ValueType type, uint32_t payload) {
+    emit_store_imm32(as, REG_TOP, TYPE_OFFSET, type, false);
+    emit_store_imm32(as, REG_TOP, AS_OFFSET, payload, true);
+    emit_add_imm(as, REG_TOP, VALUE_SIZE);
+}
+
+void emit_store_bool_from_al(Assembler* as, int base, int32_t disp) {
+    emit_op_reg(as, 0, false, 0x0fb6, RAX, RAX);
+    emit_store_imm32(as, base, disp + TYPE_OFFSET, VAL_BOOL, false);
+    emit_store(as, base, disp + AS_OFFSET, RAX);
+}
+
+/* write_barrier() on the value at [base + disp]: marks it only while the collector is marking. */
+void emit_write_barrier(Assembler* as, int base, int32_t disp) {
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&gc_marking);
+    emit_op_mem(as, 0, false, 0x80, 7, RAX, 0);
+    emit8(as, 0);
+    size_t not_marking = emit_jcc8(as, CC_E);
+    emit_load(as, RDI, base, disp);
+    emit_load(as, RSI, base, disp + 8);
+    emit_call(as, (void*)mark_value);
+    patch_jcc8(as, not_marking);
+}
+
+/* Leaves native code at `bail` when the type of [base + disp] compares `cc` to `type`. */
+void emit_bail_if_type(Assembler* as, int base, int32_t disp, int cc, ValueType type,
+                       FixupKind kind, size_t bail) {
+    emit_op_mem(as, 0, false, 0x83, 7, base, disp + TYPE_OFFSET);
+    emit8(as, (uint8_t)type);
+    emit_jcc(as, cc, kind, bail);
+}
+
+void emit_check_numbers(Assembler* as, size_t bail) {
+    emit_bail_if_type(as, REG_TOP, TOP(0), CC_NE, VAL_NUMBER, TO_BAIL, bail);
+    emit_bail_if_type(as, REG_TOP, TOP(1), CC_NE, VAL_NUMBER, TO_BAIL, bail);
+}
+
+/* Sets ecx to 1 when the top of the stack is nil or false, like is_falsey(), else 0. */
+void emit_falsey_to_ecx(Assembler* as) {
+    emit_op_reg(as, 0, false, 0x31, RCX, RCX);
+    emit_op_mem(as, 0, false, 0x8b, RAX, REG_TOP, TOP(0) + TYPE_OFFSET);
+    emit_op_reg(as, 0, false, 0x83, 7, RAX);
+    emit8(as, VAL_NIL);
+    size_t is_nil = emit_jcc8(as, CC_E);
+    emit_op_reg(as, 0, false, 0x83, 7, RAX);
+    emit8(as, VAL_BOOL);
+    size_t not_bool = emit_jcc8(as, CC_NE);
+    emit_op_mem(as, 0, false, 0x80, 7, REG_TOP, TOP(0) + AS_OFFSET);
+    emit8(as, 0);
+    size_t is_true = emit_jcc8(as, CC_NE);
+    patch_jcc8(as, is_nil);
+    emit_mov_imm32(as, RCX, 1);
+    patch_jcc8(as, not_bool);
+    patch_jcc8(as, is_true);
+}
+
+/* Calls values_equal() on the top two values; the result is in al. */
+void emit_values_equal(Assembler* as) {
+    emit_load(as, RDI, REG_TOP, TOP(1));
+    emit_load(as, RSI, REG_TOP, TOP(1) + 8);
+    emit_load(as, RDX, REG_TOP, TOP(0));
+    emit_load(as, RCX, REG_TOP, TOP(0) + 8);
+    emit_call(as, (void*)values_equal);
+}
+
+/* addsd, subsd, mulsd or divsd on the top two numbers. */
+void emit_arithmetic(Assembler* as, int opcode, bool checked, size_t bail) {
+    if (checked) emit_check_numbers(as, bail);
+    emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_op_mem(as, 0xf2, false, opcode, XMM0, REG_TOP, TOP(0) + AS_OFFSET);
+    emit_op_mem(as, 0xf2, false, 0x0f11, XMM0, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+}
+
+/*
+ * `a % b` is fmod(a, b). When a is a non-negative integer and b a
+ * nonzero integer (both below 2^63), the integer remainder is the same
+ * value and idiv is much cheaper than the call; anything else, including
+ * -0, NaN and infinities, takes the fmod() path.
+ */
+void emit_modulo(Assembler* as, bool checked, size_t bail) {
+    if (checked) emit_check_numbers(as, bail);
+    emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_op_mem(as, 0xf2, false, 0x0f10, XMM1, REG_TOP, TOP(0) + AS_OFFSET);
+    
+    size_t slow[6];
+    emit_load(as, RAX, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_op_reg(as, 0, true, 0x85, RAX, RAX);
+    slow[0] = emit_jcc8(as, CC_S);
+    emit_op_reg(as, 0xf2, true, 0x0f2c, RAX, XMM0);
+    emit_op_reg(as, 0xf2, true, 0x0f2a, XMM2, RAX);
+    emit_op_reg(as, 0x66, false, 0x0f2e, XMM2, XMM0);
+    slow[1] = emit_jcc8(as, CC_NE);
+    slow[2] = emit_jcc8(as, CC_P);
+    emit_op_reg(as, 0xf2, true, 0x0f2c, RCX, XMM1);
+    emit_op_reg(as, 0, true, 0x85, RCX, RCX);
+    slow[3] = emit_jcc8(as, CC_E);
+    emit_op_reg(as, 0xf2, true, 0x0f2a, XMM2, RCX);
+    emit_op_reg(as, 0x66, false, 0x0f2e, XMM2, XMM1);
+    slow[4] = emit_jcc8(as, CC_NE);
+    slow[5] = emit_jcc8(as, CC_P);
+    emit8(as, 0x48);
+    emit8(as, 0x99);
+    emit_op_reg(as, 0, true, 0xf7, 7, RCX);
+    emit_op_reg(as, 0xf2, true, 0x0f2a, XMM0, RDX);
+    size_t done = as->count;
+    emit8(as, 0xeb);
+    emit8(as, 0);
+    
+    for (int i = 0; i < 6; i++) patch_jcc8(as, slow[i]);
+    emit_call(as, (void*)fmod);
+    as->code[done + 1] = (uint8_t)(as->count - done - 2);
+    
+    emit_op_mem(as, 0xf2, false, 0x0f11, XMM0, REG_TOP, TOP(1) + AS_OFFSET);
+    emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+}
+
+/* Compares the top two numbers; `swap` compares b against a instead of a against b. */
+static void emit_ucomisd(Assembler* as, bool swap) {
+    int32_t a = TOP(1) + AS_OFFSET;
+    int32_t b = TOP(0) + AS_OFFSET;
+    emit_op_mem(as, 0xf2, false, 0x0f10, XMM0, REG_TOP, swap ? b : a);
+    emit_op_mem(as, 0x66, false, 0x0f2e, XMM0, REG_TOP, swap ? a : b);
+}
+
+/* Replaces the top two numbers with the bool given by condition `cc`. */
+void emit_compare(Assembler* as, bool swap, int cc, bool checked, size_t bail) {
+    if (checked) emit_check_numbers(as, bail);
+    emit_ucomisd(as, swap);
+    emit_op_reg(as, 0, false, 0x0f90 + cc, 0, RAX);
+    emit_store_bool_from_al(as, REG_TOP, TOP(1));
+    emit_add_imm(as, REG_TOP, -VALUE_SIZE);
+}
+
+/* Compares and pops the top two numbers, leaving the flags for a Jcc. */
+void emit_compare_pop(Assembler* as, bool swap, bool checked, size_t bail) {
+    if (checked) emit_check_numbers(as, bail);
+    emit_ucomisd(as, swap);
+    emit_op_mem(as, 0, true, 0x8d, REG_TOP, REG_TOP, -2 * VALUE_SIZE);
+}
+
+uint32_t read_operand(const uint8_t* ip) {
+    uint32_t operand = 0;
+    for (int i = 1; i < op_info[ip[0]].length; i++) operand = (operand << 8) | ip[i];
+    return operand;
+}
+
+void* install_code(Assembler* as) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (as->count + page - 1) / page * page;
+    
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    
+    memcpy(memory, as->code, as->count);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+    
+    if (region_capacity < region_count + 1) {
+        int old_capacity = region_capacity;
+        region_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+        regions = realloc(regions, region_capacity * sizeof(CodeRegion));
+    }
+    regions[region_count].memory = memory;
+    regions[region_count].size = size;
+    region_count++;
+    return memory;
+}
+
+void release_code(void* code) {
+    for (int i = region_count - 1; i >= 0; i--) {
+        if (regions[i].memory != code) continue;
+        munmap(regions[i].memory, regions[i].size);
+        regions[i] = regions[--region_count];
+        return;
+    }
+}
+
+void free_code() {
+    for (int i = 0; i < region_count; i++) {
+        munmap(regions[i].memory, regions[i].size);
+    }
+    free(regions);
+    regions = NULL;
+    region_count = 0;
+    region_capacity = 0;
+}
+
+#endif